@@ -2,6 +2,10 @@
 #define RTC_REMOVE 1
 #define RTC_FIND 2
 #define RTC_SYNC 3
+#define RTC_ADD_FRAME 4
+
+#define FRAME_COLS 80
+#define FRAME_ROWS 25
 
 struct mp1_blink_struct {
   unsigned short location;
@@ -13,3 +17,12 @@ struct mp1_blink_struct {
   unsigned short status;
   struct mp1_blink_struct* next;
 } __attribute((packed)); 
+
+/* Argument of RTC_ADD_FRAME. Both frames are laid out like the screen,
+   every cell that is not a space in either one starts blinking. */
+struct mp1_frame_set {
+  unsigned short on_length;
+  unsigned short off_length;
+  char on_chars[FRAME_COLS*FRAME_ROWS];
+  char off_chars[FRAME_COLS*FRAME_ROWS];
+} __attribute((packed));
@@ -5,6 +5,10 @@
 
 #define NULL 0
 #define WAIT 100
+/* tasklet calls timed by the FISH_BENCH build */
+#define BENCH_TICKS 3000
+/* a whole frame file, every row full plus its newline */
+#define FRAME_FILE_MAX ((FRAME_COLS+1)*FRAME_ROWS)
 uint8_t *vmem_base_addr;
 uint8_t *mp1_set_video_mode (void);
 void add_frames(uint8_t *, uint8_t *, int32_t);
@@ -19,13 +23,26 @@ extern int mp1_ioctl(unsigned long arg, unsigned long cmd);
 extern void mp1_rtc_tasklet(unsigned long trash);
 
 static struct mp1_blink_struct blink_array[80*25];
+/* both frames as they go on the screen, for RTC_ADD_FRAME */
+static struct mp1_frame_set frames;
+static uint8_t frame_file[FRAME_FILE_MAX];
+/* unused entries of blink_array, chained through next */
+static struct mp1_blink_struct* blink_free_list;
+
+static void blink_pool_init(void);
+#ifdef FISH_BENCH
+static uint32_t rdtsc_lo(void);
+static void put_num(const char* label, uint32_t n);
+static void bench_add_frames(int32_t rtc_fd);
+static void bench_tasklet(void);
+#endif
 
 int main(void)
 {
     int rtc_fd, ret_val, i, garbage;
     struct mp1_blink_struct blink_struct;
 
-    ece391_memset(blink_array, 0, sizeof(struct mp1_blink_struct)*80*25);
+    blink_pool_init();
 
     if(mp1_set_video_mode() == NULL) {
         return -1;
@@ -33,7 +50,12 @@ int main(void)
 
     rtc_fd = ece391_open((uint8_t*)"rtc");
 
+#ifdef FISH_BENCH
+    bench_add_frames(rtc_fd);
+    bench_tasklet();
+#else
     add_frames(file0, file1, rtc_fd);
+#endif
 
     ret_val = 32;
     ret_val = ece391_write(rtc_fd, &ret_val, 4);
@@ -75,77 +97,98 @@ int main(void)
     return 0;
 }
 
+/*
+ * Reads a frame file with one read and lays it out in frame, starting
+ * at column offset. Lines are cut at the edge of the screen. Halts if
+ * the file cannot be opened.
+ */
+static void
+load_frame(uint8_t *name, char *frame, int32_t offset)
+{
+    int32_t fd, num_bytes, i, row = 0, col = 0;
+
+    if( (fd = ece391_open(name)) < 0 ) {
+        ece391_halt(-1);
+    }
+    num_bytes = ece391_read(fd, frame_file, FRAME_FILE_MAX);
+    ece391_close(fd);
+
+    for(i=0; i<num_bytes && row<FRAME_ROWS; i++) {
+        if(frame_file[i] == '\n') {
+            row++;
+            col = 0;
+            continue;
+        }
+        if(col + offset < FRAME_COLS) {
+            frame[row*FRAME_COLS + col + offset] = frame_file[i];
+        }
+        col++;
+    }
+}
+
 void
 add_frames(uint8_t *f0, uint8_t *f1, int32_t rtc_fd)
 {
-    int32_t row, col, offset = 40, eof0 = 0, eof1 = 0, num_bytes;
-    int32_t fd0, fd1;
-    struct mp1_blink_struct blink_struct;
-    uint8_t c0 = '0', c1 = '0';
+    int32_t offset = 40;
 
-    blink_struct.on_length = 15;
-    blink_struct.off_length = 15;
+    ece391_memset(frames.on_chars, ' ', sizeof(frames.on_chars));
+    ece391_memset(frames.off_chars, ' ', sizeof(frames.off_chars));
+    frames.on_length = 15;
+    frames.off_length = 15;
 
-    row = 0;
+    load_frame(f0, frames.on_chars, offset);
+    load_frame(f1, frames.off_chars, offset);
 
-    if( (fd0 = ece391_open(f0)) < 0 ) {
-        ece391_halt(-1);
-    }
-    if( (fd1 = ece391_open(f1)) < 0 ) {
-        ece391_halt(-1);
-    }
+    mp1_ioctl((unsigned long)&frames, RTC_ADD_FRAME);
+}
 
-    while(eof0 == 0 || eof1 == 0) {
-        col = 0;
-        while(1) {
-
-            if(c0 != '\n') {
-                num_bytes = ece391_read(fd0, &c0, 1);
-                if(num_bytes == 0) {
-                    c0 = '\n';
-                    eof0 = 1;
-                }
-            }
-
-            if(c1 != '\n') {
-                num_bytes = ece391_read(fd1, &c1, 1);
-                if(num_bytes == 0) {
-                    c1 = '\n';
-                    eof1 = 1;
-                }
-            }
-
-            if(c0 == '\n' && c1 == '\n') {
-                break;
-
-            } else {
-                if((c0 != ' ' && c0 != '\n') || (c1 != ' ' && c1 != '\n')) {
-                    blink_struct.on_char = ( (c0 == '\n') ? ' ' : c0);
-                    blink_struct.off_char = ( (c1 == '\n') ? ' ' : c1);
-                    blink_struct.location = row*80 + col + offset;
-                    mp1_ioctl((unsigned long)&blink_struct, RTC_ADD);
-                }
-            }
-            col++;
-        }
+#ifdef FISH_BENCH
+static uint32_t rdtsc_lo(void)
+{
+    uint32_t lo, hi;
 
-        if(eof0) {
-            c0 = '\n';
-            ece391_close(fd0);
-        } else {
-            c0 = '0';
-        }
+    asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+    return lo;
+}
 
-        if(eof1) {
-            c1 = '\n';
-            ece391_close(fd1);
-        } else {
-            c1 = '0';
-        }
+static void put_num(const char* label, uint32_t n)
+{
+    uint8_t buf[12];
+    int32_t i = 11;
+
+    buf[i] = '\0';
+    do {
+        buf[--i] = '0' + n % 10;
+        n /= 10;
+    } while(n != 0);
+    ece391_fdputs(1, (uint8_t*)label);
+    ece391_fdputs(1, &buf[i]);
+    ece391_fdputs(1, (uint8_t*)"\n");
+}
+
+static void bench_add_frames(int32_t rtc_fd)
+{
+    uint32_t start;
 
-        row++;
+    start = rdtsc_lo();
+    add_frames(file0, file1, rtc_fd);
+    put_num("add_frames cycles: ", rdtsc_lo() - start);
+}
+
+/* Average cycles per tasklet call with the frames loaded, without
+   waiting on the RTC in between */
+static void bench_tasklet(void)
+{
+    uint32_t start;
+    int32_t i;
+
+    start = rdtsc_lo();
+    for(i=0; i<BENCH_TICKS; i++) {
+        mp1_rtc_tasklet(0);
     }
+    put_num("tasklet cycles per tick: ", (rdtsc_lo() - start) / BENCH_TICKS);
 }
+#endif
 
 uint8_t*
 mp1_set_video_mode (void)
@@ -157,21 +200,36 @@ mp1_set_video_mode (void)
     }
 }
 
-void* mp1_malloc(int32_t size)
+static void blink_pool_init(void)
 {
     int32_t i;
-    for(i=0; i< 80*25; i++) {
-        if(blink_array[i].location == 0) {
-            return &blink_array[i];
-        }
+
+    ece391_memset(blink_array, 0, sizeof(struct mp1_blink_struct)*80*25);
+    blink_free_list = NULL;
+    for(i=80*25-1; i>=0; i--) {
+        blink_array[i].next = blink_free_list;
+        blink_free_list = &blink_array[i];
+    }
+}
+
+void* mp1_malloc(int32_t size)
+{
+    struct mp1_blink_struct* b = blink_free_list;
+
+    if(b != NULL) {
+        blink_free_list = b->next;
     }
 
-    return NULL;
+    return b;
 }
 
 void mp1_free(void* memory)
 {
-    ece391_memset(memory, 0, sizeof(struct mp1_blink_struct));
+    struct mp1_blink_struct* b = (struct mp1_blink_struct*)memory;
+
+    ece391_memset(b, 0, sizeof(struct mp1_blink_struct));
+    b->next = blink_free_list;
+    blink_free_list = b;
 }
 
 void ece391_memset(void* memory, char c, int n)
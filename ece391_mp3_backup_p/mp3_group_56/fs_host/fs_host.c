@@ -0,0 +1,311 @@
+/* fs_host.c - Runs the kernel's file system code on Linux against a
+ * file system image, checking it and timing it
+ *
+ * usage: fs_host test|fuzz|bench <image> [seed]
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fs_shim.h"
+/* terminal.h brings in syscall.h, whose open, read, write and close clash
+   with unistd.h, and nothing in it is needed here */
+#define _TERMINAL_H
+#include "file_system_driver.h"
+
+/* from syscall_helpers.h, which includes syscall.h as well */
+int32_t read_dentry_by_name(const uint8_t* fname, dentry_t* dentry);
+int32_t read_dentry_by_index(uint32_t index, dentry_t* dentry);
+int32_t read_data(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length);
+
+#define PAGE_SIZE 4096
+/* largest file the image format can describe */
+#define MAX_FILE_SIZE (DATA_BLOCKS_PER_INODE * DATA_BLOCK_SIZE)
+#define FUZZ_ROUNDS 2000
+#define FUZZ_READS 200
+#define CANARY 0xA5
+
+static uint8_t read_buf[MAX_FILE_SIZE + PAGE_SIZE];
+static uint8_t ref_buf[MAX_FILE_SIZE + PAGE_SIZE];
+static int failures;
+
+#define CHECK(cond, ...) do {                           \
+    if (!(cond)) {                                      \
+        failures++;                                     \
+        printf("FAIL %s:%d: ", __FILE__, __LINE__);     \
+        printf(__VA_ARGS__);                            \
+        printf("\n");                                   \
+    }                                                   \
+} while (0)
+
+/* Points the driver at an image, the way kernel.c does at boot */
+static void use_image(void* image) {
+    boot_block_ptr = (boot_block_t*)image;
+    init_file_system();
+}
+
+/* Maps the image file read only, returns its size in *size */
+static void* map_image(const char* path, size_t* size) {
+    struct stat st;
+    void* image;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        exit(2);
+    }
+    image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        perror("mmap");
+        exit(2);
+    }
+    *size = st.st_size;
+    return image;
+}
+
+/*
+ * Copies the image into writable memory that ends at an inaccessible page,
+ * so a read past the end of the image faults instead of going unnoticed
+ */
+static uint8_t* guarded_copy(const void* image, size_t size) {
+    size_t span = (size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+    uint8_t* base;
+
+    base = mmap(NULL, span + PAGE_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED || mprotect(base + span, PAGE_SIZE, PROT_NONE) < 0) {
+        perror("guarded_copy");
+        exit(2);
+    }
+    base += span - size;
+    memcpy(base, image, size);
+    return base;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The image's own description has to fit in the file */
+static int image_fits(size_t size) {
+    boot_block_t* bb = boot_block_ptr;
+
+    if (bb->num_dirs < 0 || bb->num_dirs > 63 || bb->num_inodes < 0 || bb->num_data_blocks < 0)
+        return 0;
+    return (1 + (size_t)bb->num_inodes + bb->num_data_blocks) * DATA_BLOCK_SIZE <= size;
+}
+
+/*
+ * What read_data should give, worked out a byte at a time straight from
+ * the inode: the bytes from offset up to the end of the file, or -1 if
+ * any of them lies in a data block the image does not have
+ */
+static int32_t ref_read(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length) {
+    inode_t* node;
+    uint32_t i, n, pos, block;
+
+    if (inode >= (uint32_t)boot_block_ptr->num_inodes)
+        return -1;
+    node = inode_ptr + inode;
+    if (offset >= (uint32_t)node->length)
+        return 0;
+    n = (uint32_t)node->length - offset;
+    if (length < n)
+        n = length;
+    for (i = 0; i < n; i++) {
+        pos = offset + i;
+        if (pos / DATA_BLOCK_SIZE >= DATA_BLOCKS_PER_INODE)
+            return -1;
+        block = node->data_blocks[pos / DATA_BLOCK_SIZE];
+        if (block >= (uint32_t)boot_block_ptr->num_data_blocks)
+            return -1;
+        buf[i] = data_block_ptr[block].data[pos % DATA_BLOCK_SIZE];
+    }
+    return n;
+}
+
+/* One read_data call checked against ref_read, nothing past what it
+   returns may be written */
+static void check_read(uint32_t inode, uint32_t offset, uint32_t length) {
+    uint32_t room = length < MAX_FILE_SIZE ? length : MAX_FILE_SIZE;
+    int32_t got, want;
+
+    memset(read_buf, CANARY, room + 1);
+    got = read_data(inode, offset, read_buf, room);
+    want = ref_read(inode, offset, ref_buf, room);
+    CHECK(got == want, "read_data(%u, %u, %u) = %d, expected %d", inode, offset, room, got, want);
+    if (got != want || got < 0)
+        return;
+    CHECK(memcmp(read_buf, ref_buf, got) == 0, "read_data(%u, %u, %u) returned the wrong bytes",
+          inode, offset, room);
+    CHECK(read_buf[got] == CANARY, "read_data(%u, %u, %u) wrote past %d bytes",
+          inode, offset, room, got);
+}
+
+/* Every entry found by index and by name, reads of every file at the edges */
+static void run_tests(void) {
+    dentry_t by_index, by_name;
+    uint8_t name[FILENAME_SIZE + 1];
+    int32_t i, len;
+    uint32_t inode;
+
+    for (i = 0; i < boot_block_ptr->num_dirs; i++) {
+        CHECK(read_dentry_by_index(i, &by_index) == 0, "read_dentry_by_index(%d) failed", i);
+        memcpy(name, boot_block_ptr->dir_entries[i].file_name, FILENAME_SIZE);
+        name[FILENAME_SIZE] = '\0';
+        CHECK(read_dentry_by_name(name, &by_name) == 0, "read_dentry_by_name(%s) failed", name);
+        CHECK(by_name.inode_num == by_index.inode_num && by_name.file_type == by_index.file_type,
+              "%s: by name and by index disagree", name);
+        if (by_index.file_type != 2)
+            continue;
+
+        inode = by_index.inode_num;
+        len = inode_ptr[inode].length;
+        check_read(inode, 0, len);
+        check_read(inode, 0, len + 100);
+        check_read(inode, 0, 0xFFFFFFFF);
+        check_read(inode, len, 10);
+        check_read(inode, len + 1, 10);
+        check_read(inode, len / 2, 1);
+        check_read(inode, DATA_BLOCK_SIZE - 1, 2);
+        check_read(inode, DATA_BLOCK_SIZE, DATA_BLOCK_SIZE);
+    }
+
+    CHECK(read_dentry_by_index(boot_block_ptr->num_dirs, &by_index) == -1,
+          "read_dentry_by_index past the last entry succeeded");
+    CHECK(read_dentry_by_index(63, &by_index) == -1, "read_dentry_by_index(63) succeeded");
+    CHECK(read_dentry_by_name((uint8_t*)"no such file", &by_name) == -1,
+          "read_dentry_by_name found a file that is not there");
+    CHECK(read_dentry_by_name((uint8_t*)"", &by_name) == -1, "read_dentry_by_name found \"\"");
+    CHECK(read_data(boot_block_ptr->num_inodes, 0, read_buf, 1) == -1,
+          "read_data past the last inode succeeded");
+}
+
+/*
+ * Random reads of a copy of the image whose inodes get scribbled on
+ * between rounds: lengths up to 4GB and data block numbers past the end.
+ * read_data has to agree with ref_read and stay inside the image.
+ */
+static void run_fuzz(const void* image, size_t size) {
+    uint8_t* copy = guarded_copy(image, size);
+    int32_t round, i, num_inodes;
+    uint32_t inode, offset, length, slot;
+    inode_t* node;
+
+    use_image(copy);
+    num_inodes = boot_block_ptr->num_inodes;
+    for (round = 0; round < FUZZ_ROUNDS; round++) {
+        memcpy(copy, image, size);
+        if (round > 0) {
+            node = inode_ptr + rand() % num_inodes;
+            switch (rand() % 3) {
+                case 0:
+                    node->length = (uint32_t)rand() * 2654435761u;
+                    break;
+                case 1:
+                    slot = rand() % DATA_BLOCKS_PER_INODE;
+                    node->data_blocks[slot] = boot_block_ptr->num_data_blocks + rand() % 4;
+                    break;
+                default:
+                    node->length = MAX_FILE_SIZE - rand() % 8;
+                    break;
+            }
+        }
+        for (i = 0; i < FUZZ_READS; i++) {
+            inode = rand() % (num_inodes + 2);
+            switch (rand() % 3) {
+                case 0:  offset = rand() % (2 * DATA_BLOCK_SIZE); break;
+                case 1:  offset = rand() % (MAX_FILE_SIZE + DATA_BLOCK_SIZE); break;
+                default: offset = (uint32_t)rand() * 2654435761u; break;
+            }
+            length = (rand() % 2) ? rand() % (3 * DATA_BLOCK_SIZE) : (uint32_t)rand() * 2654435761u;
+            check_read(inode, offset, length);
+        }
+    }
+}
+
+/* Name lookups and whole file reads in several chunk sizes */
+static void run_bench(void) {
+    static const uint32_t chunks[] = { 1, 64, 1024, DATA_BLOCK_SIZE, 65536, MAX_FILE_SIZE };
+    uint8_t names[63][FILENAME_SIZE + 1];
+    dentry_t dentry;
+    int32_t n = boot_block_ptr->num_dirs, i, c, rep, reps, got;
+    uint32_t inode, pos, bytes;
+    double t;
+
+    for (i = 0; i < n; i++) {
+        memcpy(names[i], boot_block_ptr->dir_entries[i].file_name, FILENAME_SIZE);
+        names[i][FILENAME_SIZE] = '\0';
+    }
+
+    reps = 100000;
+    t = now_sec();
+    for (rep = 0; rep < reps; rep++)
+        read_dentry_by_name(names[rep % n], &dentry);
+    t = now_sec() - t;
+    printf("%-24s %10.1f ns\n", "lookup hit", t * 1e9 / reps);
+
+    t = now_sec();
+    for (rep = 0; rep < reps; rep++)
+        read_dentry_by_name((uint8_t*)"not in the image", &dentry);
+    t = now_sec() - t;
+    printf("%-24s %10.1f ns\n", "lookup miss", t * 1e9 / reps);
+
+    for (c = 0; c < (int32_t)(sizeof(chunks) / sizeof(chunks[0])); c++) {
+        bytes = 0;
+        reps = chunks[c] < 64 ? 4 : 40;
+        t = now_sec();
+        for (rep = 0; rep < reps; rep++) {
+            for (i = 0; i < n; i++) {
+                if (boot_block_ptr->dir_entries[i].file_type != 2)
+                    continue;
+                inode = boot_block_ptr->dir_entries[i].inode_num;
+                for (pos = 0; (got = read_data(inode, pos, read_buf, chunks[c])) > 0; pos += got)
+                    bytes += got;
+            }
+        }
+        t = now_sec() - t;
+        printf("read %-7u byte chunks %10.1f MB/s\n", chunks[c], bytes / t / 1e6);
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t size;
+    void* image;
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s test|fuzz|bench <image> [seed]\n", argv[0]);
+        return 2;
+    }
+    image = map_image(argv[2], &size);
+    use_image(image);
+    if (!image_fits(size)) {
+        fprintf(stderr, "%s: boot block does not match the file size\n", argv[2]);
+        return 2;
+    }
+    srand(argc > 3 ? atoi(argv[3]) : 391);
+
+    if (strcmp(argv[1], "test") == 0) {
+        run_tests();
+    } else if (strcmp(argv[1], "fuzz") == 0) {
+        run_fuzz(image, size);
+    } else if (strcmp(argv[1], "bench") == 0) {
+        run_bench();
+        return 0;
+    } else {
+        fprintf(stderr, "unknown mode %s\n", argv[1]);
+        return 2;
+    }
+    printf("%s: %s\n", argv[1], failures ? "FAILED" : "passed");
+    return failures != 0;
+}
@@ -0,0 +1,30 @@
+/* fs_shim.c - Library calls and device entry points the file system code
+ * links against when it is built for Linux
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+void* fs_memcpy(void* dest, const void* src, uint32_t n) {
+    return memcpy(dest, src, n);
+}
+
+int32_t fs_strncmp(const signed char* s1, const signed char* s2, uint32_t n) {
+    return strncmp((const char*)s1, (const char*)s2, n);
+}
+
+signed char* fs_strcpy(signed char* dest, const signed char* src) {
+    return (signed char*)strcpy((char*)dest, (const char*)src);
+}
+
+/* init_ops_tables takes the addresses of these, none of them is called */
+int32_t terminal_read(int32_t fd, void* buf, int32_t nbytes) { return -1; }
+int32_t terminal_write(int32_t fd, const void* buf, int32_t nbytes) { return -1; }
+int32_t rtc_open(const uint8_t* filename) { return -1; }
+int32_t rtc_close(int32_t fd) { return -1; }
+int32_t rtc_read(int32_t fd, void* buf, int32_t nbytes) { return -1; }
+int32_t rtc_write(int32_t fd, const void* buf, int32_t nbytes) { return -1; }
+int32_t trace_open(const uint8_t* filename) { return -1; }
+int32_t trace_close(int32_t fd) { return -1; }
+int32_t trace_read(int32_t fd, void* buf, int32_t nbytes) { return -1; }
+int32_t trace_write(int32_t fd, const void* buf, int32_t nbytes) { return -1; }
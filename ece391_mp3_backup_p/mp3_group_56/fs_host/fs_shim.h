@@ -0,0 +1,32 @@
+/* fs_shim.h - Stands in for types.h and lib.h when the file system code
+ * is built for Linux. The kernel sources get it with -include, so their
+ * own includes of those two headers come out empty.
+ */
+
+#ifndef _FS_SHIM_H
+#define _FS_SHIM_H
+
+#define _TYPES_H
+#define _LIB_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* lib.h's versions, renamed so that they do not collide with libc's */
+#define memcpy fs_memcpy
+#define strncmp fs_strncmp
+#define strcpy fs_strcpy
+
+void* fs_memcpy(void* dest, const void* src, uint32_t n);
+int32_t fs_strncmp(const int8_t* s1, const int8_t* s2, uint32_t n);
+int8_t* fs_strcpy(int8_t* dest, const int8_t* src);
+
+static inline uint64_t rdtsc(void) {
+    return __builtin_ia32_rdtsc();
+}
+
+/* nothing to mask, there is a single thread */
+#define cli_and_save(flags)     do { (flags) = 0; } while (0)
+#define restore_flags(flags)    do { (void)(flags); } while (0)
+
+#endif /* _FS_SHIM_H */
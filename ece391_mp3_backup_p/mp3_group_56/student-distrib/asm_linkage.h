@@ -10,5 +10,8 @@
 extern void keyboard_handler_linkage();
 extern void rtc_handler_linkage();
 extern void pit_handler_linkage();
+extern void apic_spurious_linkage();
+extern void resched_ipi_linkage();
+extern void device_not_available_linkage();
 
 #endif
@@ -0,0 +1,450 @@
+/* bench.c - Timed kernel workloads, run from kernel.c with RUN_BENCHMARKS
+ * vim:ts=4 noexpandtab
+ */
+
+#include "bench.h"
+#include "lib.h"
+#include "x86_desc.h"
+#include "syscall.h"
+#include "syscall_helpers.h"
+#include "terminal.h"
+#include "devices/i8259.h"
+#include "smp.h"
+
+/* system call numbers, the order of sys_call_table */
+#define SYS_EXECUTE     2
+#define SYS_OPEN        5
+#define SYS_CLOSE       6
+#define SYS_GETSTATS    11
+
+extern void bench_call_on_stack(void (*func)(void), uint32_t stack_top);
+extern void bench_switch(uint32_t* save_esp, uint32_t load_esp);
+extern void bench_page_fault(void);
+extern void bench_fault_stub(void);
+
+/* Results are kept until the end since the terminal workload scrolls them away */
+typedef struct bench_result_t {
+    const char* name;
+    uint32_t iters;
+    uint64_t cycles;
+} bench_result_t;
+
+static bench_result_t results[BENCH_MAX_RESULTS];
+static int num_results = 0;
+
+static pcb_t* bench_pcb;
+static pcb_t* partner_pcb;
+static uint32_t main_esp;
+static uint32_t partner_esp;
+
+static uint8_t read_buf[BENCH_READ_BLOCK];
+
+/* result names of the memory sweep, one per size from BENCH_MEM_MIN_SIZE */
+static const char* memcpy_names[] = {
+    "memcpy_16", "memcpy_64", "memcpy_256", "memcpy_1k", "memcpy_4k", "memcpy_16k",
+    "memcpy_64k", "memcpy_256k", "memcpy_1m", "memcpy_4m"
+};
+static const char* memset_names[] = {
+    "memset_16", "memset_64", "memset_256", "memset_1k", "memset_4k", "memset_16k",
+    "memset_64k", "memset_256k", "memset_1m", "memset_4m"
+};
+
+/*
+ * bench_record
+ *   DESCRIPTION: Keeps a workload's result for the final table
+ *   INPUTS: name - workload name, no spaces
+ *           iters - operations timed, 0 if the workload could not run
+ *           cycles - total TSC cycles
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void bench_record(const char* name, uint32_t iters, uint64_t cycles) {
+    if (num_results == BENCH_MAX_RESULTS) return;
+    results[num_results].name = name;
+    results[num_results].iters = iters;
+    results[num_results].cycles = cycles;
+    num_results++;
+}
+
+/*
+ * u64_to_str
+ *   DESCRIPTION: Decimal string of a 64-bit value, printf only takes 32 bits
+ *   INPUTS: val - value to convert
+ *           buf - at least 21 bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: buf
+ *   SIDE EFFECTS: none
+ */
+static int8_t* u64_to_str(uint64_t val, int8_t* buf) {
+    int8_t tmp[21];
+    int i = 0, j = 0;
+
+    do {
+        tmp[i++] = '0' + div64_32(&val, 10);
+    } while (val != 0);
+    while (i > 0)
+        buf[j++] = tmp[--i];
+    buf[j] = '\0';
+    return buf;
+}
+
+/*
+ * bench_syscall
+ *   DESCRIPTION: Makes a system call through int $0x80 like user code does,
+ *                so the dispatch and accounting hooks are part of the cost
+ *   INPUTS: nr - system call number
+ *           a, b, c - ebx, ecx, edx
+ *   OUTPUTS: none
+ *   RETURN VALUE: eax after the call
+ *   SIDE EFFECTS: whatever the call does
+ */
+static inline int32_t bench_syscall(uint32_t nr, uint32_t a, uint32_t b, uint32_t c) {
+    int32_t ret;
+    asm volatile ("int $0x80"
+        : "=a" (ret)
+        : "a" (nr), "b" (a), "c" (b), "d" (c)
+        : "memory", "cc"
+    );
+    return ret;
+}
+
+/*
+ * claim_pcb
+ *   DESCRIPTION: Takes a free PCB slot and gives it an empty process
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the PCB, NULL if every slot is in use
+ *   SIDE EFFECTS: marks the slot used
+ */
+static pcb_t* claim_pcb(void) {
+    pcb_t* pcb;
+    int32_t pid;
+
+    for (pid = 0; pid < MAX_NUM_PROGRAMS; pid++) {
+        if (pcb_flags[pid] == 0) break;
+    }
+    if (pid == MAX_NUM_PROGRAMS) return NULL;
+
+    pcb_flags[pid] = 1;
+    pcb = get_pcb_ptr(pid);
+    memset(pcb, 0, sizeof(pcb_t));
+    pcb->pid = pid;
+    pcb->parent_pid = -1;
+    pcb->child_pid = -1;
+    rwlock_init(&pcb->fd_lock, "fd table");
+    strncpy((int8_t*) pcb->name, (const int8_t*) "bench", PROC_NAME_SIZE);
+    return pcb;
+}
+
+/*
+ * bench_null_syscall
+ *   DESCRIPTION: Cheapest full trip through the system call path, getstats
+ *                with a NULL buffer fails right after dispatch
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void bench_null_syscall(void) {
+    uint64_t start = rdtsc();
+    int i;
+
+    for (i = 0; i < BENCH_NULL_SYSCALL_ITERS; i++)
+        bench_syscall(SYS_GETSTATS, 0, 0, 0);
+    bench_record("null_syscall", BENCH_NULL_SYSCALL_ITERS, rdtsc() - start);
+}
+
+/*
+ * bench_open_close
+ *   DESCRIPTION: open then close of a regular file, the directory lookup
+ *                is most of it
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void bench_open_close(void) {
+    uint64_t start = rdtsc();
+    int32_t fd;
+    int i;
+
+    for (i = 0; i < BENCH_OPEN_CLOSE_ITERS; i++) {
+        fd = bench_syscall(SYS_OPEN, (uint32_t) BENCH_OPEN_FILE, 0, 0);
+        if (fd == -1) {
+            bench_record("open_close", 0, 0);
+            return;
+        }
+        bench_syscall(SYS_CLOSE, fd, 0, 0);
+    }
+    bench_record("open_close", BENCH_OPEN_CLOSE_ITERS, rdtsc() - start);
+}
+
+/*
+ * bench_read_data
+ *   DESCRIPTION: Reads the biggest program in the image a block at a time,
+ *                per op is one BENCH_READ_BLOCK
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void bench_read_data(void) {
+    dentry_t dentry;
+    uint32_t offset, blocks = 0;
+    uint64_t start;
+    int32_t cnt;
+    int i;
+
+    if (read_dentry_by_name((const uint8_t*) BENCH_READ_FILE, &dentry) == -1) {
+        bench_record("read_data_4k", 0, 0);
+        return;
+    }
+
+    start = rdtsc();
+    for (i = 0; i < BENCH_READ_DATA_PASSES; i++) {
+        offset = 0;
+        while ((cnt = read_data(dentry.inode_num, offset, read_buf, BENCH_READ_BLOCK)) > 0) {
+            offset += cnt;
+            blocks++;
+        }
+    }
+    bench_record("read_data_4k", blocks, rdtsc() - start);
+}
+
+/*
+ * bench_exec_halt
+ *   DESCRIPTION: Runs a short program to completion, covering ELF load,
+ *                the user page switch and the halt back to the parent
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: the program prints to the terminal
+ */
+static void bench_exec_halt(void) {
+    uint64_t start = rdtsc();
+    int i;
+
+    for (i = 0; i < BENCH_EXEC_HALT_ITERS; i++) {
+        if (bench_syscall(SYS_EXECUTE, (uint32_t) BENCH_EXEC_FILE, 0, 0) != 0) {
+            bench_record("exec_halt", 0, 0);
+            return;
+        }
+    }
+    bench_record("exec_halt", BENCH_EXEC_HALT_ITERS, rdtsc() - start);
+}
+
+/*
+ * switch_to
+ *   DESCRIPTION: What schedule() does to move between two processes: the
+ *                TSS, the user page and the kernel stack
+ *   INPUTS: next - process to run
+ *           save_esp - where this side's esp goes
+ *           load_esp - the other side's esp
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: switches stacks until switched back
+ */
+static void switch_to(pcb_t* next, uint32_t* save_esp, uint32_t load_esp) {
+    set_kernel_stack((uint32_t) next + EIGHT_KB - STACK_FENCE_SIZE);
+    setup_user_page(((next->pid * FOUR_MB) + EIGHT_MB) / FOUR_KB);
+    bench_switch(save_esp, load_esp);
+}
+
+/*
+ * bench_partner
+ *   DESCRIPTION: The other side of the context switch workload, hands the
+ *                CPU straight back every time it gets it
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: never returns
+ *   SIDE EFFECTS: none
+ */
+static void bench_partner(void) {
+    for (;;)
+        switch_to(bench_pcb, &partner_esp, main_esp);
+}
+
+/*
+ * bench_context_switch
+ *   DESCRIPTION: Ping-pongs between the benchmark PCB and a second one,
+ *                per op is one switch
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void bench_context_switch(void) {
+    uint32_t* stack;
+    uint64_t start;
+    int i;
+
+    if (partner_pcb == NULL) {
+        bench_record("ctx_switch", 0, 0);
+        return;
+    }
+
+    // what bench_switch pops: edi, esi, ebx, ebp, then it returns into the partner
+    stack = (uint32_t*) ((uint32_t) partner_pcb + EIGHT_KB - STACK_FENCE_SIZE) - 6;
+    stack[0] = stack[1] = stack[2] = stack[3] = 0;
+    stack[4] = (uint32_t) bench_partner;
+    stack[5] = 0;
+    partner_esp = (uint32_t) stack;
+
+    start = rdtsc();
+    for (i = 0; i < BENCH_SWITCH_ITERS; i++)
+        switch_to(partner_pcb, &main_esp, partner_esp);
+    bench_record("ctx_switch", 2 * BENCH_SWITCH_ITERS, rdtsc() - start);
+    set_kernel_stack((uint32_t) bench_pcb + EIGHT_KB - STACK_FENCE_SIZE);
+    setup_user_page(((bench_pcb->pid * FOUR_MB) + EIGHT_MB) / FOUR_KB);
+}
+
+/*
+ * bench_terminal_write
+ *   DESCRIPTION: Full 80 column lines through terminal_write, every one
+ *                scrolls once the screen is full
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: fills the terminal
+ */
+static void bench_terminal_write(void) {
+    int8_t line[BENCH_LINE_SIZE];
+    uint64_t start;
+    int i;
+
+    for (i = 0; i < BENCH_LINE_SIZE - 1; i++)
+        line[i] = 'a' + (i % 26);
+    line[BENCH_LINE_SIZE - 1] = '\n';
+
+    start = rdtsc();
+    for (i = 0; i < BENCH_TERM_WRITE_LINES; i++)
+        terminal_write(1, line, BENCH_LINE_SIZE);
+    bench_record("term_write_line", BENCH_TERM_WRITE_LINES, rdtsc() - start);
+}
+
+/*
+ * bench_page_faults
+ *   DESCRIPTION: Cost of taking a page fault and returning from it. The
+ *                real handler ends the process, so a stub that skips the
+ *                faulting load stands in for vector 14 meanwhile.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void bench_page_faults(void) {
+    idt_desc_t saved = idt[14];
+    uint64_t start;
+    int i;
+
+    SET_IDT_ENTRY(idt[14], bench_fault_stub);
+    start = rdtsc();
+    for (i = 0; i < BENCH_PAGE_FAULT_ITERS; i++)
+        bench_page_fault();
+    bench_record("page_fault", BENCH_PAGE_FAULT_ITERS, rdtsc() - start);
+    idt[14] = saved;
+}
+
+/*
+ * bench_memory
+ *   DESCRIPTION: memcpy and memset at every size of the sweep, so the
+ *                thresholds in lib.h can be checked on real hardware
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: overwrites the benchmark PCB's user page
+ */
+static void bench_memory(void) {
+    void* dest = (void*) USER_MEM_VIRTUAL_ADDR;
+    const void* src = (const void*) BENCH_MEM_SRC;
+    uint32_t size, iters, i;
+    uint64_t start;
+    int n = 0;
+
+    for (size = BENCH_MEM_MIN_SIZE; size <= BENCH_MEM_MAX_SIZE; size *= 4, n++) {
+        iters = BENCH_MEM_BYTES / size;
+
+        start = rdtsc();
+        for (i = 0; i < iters; i++)
+            memcpy(dest, src, size);
+        bench_record(memcpy_names[n], iters, rdtsc() - start);
+
+        start = rdtsc();
+        for (i = 0; i < iters; i++)
+            memset(dest, i, size);
+        bench_record(memset_names[n], iters, rdtsc() - start);
+    }
+}
+
+/*
+ * bench_body
+ *   DESCRIPTION: The workloads, run on the benchmark PCB's stack
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: see the workloads
+ */
+static void bench_body(void) {
+    set_kernel_stack((uint32_t) bench_pcb + EIGHT_KB - STACK_FENCE_SIZE);
+    setup_user_page(((bench_pcb->pid * FOUR_MB) + EIGHT_MB) / FOUR_KB);
+
+    bench_null_syscall();
+    bench_open_close();
+    bench_read_data();
+    bench_exec_halt();
+    bench_context_switch();
+    bench_terminal_write();
+    bench_page_faults();
+    bench_memory();
+}
+
+/*
+ * run_benchmarks
+ *   DESCRIPTION: Runs the workloads with the scheduler and RTC masked so
+ *                nothing else shares the CPU, then prints the table. Called
+ *                by entry() after i8259_init and before sti.
+ *   INPUTS: none
+ *   OUTPUTS: one BENCH line per workload
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: clears the screen, uses and frees two PCB slots
+ */
+void run_benchmarks(void) {
+    int8_t total[21], per_op[21];
+    const int8_t* copy_kernel;
+    const int8_t* fill_kernel;
+    uint64_t per;
+    int i;
+
+    // a PIT tick from here on would start booting the shells on this stack
+    disable_irq(0);
+    disable_irq(8);
+    bench_pcb = claim_pcb();
+    partner_pcb = claim_pcb();
+    if (bench_pcb == NULL) {
+        enable_irq(8);
+        enable_irq(0);
+        printf("BENCH no free pcb\n");
+        return;
+    }
+
+    bench_call_on_stack(bench_body, (uint32_t) bench_pcb + EIGHT_KB - STACK_FENCE_SIZE);
+    enable_irq(8);
+    enable_irq(0);
+
+    if (partner_pcb != NULL) pcb_flags[partner_pcb->pid] = 0;
+    pcb_flags[bench_pcb->pid] = 0;
+    set_kernel_stack(EIGHT_MB);
+
+    clear();
+    printf("BENCH name iters total_cycles cycles_per_op\n");
+    for (i = 0; i < num_results; i++) {
+        per = results[i].cycles;
+        if (results[i].iters != 0)
+            div64_32(&per, results[i].iters);
+        printf("BENCH %s %u %s %s\n", results[i].name, results[i].iters,
+            u64_to_str(results[i].cycles, total), u64_to_str(per, per_op));
+    }
+    get_lib_ops(&copy_kernel, &fill_kernel);
+    printf("BENCH memcpy=%s memset=%s\n", copy_kernel, fill_kernel);
+}
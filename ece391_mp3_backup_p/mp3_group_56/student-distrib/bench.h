@@ -0,0 +1,42 @@
+/* bench.h - Timed kernel workloads, run from kernel.c with RUN_BENCHMARKS
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include "types.h"
+
+/* iterations per workload, sized so each finishes well under a second in QEMU */
+#define BENCH_NULL_SYSCALL_ITERS    10000
+#define BENCH_OPEN_CLOSE_ITERS      1000
+#define BENCH_READ_DATA_PASSES      64
+#define BENCH_EXEC_HALT_ITERS       20
+#define BENCH_SWITCH_ITERS          1000
+#define BENCH_TERM_WRITE_LINES      500
+#define BENCH_PAGE_FAULT_ITERS      10000
+
+/* memcpy/memset sweep, sizes go up by 4x, each size moves BENCH_MEM_BYTES.
+ * The source is the kernel page, the destination the user page. */
+#define BENCH_MEM_MIN_SIZE          16
+#define BENCH_MEM_MAX_SIZE          0x400000
+#define BENCH_MEM_BYTES             0x800000
+#define BENCH_MEM_SRC               0x400000
+
+/* files the workloads use, in fsdir */
+#define BENCH_OPEN_FILE             "frame0.txt"
+#define BENCH_READ_FILE             "fish"
+#define BENCH_EXEC_FILE             "testprint"
+
+#define BENCH_READ_BLOCK            4096
+#define BENCH_LINE_SIZE             80
+#define BENCH_MAX_RESULTS           40
+
+/*
+ * Runs every workload on a borrowed PCB before the shells start, then
+ * prints one line per workload:
+ *   BENCH <name> <iterations> <total cycles> <cycles per op>
+ */
+void run_benchmarks(void);
+
+#endif /* _BENCH_H */
@@ -0,0 +1,73 @@
+#include "cpu.h"
+
+static uint32_t cpu_feature_mask = 0;
+
+/*
+ * cpuid
+ *   DESCRIPTION: Executes the CPUID instruction for the given leaf (subleaf 0)
+ *   INPUTS: leaf - CPUID leaf to query
+ *           eax, ebx, ecx, edx - where to store the results
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx) {
+    asm volatile ("cpuid"
+        : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+        : "a" (leaf), "c" (0)
+    );
+}
+
+/*
+ * init_cpu_features
+ *   DESCRIPTION: Reads the CPUID feature flags the kernel cares about and
+ *                turns on SSE support (CR4.OSFXSR/OSXMMEXCPT) if present so
+ *                the SSE variants of the lib.c helpers can be used.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: fills in the feature mask, may modify CR4
+ */
+void init_cpu_features(void) {
+    uint32_t max_leaf, eax, ebx, ecx, edx;
+
+    cpuid(0, &max_leaf, &ebx, &ecx, &edx);
+    if (max_leaf < 1) return;
+
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (edx & CPUID_1_EDX_TSC)  cpu_feature_mask |= CPU_FEATURE_TSC;
+    if (edx & CPUID_1_EDX_PGE)  cpu_feature_mask |= CPU_FEATURE_PGE;
+    if (edx & CPUID_1_EDX_FXSR) cpu_feature_mask |= CPU_FEATURE_FXSR;
+    if (edx & CPUID_1_EDX_SSE)  cpu_feature_mask |= CPU_FEATURE_SSE;
+    if (edx & CPUID_1_EDX_SSE2) cpu_feature_mask |= CPU_FEATURE_SSE2;
+
+    if (max_leaf >= 7) {
+        cpuid(7, &eax, &ebx, &ecx, &edx);
+        if (ebx & CPUID_7_EBX_ERMS) cpu_feature_mask |= CPU_FEATURE_ERMS;
+    }
+
+    // SSE instructions raise #UD until the OS says it can handle them
+    if (cpu_has_feature(CPU_FEATURE_FXSR | CPU_FEATURE_SSE)) {
+        asm volatile (
+            "movl %%cr4, %%eax  ;\
+             orl %0, %%eax      ;\
+             movl %%eax, %%cr4  ;\
+            "
+            :
+            : "i" (CR4_OSFXSR | CR4_OSXMMEXCPT)
+            : "eax", "memory"
+        );
+    }
+}
+
+/*
+ * cpu_has_feature
+ *   DESCRIPTION: Checks the features found by init_cpu_features
+ *   INPUTS: feature_mask - CPU_FEATURE_* bits to check
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if all requested features exist, 0 else
+ *   SIDE EFFECTS: none
+ */
+int32_t cpu_has_feature(uint32_t feature_mask) {
+    return (cpu_feature_mask & feature_mask) == feature_mask;
+}
@@ -0,0 +1,42 @@
+/* cpu.h - CPUID feature detection and control register setup
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _CPU_H
+#define _CPU_H
+
+#include "types.h"
+
+/* CPUID leaf 1, EDX feature bits (IA-32 vol 2A, CPUID) */
+#define CPUID_1_EDX_TSC     0x00000010
+#define CPUID_1_EDX_PGE     0x00002000
+#define CPUID_1_EDX_FXSR    0x01000000
+#define CPUID_1_EDX_SSE     0x02000000
+#define CPUID_1_EDX_SSE2    0x04000000
+
+/* CPUID leaf 7, EBX feature bits */
+#define CPUID_7_EBX_ERMS    0x00000200
+
+/* CR4 bits we may turn on once the features are known */
+#define CR4_OSFXSR          0x00000200
+#define CR4_OSXMMEXCPT      0x00000400
+
+/* Features the rest of the kernel can ask about */
+#define CPU_FEATURE_TSC     0x01
+#define CPU_FEATURE_PGE     0x02
+#define CPU_FEATURE_FXSR    0x04
+#define CPU_FEATURE_SSE     0x08
+#define CPU_FEATURE_SSE2    0x10
+#define CPU_FEATURE_ERMS    0x20
+
+#ifndef ASM
+
+/* Runs CPUID once and enables SSE in CR4 when the CPU has it */
+void init_cpu_features(void);
+
+/* returns nonzero if every feature in the mask is supported */
+int32_t cpu_has_feature(uint32_t feature_mask);
+
+#endif /* ASM */
+
+#endif /* _CPU_H */
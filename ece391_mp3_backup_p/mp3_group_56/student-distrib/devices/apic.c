@@ -0,0 +1,253 @@
+/* apic.c - Local APIC and I/O APIC, used instead of the 8259 with SMP
+ * vim:ts=4 noexpandtab
+ */
+
+#include "apic.h"
+#include "i8259.h"
+#include "../lib.h"
+
+static volatile uint32_t* lapic = NULL;
+static volatile uint32_t* ioapic = NULL;
+static uint32_t ioapic_pins = 0;
+static uint32_t ioapic_dest = 0;       // APIC id every ISA IRQ is sent to
+static int32_t ioapic_on = 0;
+static int32_t imcr_present = 0;
+
+/* pin and polarity/trigger flags per ISA IRQ, identity unless overridden */
+static uint32_t isa_pin[NUM_ISA_IRQS];
+static uint32_t isa_flags[NUM_ISA_IRQS];
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    return lapic[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t val) {
+    lapic[reg / 4] = val;
+    (void) lapic[LAPIC_ID / 4];     // reads back so the write has landed
+}
+
+static inline uint32_t ioapic_read(uint32_t reg) {
+    ioapic[IOAPIC_REGSEL / 4] = reg;
+    return ioapic[IOAPIC_WINDOW / 4];
+}
+
+static inline void ioapic_write(uint32_t reg, uint32_t val) {
+    ioapic[IOAPIC_REGSEL / 4] = reg;
+    ioapic[IOAPIC_WINDOW / 4] = val;
+}
+
+/*
+ * udelay
+ *   DESCRIPTION: Rough busy wait, a write to port 0x80 takes about a
+ *                microsecond on real hardware and is no faster than needed
+ *                under QEMU since the APs are polled for anyway
+ *   INPUTS: us - microseconds
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void udelay(uint32_t us) {
+    while (us--)
+        outb(0, 0x80);
+}
+
+/*
+ * lapic_init
+ *   DESCRIPTION: Enables the calling CPU's local APIC and lets every
+ *                priority through
+ *   INPUTS: base - physical (and virtual) address of the local APIC
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: programs the spurious vector register
+ */
+void lapic_init(uint32_t base) {
+    lapic = (volatile uint32_t*) base;
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+}
+
+/*
+ * lapic_id
+ *   DESCRIPTION: Which CPU is running
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: local APIC id, 0 when there is no local APIC
+ *   SIDE EFFECTS: none
+ */
+uint32_t lapic_id(void) {
+    if (lapic == NULL) return 0;
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+/*
+ * lapic_eoi
+ *   DESCRIPTION: Tells the local APIC the current interrupt is done
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void lapic_eoi(void) {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+/*
+ * lapic_send_ipi
+ *   DESCRIPTION: Sends an interprocessor interrupt and waits for delivery
+ *   INPUTS: apic_id - destination
+ *           cmd - ICR low word
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void lapic_send_ipi(uint32_t apic_id, uint32_t cmd) {
+    lapic_write(LAPIC_ICR_HI, apic_id << 24);
+    lapic_write(LAPIC_ICR_LO, cmd);
+    while (lapic_read(LAPIC_ICR_LO) & LAPIC_ICR_PENDING)
+        asm volatile ("pause");
+}
+
+/*
+ * lapic_start_ap
+ *   DESCRIPTION: The INIT-SIPI-SIPI sequence from the MP spec, the AP
+ *                starts in real mode at entry
+ *   INPUTS: apic_id - CPU to start
+ *           entry - 4 KB aligned address below 1 MB
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: the AP starts running
+ */
+void lapic_start_ap(uint32_t apic_id, uint32_t entry) {
+    lapic_send_ipi(apic_id, LAPIC_ICR_INIT);
+    udelay(10000);
+    lapic_send_ipi(apic_id, LAPIC_ICR_STARTUP | (entry >> 12));
+    udelay(200);
+    lapic_send_ipi(apic_id, LAPIC_ICR_STARTUP | (entry >> 12));
+    udelay(200);
+}
+
+/*
+ * lapic_send_fixed_ipi
+ *   DESCRIPTION: Raises an interrupt on another CPU, it goes through
+ *                that CPU's IDT like a device interrupt
+ *   INPUTS: apic_id - destination
+ *           vector - IDT entry to use
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void lapic_send_fixed_ipi(uint32_t apic_id, uint32_t vector) {
+    lapic_send_ipi(apic_id, LAPIC_ICR_FIXED | (vector & 0xFF));
+}
+
+/*
+ * ioapic_init
+ *   DESCRIPTION: Masks every pin of the I/O APIC, the ISA IRQs start out
+ *                on their own pin number
+ *   INPUTS: base - address of the I/O APIC
+ *           apic_id - CPU to deliver to
+ *           imcr - nonzero if the board starts in PIC mode and has an IMCR
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void ioapic_init(uint32_t base, uint32_t apic_id, int32_t imcr) {
+    uint32_t i;
+
+    imcr_present = imcr;
+    ioapic = (volatile uint32_t*) base;
+    ioapic_dest = apic_id;
+    ioapic_pins = ((ioapic_read(IOAPIC_VER) >> 16) & 0xFF) + 1;
+    for (i = 0; i < ioapic_pins; i++) {
+        ioapic_write(IOAPIC_REDTBL + 2 * i, IOAPIC_MASKED);
+        ioapic_write(IOAPIC_REDTBL + 2 * i + 1, 0);
+    }
+    for (i = 0; i < NUM_ISA_IRQS; i++) {
+        isa_pin[i] = i;
+        isa_flags[i] = 0;
+    }
+}
+
+/*
+ * ioapic_set_isa_override
+ *   DESCRIPTION: Records an MP table I/O interrupt entry for an ISA IRQ
+ *   INPUTS: irq - ISA IRQ
+ *           pin - I/O APIC input it arrives on
+ *           flags - MP table polarity (bits 0-1) and trigger (bits 2-3)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void ioapic_set_isa_override(uint32_t irq, uint32_t pin, uint32_t flags) {
+    if (irq >= NUM_ISA_IRQS) return;
+    isa_pin[irq] = pin;
+    isa_flags[irq] = 0;
+    if ((flags & 0x3) == 0x3) isa_flags[irq] |= IOAPIC_ACTIVE_LOW;
+    if (((flags >> 2) & 0x3) == 0x3) isa_flags[irq] |= IOAPIC_LEVEL;
+}
+
+/*
+ * ioapic_take_over
+ *   DESCRIPTION: Masks the 8259, and on PIC mode boards routes it through
+ *                the APIC with the IMCR, so from here on only the I/O APIC
+ *                raises device interrupts
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: enable_irq, disable_irq and send_eoi switch to the APICs
+ */
+void ioapic_take_over(void) {
+    if (ioapic == NULL || lapic == NULL) return;
+    outb(0xFF, PIC1_DATA);
+    outb(0xFF, PIC2_DATA);
+    if (imcr_present) {
+        outb(0x70, IMCR_SELECT);
+        outb(0x01, IMCR_DATA);
+    }
+    ioapic_on = 1;
+}
+
+/*
+ * ioapic_active
+ *   DESCRIPTION: Whether device interrupts come from the I/O APIC
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 after ioapic_take_over, 0 while the 8259 is in use
+ *   SIDE EFFECTS: none
+ */
+int32_t ioapic_active(void) {
+    return ioapic_on;
+}
+
+/*
+ * ioapic_unmask
+ *   DESCRIPTION: Delivers an ISA IRQ to the boot CPU on the vector the
+ *                8259 would have used, so the IDT does not change
+ *   INPUTS: irq - ISA IRQ
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: programs one redirection entry
+ */
+void ioapic_unmask(uint32_t irq) {
+    uint32_t pin;
+
+    // IRQ 2 is the 8259 cascade, its pin usually carries the PIT instead
+    if (irq == 2) return;
+    if (irq >= NUM_ISA_IRQS || isa_pin[irq] >= ioapic_pins) return;
+    pin = isa_pin[irq];
+    ioapic_write(IOAPIC_REDTBL + 2 * pin + 1, ioapic_dest << 24);
+    ioapic_write(IOAPIC_REDTBL + 2 * pin, (ISA_VECTOR_BASE + irq) | isa_flags[irq]);
+}
+
+/*
+ * ioapic_mask
+ *   DESCRIPTION: Stops delivery of an ISA IRQ
+ *   INPUTS: irq - ISA IRQ
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: programs one redirection entry
+ */
+void ioapic_mask(uint32_t irq) {
+    if (irq == 2 || irq >= NUM_ISA_IRQS || isa_pin[irq] >= ioapic_pins) return;
+    ioapic_write(IOAPIC_REDTBL + 2 * isa_pin[irq], IOAPIC_MASKED);
+}
@@ -0,0 +1,76 @@
+/* apic.h - Local APIC and I/O APIC, used instead of the 8259 with SMP
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _APIC_H
+#define _APIC_H
+
+#include "../types.h"
+
+/* Local APIC registers, offsets from the base in the MP table */
+#define LAPIC_ID            0x020
+#define LAPIC_TPR           0x080
+#define LAPIC_EOI           0x0B0
+#define LAPIC_SVR           0x0F0
+#define LAPIC_ICR_LO        0x300
+#define LAPIC_ICR_HI        0x310
+
+#define LAPIC_SVR_ENABLE    0x100
+#define LAPIC_ICR_PENDING   0x1000
+
+/* ICR commands, level assert */
+#define LAPIC_ICR_INIT      0x4500
+#define LAPIC_ICR_STARTUP   0x4600
+/* ICR command, fixed delivery of the vector in the low byte */
+#define LAPIC_ICR_FIXED     0x4000
+
+/* vector for interrupts the local APIC drops, needs no EOI */
+#define APIC_SPURIOUS_VECTOR 0xFF
+/* vector the BSP uses to pass the PIT tick on to the APs */
+#define RESCHED_VECTOR      0xF0
+
+/* I/O APIC window and registers */
+#define IOAPIC_REGSEL       0x00
+#define IOAPIC_WINDOW       0x10
+#define IOAPIC_VER          0x01
+#define IOAPIC_REDTBL       0x10
+
+#define IOAPIC_MASKED       0x10000
+#define IOAPIC_LEVEL        0x08000
+#define IOAPIC_ACTIVE_LOW   0x02000
+
+/* ISA IRQs are delivered on vector ISA_VECTOR_BASE + irq, same as the 8259 */
+#define ISA_VECTOR_BASE     0x20
+#define NUM_ISA_IRQS        16
+
+/* Interrupt Mode Configuration Register, routes the 8259 to the APIC */
+#define IMCR_SELECT         0x22
+#define IMCR_DATA           0x23
+
+#ifndef ASM
+
+/* Enables the local APIC of the calling CPU */
+void lapic_init(uint32_t base);
+/* APIC id of the calling CPU */
+uint32_t lapic_id(void);
+/* Ends the interrupt being handled on this CPU */
+void lapic_eoi(void);
+/* Sends INIT then two STARTUP IPIs pointing at the page of entry */
+void lapic_start_ap(uint32_t apic_id, uint32_t entry);
+/* Interrupts another CPU on vector */
+void lapic_send_fixed_ipi(uint32_t apic_id, uint32_t vector);
+
+/* Finds the I/O APIC at base and masks all its pins */
+void ioapic_init(uint32_t base, uint32_t apic_id, int32_t imcr);
+/* Records an ISA IRQ that the MP table says is wired to another pin */
+void ioapic_set_isa_override(uint32_t irq, uint32_t pin, uint32_t flags);
+/* Takes over from the 8259, enable_irq and friends go to the I/O APIC after this */
+void ioapic_take_over(void);
+/* Nonzero once the I/O APIC delivers the ISA IRQs */
+int32_t ioapic_active(void);
+void ioapic_unmask(uint32_t irq);
+void ioapic_mask(uint32_t irq);
+
+#endif /* ASM */
+
+#endif /* _APIC_H */
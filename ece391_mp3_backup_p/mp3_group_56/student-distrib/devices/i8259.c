@@ -6,6 +6,7 @@
 #include "keyboard.h"
 #include "rtc.h"
 #include "pit.h"
+#include "apic.h"
 #include "../lib.h"
 #include "../x86_desc.h"
 
@@ -34,6 +35,9 @@ void i8259_init(void) {
 
     // Offset primary PIC to 0x20 on IDT, offset secondary PIC to 0x28 on IDT
 	PIC_remap(ICW2_MASTER, ICW2_SLAVE);
+
+    // with SMP the I/O APIC delivers the same IRQs on the same vectors
+    ioapic_take_over();
 	
 	// Other devices are initialized in helper functions after 8259
     init_keyboard();
@@ -52,6 +56,11 @@ void i8259_init(void) {
  *   SIDE EFFECTS: updates master_mask and slave_mask as well as PIC internal state
  */  
 void enable_irq(uint32_t irq_num) {
+    if (ioapic_active()) {
+        ioapic_unmask(irq_num);
+        return;
+    }
+
     // Check if the interrupt is occurring on the second or the first pic
     // Each PIC has 8 IRQs so IRQs 0-7 are primary, 8-15 are secondary
     if (irq_num < 8) {
@@ -75,13 +84,18 @@ void enable_irq(uint32_t irq_num) {
  *   SIDE EFFECTS: updates master_mask and slave_mask as well as PIC internal state
  */  
 void disable_irq(uint32_t irq_num) {
+    if (ioapic_active()) {
+        ioapic_mask(irq_num);
+        return;
+    }
+
     // Same thing as the enable except we OR it with the mask to disable the interrupt
     // This will make that corresponding IRQ disabled
     if (irq_num < 8) {
-        master_mask |= (~(1 << irq_num));
+        master_mask |= (1 << irq_num);
         outb(master_mask, PIC1_DATA);
     } else {
-        slave_mask |= (~(1 << (irq_num - 8)));
+        slave_mask |= (1 << (irq_num - 8));
         outb(slave_mask, PIC2_DATA);
     }
     return;
@@ -96,6 +110,11 @@ void disable_irq(uint32_t irq_num) {
  *   SIDE EFFECTS: updates PIC internal state to tell it to stop the interrupt
  */  
 void send_eoi(uint32_t irq_num) {
+    if (ioapic_active()) {
+        lapic_eoi();
+        return;
+    }
+
     // Check if the irq is from the secondary or primary
     if (irq_num >= 8) {
         // Have to send EOI to primary and secondary to let them know interrupt is over
@@ -8,11 +8,19 @@
 #include "../x86_desc.h"
 #include "keyboard.h"
 #include "../terminal.h"   
+#include "../irq.h"
 
 extern int new_terminal_flag;
 
 uint8_t special_key_flags[NUM_SPECIAL_FLAGS] = { 0, 0, 0, 0 };
 
+/* Scancode ring between the top half (only writes head) and the bottom half
+ * (only writes tail). Both only ever count up, the mask picks the slot. */
+static volatile uint8_t kbd_ring[KBD_RING_SIZE];
+static volatile uint32_t kbd_head = 0;
+static volatile uint32_t kbd_tail = 0;
+static uint32_t kbd_dropped = 0;
+
 const unsigned char keyboard_map[128] =
     {
         0, 27, '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '-', '=', '\b',    // 0 - 14
@@ -93,38 +101,76 @@ const unsigned char shift_keyboard_map[128] =
  *   SIDE EFFECTS: enables IRQ1 on PIC for the keyboard
  */ 
 void init_keyboard() {
+    request_irq(1, keyboard_handler);
+#ifdef KEYBOARD_BOTTOM_HALF
+    open_softirq(SOFTIRQ_KEYBOARD, keyboard_bottom_half);
+#endif
     // Let PIC enable the IRQ1 for keyboard
     enable_irq(1);
 }
 
 /*
  *   keyboard_handler
- *   DESCRIPTION: This is the handler for the keyboard interrupts. It reads the data from port x60 and sends an EOI
+ *   DESCRIPTION: This is the top half for the keyboard interrupts. It queues the
+ *                scancode and raises the keyboard softirq, which decodes it with
+ *                interrupts back on. Without KEYBOARD_BOTTOM_HALF everything
+ *                happens here with them off. do_irq sends the EOI.
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
  *   SIDE EFFECTS: prints any keyboard input to the screen
  */ 
 void keyboard_handler() {
+#ifdef KEYBOARD_BOTTOM_HALF
+    uint8_t keycode = inb(KEYBOARD_PORT);
+
+    // Queue it for the bottom half, drop it if the ring is full
+    if (kbd_head - kbd_tail < KBD_RING_SIZE) {
+        kbd_ring[kbd_head & KBD_RING_MASK] = keycode;
+        asm volatile ("" : : : "memory");
+        kbd_head++;
+        raise_softirq(SOFTIRQ_KEYBOARD);
+    } else {
+        kbd_dropped++;
+    }
+#else
     // Read input from keyboard
-    keyboard_driver();
-    
-    // Signal that interrupt is done
-    send_eoi(1);
+    keyboard_driver(inb(KEYBOARD_PORT));
+#endif
+}
+
+/*
+ *   keyboard_bottom_half
+ *   DESCRIPTION: Keyboard softirq, decodes every queued scancode. Runs with
+ *                interrupts enabled and never nested, so keys pressed
+ *                meanwhile are queued and picked up by the same loop.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: echoes keys, updates the terminal buffer
+ */ 
+void keyboard_bottom_half() {
+    uint8_t keycode;
+
+    while (kbd_tail != kbd_head) {
+        keycode = kbd_ring[kbd_tail & KBD_RING_MASK];
+        asm volatile ("" : : : "memory");
+        kbd_tail++;
+        keyboard_driver(keycode);
+    }
 }
 
 /* keyboard_driver
- * Inputs: none
+ * Inputs: keycode = scancode read from the keyboard port
  * Return Value: none
- * Function: reads in from keyboard port and decodes keycode. Sends necessary data to terminal to update the buffer */
-void keyboard_driver() {
+ * Function: decodes keycode. Sends necessary data to terminal to update the buffer */
+void keyboard_driver(uint8_t keycode) {
     // TODO: leave if new term flag set, we need wait for term to start
     if(new_terminal_flag == 1 || !is_terminals_initialized()) return;
     int term = get_terminal_idx();
     //printf("keyboard int occured\n");
     //unsigned char status;
     // give to active terminal the keycoamdndadaADadadasdadadadadaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa
-    unsigned char keycode = inb(KEYBOARD_PORT);  
     // Control key code: 29
     // Set special 
     //printf("%d",keycode);
@@ -173,6 +219,15 @@ void keyboard_driver() {
             putc_terminal(' ', term);
             write_to_terminal(keyboard_map[keycode]);
             return;
+        case PAGE_UP:
+            // Shift+PgUp browses back through the terminal's history
+            if (special_key_flags[SHIFT_INDEX])
+                scroll_terminal_history(term, SCROLLBACK_STEP);
+            return;
+        case PAGE_DOWN:
+            if (special_key_flags[SHIFT_INDEX])
+                scroll_terminal_history(term, -SCROLLBACK_STEP);
+            return;
         default:
             if(get_buffer_fill() == 127) return; //do check in terminal
             if (keycode > 0 && keycode < 58) {
@@ -17,6 +17,16 @@
 #define BACKSPACE 14
 
 #define TAB 15
+/* also sent after an 0xE0 prefix by the grey keys */
+#define PAGE_UP 73
+#define PAGE_DOWN 81
+
+/* Comment out to decode keys inside the IRQ1 handler with interrupts off */
+#define KEYBOARD_BOTTOM_HALF
+
+/* raw scancodes waiting for the bottom half, must be a power of 2 */
+#define KBD_RING_SIZE 64
+#define KBD_RING_MASK (KBD_RING_SIZE - 1)
 
 #define CTRL_INDEX 0 
 #define SHIFT_INDEX 1
@@ -33,7 +43,9 @@ void init_keyboard();
 
 // For when the interrupt occurs
 void keyboard_handler();
-// handles reading and interaction with temrinal
-void keyboard_driver();
+// decodes a scancode and handles interaction with temrinal
+void keyboard_driver(uint8_t keycode);
+// drains the scancode ring with interrupts on
+void keyboard_bottom_half();
 
 #endif
@@ -5,13 +5,17 @@
 #include "../syscall_helpers.h"
 #include "pit.h"
 #include "../terminal.h"
+#include "../irq.h"
+#include "../trace.h"
+#include "../profile.h"
+#include "../smp.h"
 
-int32_t schedule_index = 0;
 int32_t init_schedule_index = 0;
 extern int new_terminal_flag;
 int terminals_initialized = 0;
 int init_wait_count = 50;
 int pit_wait_count = 0;
+static uint32_t pit_ticks = 0;
 
 /*
  *   is_terminals_initialized
@@ -50,12 +54,13 @@ void init_pit() {
     outb(count >> 8, PIT_CHANNEL0_DATA);
 
     // Enable the irq on the PIC
+    request_irq(0, pit_handler);
     enable_irq(0);
 }
 
 /*
  *   get_schedule_idx
- *   DESCRIPTION: Grabs the index of the current scheduled process
+ *   DESCRIPTION: Grabs the terminal of the process scheduled on this CPU
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
@@ -66,12 +71,12 @@ int get_schedule_idx()
     // Conditional check to see if we need to initialize our terminals
     if (!terminals_initialized)
         return init_schedule_index;
-    return schedule_index;
+    return this_cpu()->schedule_index;
 }
 
 /*
  *   set_schedule_idx
- *   DESCRIPTION: Updates the schedule index
+ *   DESCRIPTION: Updates the schedule index of this CPU
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
@@ -79,18 +84,73 @@ int get_schedule_idx()
  */  
 void set_schedule_idx(int index)
 {
-    schedule_index = index;
+    this_cpu()->schedule_index = index;
+}
+
+/*
+ *   next_terminal
+ *   DESCRIPTION: Round robin over the terminals in a CPU's run queue
+ *   INPUTS: cpu - the calling CPU's entry
+ *   OUTPUTS: none
+ *   RETURN VALUE: first terminal after the current one that is in
+ *                 terminal_mask, -1 if the mask is empty
+ *   SIDE EFFECTS: none
+ */  
+static int32_t next_terminal(cpu_t* cpu)
+{
+    uint32_t mask = cpu->terminal_mask;
+    int32_t i, t;
+
+    for (i = 1; i <= 3; i++) {
+        t = (cpu->schedule_index + i) % 3;
+        if (mask & (1 << t))
+            return t;
+    }
+    return -1;
 }
 
 /*
  *   pit_handler
- *   DESCRIPTION: Saves previous state of old process and sets up for the next scheduled process
+ *   DESCRIPTION: Top half for the PIT, counts the tick and asks for a reschedule on interrupt exit
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sets need_resched, passes the tick on to the APs
+ */  
+void pit_handler () {
+    pit_ticks++;
+    profile_tick(PROF_SOURCE_PIT);
+    set_need_resched();
+    smp_send_resched();
+}
+
+/*
+ *   get_pit_ticks
+ *   DESCRIPTION: Number of PIT interrupts since boot
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: tick count
+ *   SIDE EFFECTS: none
+ */  
+uint32_t get_pit_ticks () {
+    return pit_ticks;
+}
+
+/*
+ *   schedule
+ *   DESCRIPTION: Saves previous state of old process and sets up for the next process in this
+ *                CPU's terminal_mask. Called by do_irq with interrupts off after the EOI has gone out.
  *   INPUTS: none
  *   OUTPUTS: int - doesn't do anything though
  *   RETURN VALUE: none
  *   SIDE EFFECTS: Changes vid mapping to current scheduled terminal as well as saving stack and base pointers for old process
  */  
-void pit_handler () {
+void schedule () {
+    cpu_t * cpu = this_cpu();
+    pcb_t * prev_pcb;
+    pcb_t * next_pcb;
+    int32_t next;
+
     // If terminals are not initialized, there is additional work we need to do
     if (!terminals_initialized)
     {
@@ -120,35 +180,46 @@ void pit_handler () {
             // Switch back to first process and let program know we are done with setup
             terminal_switch(0);
             terminals_initialized = 1;
-            schedule_index = 2;
+            cpu->schedule_index = 2;
+            // terminals 1 and 2 go to the APs, if there are any
+            smp_assign_terminals();
         }
     }
 
-    // Increment scheduling index to next terminal
-    schedule_index++;
-    schedule_index %= 3;
+    // Next terminal in this CPU's run queue, an AP may have none yet
+    next = next_terminal(cpu);
+    if (next < 0)
+        return;
+    cpu->schedule_index = next;
 
-    // Save stack and base pointer for iret context in current pcb struct
-    asm volatile (
-        "movl %%esp, %0   ;\
-         movl %%ebp, %1   ;\
-        "
-        : "=r" (get_curr_pcb_ptr()->kernel_esp), "=r" (get_curr_pcb_ptr()->kernel_ebp)
-        :
-        : "memory"
-    );
+    // Save stack and base pointer for iret context in current pcb struct,
+    // an AP's first switch comes from its idle stack which has no pcb
+    prev_pcb = get_acct_pcb();
+    if (prev_pcb != NULL) {
+        asm volatile (
+            "movl %%esp, %0   ;\
+             movl %%ebp, %1   ;\
+            "
+            : "=r" (prev_pcb->kernel_esp), "=r" (prev_pcb->kernel_ebp)
+            :
+            : "memory"
+        );
+    }
 
     // Grab the next child pcb for the next scheduled item
-    pcb_t * next_pcb = get_child_pcb(schedule_index);
+    next_pcb = get_child_pcb(next);
+    TRACE(TRACE_SWITCH, next_pcb->pid, next);
+    acct_switch(next_pcb);
+    fpu_switch(next_pcb);
 
     // Update task segment selector
-    tss.ss0 = (uint16_t) KERNEL_DS;
-    tss.esp0 = (uint32_t) next_pcb + EIGHT_KB - STACK_FENCE_SIZE;
+    set_kernel_stack((uint32_t) next_pcb + EIGHT_KB - STACK_FENCE_SIZE);
     
     // Swap vid map for the user page
     setup_user_page(((next_pcb->pid * FOUR_MB) + EIGHT_MB) / FOUR_KB);
     
-    // Grab the esp and ebp to jump back to the current scheduled process
+    // Grab the esp and ebp to jump back to the current scheduled process,
+    // nothing of this frame is used after this
     asm volatile (
         "movl %%eax, %%esp   ;\
          movl %%ebx, %%ebp   ;\
@@ -157,5 +228,4 @@ void pit_handler () {
         : "a" (next_pcb->kernel_esp), "b" (next_pcb->kernel_ebp)
         : "memory"
     );
-    send_eoi(0);    
 }
@@ -8,9 +8,15 @@
 #define PIT_CHANNEL2_DATA   0x42
 #define PIT_COMMAND         0x43
 
-// Sends an interupt to the PIC to let PIC know we're doing a process switch
+// Top half for the PIT, requests a process switch
 void pit_handler();
 
+// Switches to the next terminal's process, called on interrupt exit
+void schedule();
+
+// PIT interrupts since boot
+uint32_t get_pit_ticks();
+
 // Intializes the pit on the PIC
 void init_pit();
 
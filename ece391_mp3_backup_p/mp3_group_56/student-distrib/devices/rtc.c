@@ -13,10 +13,18 @@ IMPORTANT: What is important is that if register C is not read after an IRQ 8, t
 #include "../lib.h"
 #include "../x86_desc.h"
 #include "../syscall_helpers.h"
+#include "../irq.h"
+#include "../profile.h"
+#include "../page_pool.h"
+#include "../spinlock.h"
 
 
 volatile int clock_count[3];
 static int wait_count[3];
+static int hw_div = 1;              // chip interrupts per virtual RTC_MAX_FREQ tick
+static int hw_div_count = 0;
+// the counters above and the chip's index register
+static spinlock_t rtc_lock = SPINLOCK_INIT("rtc");
 
 /*
  *   init_rtc
@@ -48,6 +56,7 @@ void init_rtc() {
     outb((prev & 0xF0) | rate, RTC_PORT_DATA); //write only our rate to A. Note, rate is the bottom 4 bits.
 
     // Enable both the primary PIC IRQ2 port as well as IRQ0 on the secondary PIC
+    request_irq(8, rtc_handler);
     enable_irq(2);
     enable_irq(8);
 
@@ -65,14 +74,23 @@ void init_rtc() {
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: Clears out status register C so we can receive another timer interrupt
+ *   SIDE EFFECTS: Clears out status register C so we can receive another timer interrupt,
+ *                 do_irq sends the EOI
  */ 
 void rtc_handler() {
     //printf("%d\n", clock_count);
     rtc_int_flag = 1;
-    clock_count[0]++;
-    clock_count[1]++;
-    clock_count[2]++;
+    profile_tick(PROF_SOURCE_RTC);
+
+    // interrupts are already off in a handler
+    spin_lock(&rtc_lock);
+    // when the profiler speeds the chip up, the programs still count RTC_MAX_FREQ ticks
+    if (++hw_div_count >= hw_div) {
+        hw_div_count = 0;
+        clock_count[0]++;
+        clock_count[1]++;
+        clock_count[2]++;
+    }
     
     // if (clock_count == freq)
     // {
@@ -87,9 +105,37 @@ void rtc_handler() {
     // Therefore, we have to simply read from register C and just throwaway the date since we don't need it
     outb(0x0C, RTC_PORT_COMMAND);	// select register C
     inb(RTC_PORT_DATA);		        // just throw away contents
+    spin_unlock(&rtc_lock);
     
     rtc_int_flag = 0;
-    send_eoi(8);
+}
+
+/*
+ *   rtc_set_hw_freq
+ *   DESCRIPTION: Changes the rate the chip interrupts at without changing what
+ *                rtc_read waits for
+ *   INPUTS: freq - power of 2 from RTC_MAX_FREQ to RTC_MAX_HW_FREQ
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on a bad frequency
+ *   SIDE EFFECTS: writes register A
+ */
+int32_t rtc_set_hw_freq(int32_t freq) {
+    uint32_t flags;
+    int rate = 16;  // frequency is 32768 >> (rate - 1)
+    char prev;
+
+    if (freq < RTC_MAX_FREQ || freq > RTC_MAX_HW_FREQ || (freq & (freq - 1))) return -1;
+    while ((1 << (16 - rate)) < freq) rate--;
+
+    spin_lock_irqsave(&rtc_lock, flags);
+    outb(0x8A, RTC_PORT_COMMAND);           // select register A, NMI off
+    prev = inb(RTC_PORT_DATA);
+    outb(0x0A, RTC_PORT_COMMAND);           // and back on for the write, as in init_rtc
+    outb((prev & 0xF0) | rate, RTC_PORT_DATA);
+    hw_div = freq / RTC_MAX_FREQ;
+    hw_div_count = 0;
+    spin_unlock_irqrestore(&rtc_lock, flags);
+    return 0;
 }
 
 /* rtc_open
@@ -97,10 +143,11 @@ void rtc_handler() {
  * Return Value: 0
  * Function: sets starting settings */
 int32_t rtc_open(const uint8_t * filename) {
-    cli();
+    uint32_t flags;
+    spin_lock_irqsave(&rtc_lock, flags);
     wait_count[get_schedule_idx()] = RTC_MAX_FREQ / RTC_INIT_FREQ;
     clock_count[get_schedule_idx()] = 0;
-    sti();
+    spin_unlock_irqrestore(&rtc_lock, flags);
     // copy stuff and set up dentry for rtc.
     return 0;
 }
@@ -114,12 +161,13 @@ int32_t rtc_open(const uint8_t * filename) {
  *   SIDE EFFECTS: modifies the file descriptor array
  */
 int32_t rtc_close(int32_t fd) {
-    cli();
+    uint32_t flags;
     pcb_t * pcb = get_curr_pcb_ptr();
     pcb->file_desc_arr[fd].flags = 0;
+    spin_lock_irqsave(&rtc_lock, flags);
     wait_count[get_schedule_idx()] = 0;
     clock_count[get_schedule_idx()] = 0;
-    sti();
+    spin_unlock_irqrestore(&rtc_lock, flags);
     return 0;
 }
 
@@ -129,11 +177,13 @@ int32_t rtc_close(int32_t fd) {
  * Return Value: 0, always suceeds
  * Function: holds and returns when an RTC interupt occurs */
 int32_t rtc_read(int32_t fd, void * buf, int32_t nbytes) {
+    uint32_t flags;
     sti();
-    while (clock_count[get_schedule_idx()] <= wait_count[get_schedule_idx()]); // wait to get response
-    cli();
+    while (clock_count[get_schedule_idx()] <= wait_count[get_schedule_idx()]) // wait to get response
+        page_pool_idle();
+    spin_lock_irqsave(&rtc_lock, flags);
     clock_count[get_schedule_idx()] = 0; //reset
-    sti();
+    spin_unlock_irqrestore(&rtc_lock, flags);
     while (rtc_int_flag != 0); //wait until not interupting to return
     
     return 0;
@@ -144,17 +194,16 @@ int32_t rtc_read(int32_t fd, void * buf, int32_t nbytes) {
  * Return Value: 0 for sucess -1 for fail
  * Function: writes the input frequency from buf, to set the frequency of RTC interupts */
 int32_t rtc_write(int32_t fd, const void * buf, int32_t nbytes) {
-    cli();
+    uint32_t flags;
     int freq = *(const int *)buf; //load freq
     // freq *= 8;
     if (freq < 2 || freq > 1024) return -1; // param check
-    if (freq && (! (freq & (freq-1)))) { //check power of 2
-        wait_count[get_schedule_idx()] = RTC_MAX_FREQ/freq; //update settings
-        clock_count[get_schedule_idx()] = 0;
-        return 0;
-    }
-    sti();
-    return -1;
+    if (freq & (freq-1)) return -1; //check power of 2
+    spin_lock_irqsave(&rtc_lock, flags);
+    wait_count[get_schedule_idx()] = RTC_MAX_FREQ/freq; //update settings
+    clock_count[get_schedule_idx()] = 0;
+    spin_unlock_irqrestore(&rtc_lock, flags);
+    return 0;
 };
 
 // USEFUL WEBSITE FOR UDERSTANDING THE REGISTER CONTENTS FOR RTC
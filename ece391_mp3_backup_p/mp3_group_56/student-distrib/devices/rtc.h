@@ -7,6 +7,8 @@
 #define RTC_PORT_DATA       0x71
 #define RTC_MAX_FREQ        1024 //32768
 #define RTC_INIT_FREQ       2
+/* fastest the chip is run, for the profiler */
+#define RTC_MAX_HW_FREQ     8192
 
 /* standard file functions for the RTC */
 int32_t rtc_read(int32_t fd, void * buf, int32_t nbytes);
@@ -19,6 +21,9 @@ static volatile int rtc_int_flag;
 // Intialize the RTC
 void init_rtc();
 
+// Runs the chip at freq (power of 2, RTC_MAX_FREQ to RTC_MAX_HW_FREQ), rtc_read still sees RTC_MAX_FREQ
+int32_t rtc_set_hw_freq(int32_t freq);
+
 // Handles the RTC when it is called in an interrupt
 void rtc_handler();
 
@@ -1,6 +1,8 @@
 #include "exceptions.h"
 #include "lib.h"
 #include "syscall.h"
+#include "trace.h"
+#include "syscall_helpers.h"
 
 /* Handlers for exceptions in IDT in order of vector number*/
 
@@ -225,6 +227,13 @@ int general_protection() {
  *   SIDE EFFECTS: for now just prints the current exception that has occurred
  */ 
 int page_fault() {
+#ifdef TRACE_ENABLED
+    uint32_t fault_addr;
+    asm volatile ("movl %%cr2, %0" : "=r" (fault_addr));
+    TRACE(TRACE_PAGE_FAULT, 0, fault_addr);
+#endif
+    pcb_t * pcb = get_acct_pcb();
+    if (pcb != NULL) pcb->acct.page_faults++;
     sti();
     // printf("Page fault occurred\n");
     int term  = get_terminal_idx();
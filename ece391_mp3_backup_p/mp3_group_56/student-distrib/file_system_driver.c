@@ -3,6 +3,7 @@
 #include "types.h"
 #include "syscall.h"
 #include "syscall_helpers.h"
+#include "trace.h"
 
 /* 
  * init_file_system
@@ -237,4 +238,9 @@ void init_ops_tables() {
     rtc_ops_table.close = rtc_close;
     rtc_ops_table.read = rtc_read;
     rtc_ops_table.write = rtc_write;
+
+    tracebuf_ops_table.open = trace_open;
+    tracebuf_ops_table.close = trace_close;
+    tracebuf_ops_table.read = trace_read;
+    tracebuf_ops_table.write = trace_write;
 }
@@ -84,6 +84,7 @@ template_ops_table_t stdin_ops_table;
 template_ops_table_t stdout_ops_table;
 template_ops_table_t file_ops_table;
 template_ops_table_t rtc_ops_table;
+template_ops_table_t tracebuf_ops_table;
 
 /* file system instantiation */
 boot_block_t * boot_block_ptr; // Pointer to our boot block
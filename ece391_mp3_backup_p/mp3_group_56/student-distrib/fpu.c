@@ -0,0 +1,254 @@
+#include "fpu.h"
+#include "cpu.h"
+#include "lib.h"
+#include "exceptions.h"
+#include "syscall_helpers.h"
+#include "smp.h"
+
+/*
+ * The x87/SSE registers are not touched on a process switch. CR0.TS is set
+ * instead whenever the next process is not the one whose values are in the
+ * registers, and the first FPU or SSE instruction it runs traps with #NM.
+ * Only then are the owner's registers saved into its PCB and the new
+ * process's loaded, so programs that never use the FPU never pay for it.
+ * Every CPU has its own registers, so the owner and TS are per CPU.
+ */
+static pcb_t* fpu_owner[MAX_CPUS];  // process whose state is in the registers
+static int32_t fpu_enabled = 0;
+static int32_t use_fxsr = 0;        // fxsave/fxrstor instead of fnsave/frstor
+static int32_t ts_set[MAX_CPUS];    // mirrors CR0.TS to skip redundant writes
+static uint8_t clean_state[FPU_STATE_SIZE] __attribute__((aligned(FPU_STATE_ALIGN)));
+static fpu_stats_t fpu_stats;
+
+/*
+ * set_ts
+ *   DESCRIPTION: Sets CR0.TS so the next FPU/SSE instruction traps
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes CR0
+ */
+static void set_ts(void) {
+    asm volatile (
+        "movl %%cr0, %%eax  ;\
+         orl %0, %%eax      ;\
+         movl %%eax, %%cr0  ;\
+        "
+        :
+        : "i" (CR0_TS)
+        : "eax", "memory"
+    );
+    ts_set[smp_cpu_index()] = 1;
+}
+
+/*
+ * clear_ts
+ *   DESCRIPTION: Clears CR0.TS so FPU/SSE instructions run
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes CR0
+ */
+static void clear_ts(void) {
+    asm volatile ("clts" : : : "memory");
+    ts_set[smp_cpu_index()] = 0;
+}
+
+/*
+ * save_state
+ *   DESCRIPTION: Saves the FPU/SSE registers. fnsave also reinitializes
+ *                the FPU, which is fine since a restore always follows.
+ *   INPUTS: area - FPU_STATE_SIZE bytes, 16 byte aligned
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: TS must be clear
+ */
+static void save_state(uint8_t* area) {
+    if (use_fxsr)
+        asm volatile ("fxsave (%0)" : : "r" (area) : "memory");
+    else
+        asm volatile ("fnsave (%0)" : : "r" (area) : "memory");
+}
+
+/*
+ * restore_state
+ *   DESCRIPTION: Loads the FPU/SSE registers saved by save_state
+ *   INPUTS: area - FPU_STATE_SIZE bytes, 16 byte aligned
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: TS must be clear
+ */
+static void restore_state(uint8_t* area) {
+    if (use_fxsr)
+        asm volatile ("fxrstor (%0)" : : "r" (area) : "memory");
+    else
+        asm volatile ("frstor (%0)" : : "r" (area) : "memory");
+}
+
+/*
+ * init_fpu
+ *   DESCRIPTION: Turns off x87 emulation, makes WAIT honour TS, and saves
+ *                the state every process starts from. Needs
+ *                init_cpu_features to have run so fxsave is known to work.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes CR0, leaves TS set
+ */
+void init_fpu(void) {
+    use_fxsr = cpu_has_feature(CPU_FEATURE_FXSR);
+    asm volatile (
+        "movl %%cr0, %%eax  ;\
+         orl %0, %%eax      ;\
+         andl %1, %%eax     ;\
+         movl %%eax, %%cr0  ;\
+        "
+        :
+        : "i" (CR0_MP), "i" (~CR0_EM)
+        : "eax", "memory"
+    );
+    clear_ts();
+    // MXCSR is still at its reset value, fninit only covers the x87 part
+    asm volatile ("fninit" : : : "memory");
+    save_state(clean_state);
+    restore_state(clean_state);
+    set_ts();
+    fpu_enabled = 1;
+}
+
+/*
+ * fpu_switch
+ *   DESCRIPTION: Arms the #NM trap unless next already owns the registers
+ *   INPUTS: next - process about to run
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may write CR0
+ */
+void fpu_switch(pcb_t* next) {
+    uint32_t cpu = smp_cpu_index();
+
+    if (!fpu_enabled) return;
+    if (next == fpu_owner[cpu]) {
+        if (ts_set[cpu]) clear_ts();
+    } else if (!ts_set[cpu]) {
+        set_ts();
+    }
+}
+
+/*
+ * fpu_release
+ *   DESCRIPTION: Drops a halting process's FPU state, the next process in
+ *                its PCB starts clean. A process only runs on one CPU once
+ *                the terminals are handed out, so only this CPU can own it.
+ *   INPUTS: pcb - the process
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void fpu_release(pcb_t* pcb) {
+    pcb_t** owner;
+    uint32_t flags;
+
+    cli_and_save(flags);
+    owner = &fpu_owner[smp_cpu_index()];
+    if (*owner == pcb) *owner = NULL;
+    pcb->fpu_used = 0;
+    restore_flags(flags);
+}
+
+/*
+ * fpu_trap
+ *   DESCRIPTION: Handles #NM. Saves the owner's registers, loads the
+ *                current process's (or the clean state on its first use)
+ *                and lets the faulting instruction run again.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: clears TS, changes the owner
+ */
+void fpu_trap(void) {
+    pcb_t* pcb;
+    pcb_t** owner;
+    uint32_t flags;
+
+    // without lazy switching set up #NM is still a fatal exception
+    if (!fpu_enabled) {
+        device_not_available();
+        return;
+    }
+
+    cli_and_save(flags);
+    clear_ts();
+    fpu_stats.traps++;
+    pcb = get_acct_pcb();
+    owner = &fpu_owner[smp_cpu_index()];
+    if (pcb != *owner) {
+        if (*owner != NULL) {
+            save_state((*owner)->fpu_state);
+            fpu_stats.saves++;
+        }
+        if (pcb != NULL && pcb->fpu_used) {
+            restore_state(pcb->fpu_state);
+            fpu_stats.restores++;
+        } else {
+            restore_state(clean_state);
+            fpu_stats.inits++;
+        }
+        if (pcb != NULL) pcb->fpu_used = 1;
+        *owner = pcb;
+    }
+    restore_flags(flags);
+}
+
+/*
+ * kernel_fpu_begin
+ *   DESCRIPTION: Makes the FPU/SSE registers safe for the kernel to use.
+ *                The owner's state is saved and it loses ownership, so its
+ *                next FPU instruction reloads it.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: EFLAGS to pass to kernel_fpu_end
+ *   SIDE EFFECTS: interrupts off until kernel_fpu_end, clears TS
+ */
+uint32_t kernel_fpu_begin(void) {
+    pcb_t** owner;
+    uint32_t flags;
+
+    cli_and_save(flags);
+    fpu_stats.kernel_uses++;
+    if (!fpu_enabled) return flags;
+    clear_ts();
+    owner = &fpu_owner[smp_cpu_index()];
+    if (*owner != NULL) {
+        save_state((*owner)->fpu_state);
+        fpu_stats.saves++;
+        *owner = NULL;
+    }
+    return flags;
+}
+
+/*
+ * kernel_fpu_end
+ *   DESCRIPTION: Ends a kernel_fpu_begin section
+ *   INPUTS: flags - what kernel_fpu_begin returned
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sets TS, restores interrupts
+ */
+void kernel_fpu_end(uint32_t flags) {
+    if (fpu_enabled) set_ts();
+    restore_flags(flags);
+}
+
+/*
+ * get_fpu_stats
+ *   DESCRIPTION: Copies the lazy switching counters
+ *   INPUTS: stats - where to copy them
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void get_fpu_stats(fpu_stats_t* stats) {
+    if (stats == NULL) return;
+    *stats = fpu_stats;
+}
@@ -0,0 +1,49 @@
+/* fpu.h - Lazy saving of x87/SSE registers across process switches
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _FPU_H
+#define _FPU_H
+
+#include "types.h"
+
+/* fxsave image, fnsave only needs the first 108 bytes */
+#define FPU_STATE_SIZE  512
+#define FPU_STATE_ALIGN 16
+
+/* CR0 bits */
+#define CR0_MP          0x00000002
+#define CR0_EM          0x00000004
+#define CR0_TS          0x00000008
+
+#ifndef ASM
+
+struct pcb;
+
+/* How often the lazy scheme had to do real work */
+typedef struct fpu_stats_t {
+    uint32_t traps;             // #NM taken
+    uint32_t saves;             // fxsave of a previous owner
+    uint32_t restores;          // fxrstor of a process's own state
+    uint32_t inits;             // first use, clean state loaded
+    uint32_t kernel_uses;       // kernel_fpu_begin calls
+} fpu_stats_t;
+
+/* Sets CR0 up for lazy switching and records the clean state */
+void init_fpu(void);
+/* Called whenever a different process is about to run */
+void fpu_switch(struct pcb* next);
+/* Forgets a halting process's registers */
+void fpu_release(struct pcb* pcb);
+/* The #NM handler, entered from device_not_available_linkage */
+void fpu_trap(void);
+/* Lets the kernel use the FPU/SSE registers, interrupts stay off until
+ * kernel_fpu_end, which takes what kernel_fpu_begin returned */
+uint32_t kernel_fpu_begin(void);
+void kernel_fpu_end(uint32_t flags);
+/* Copies out the counters */
+void get_fpu_stats(fpu_stats_t* stats);
+
+#endif /* ASM */
+
+#endif /* _FPU_H */
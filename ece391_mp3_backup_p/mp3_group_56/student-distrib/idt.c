@@ -3,6 +3,7 @@
 #include "asm_linkage.h"
 #include "lib.h" // for printing
 #include "syscall.h"
+#include "devices/apic.h"
 
 /* NOTE: IDT DPL levels - @ page 113
  * 0 - OS kernel
@@ -55,7 +56,8 @@ void init_idt() {
             idt[i].reserved2 = 1;
             idt[i].reserved3 = 1;
             idt[i].seg_selector = KERNEL_CS;
-        } else if (i == 0x20 || i == 0x21 || i == 0x28) {
+        } else if (i == 0x20 || i == 0x21 || i == 0x28 || i == APIC_SPURIOUS_VECTOR ||
+                   i == RESCHED_VECTOR) {
             idt[i].present = 1;
             idt[i].dpl = 0; // set privilege level 1
             idt[i].reserved0 = 0;
@@ -85,7 +87,7 @@ void init_idt() {
     SET_IDT_ENTRY(idt[0x04], overflow);
     SET_IDT_ENTRY(idt[0x05], bound_range_exceeded);
     SET_IDT_ENTRY(idt[0x06], invalid_opcode);
-    SET_IDT_ENTRY(idt[0x07], device_not_available);
+    SET_IDT_ENTRY(idt[0x07], device_not_available_linkage); // lazy FPU switch
     SET_IDT_ENTRY(idt[0x08], double_fault);
     SET_IDT_ENTRY(idt[0x09], coprocessor_segment_overrun);
     SET_IDT_ENTRY(idt[0x0A], invalid_tss);
@@ -109,5 +111,11 @@ void init_idt() {
     // RTC PIC Intertupt
     SET_IDT_ENTRY(idt[0x28], rtc_handler_linkage); // PIC INT call
     
+    // Local APIC spurious interrupt, only ever seen with SMP
+    SET_IDT_ENTRY(idt[APIC_SPURIOUS_VECTOR], apic_spurious_linkage);
+
+    // PIT tick passed on by the BSP, only ever seen on the APs
+    SET_IDT_ENTRY(idt[RESCHED_VECTOR], resched_ipi_linkage);
+
     SET_IDT_ENTRY(idt[0x80], system_call_handler); // INT system call    
 }
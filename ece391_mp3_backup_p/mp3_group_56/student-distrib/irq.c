@@ -0,0 +1,229 @@
+/* irq.c - Common entry for device interrupts and deferred work
+ * vim:ts=4 noexpandtab
+ */
+
+#include "irq.h"
+#include "lib.h"
+#include "devices/i8259.h"
+#include "devices/pit.h"
+#include "trace.h"
+#include "syscall_helpers.h"
+#include "smp.h"
+
+/* Device interrupts and softirqs only ever run on the BSP. The APs take
+ * the reschedule IPI, so nesting, the pending switch and the counters
+ * are kept per CPU. */
+static irq_handler_t irq_handlers[NUM_IRQS];
+static irq_stats_t irq_stats[MAX_CPUS][NUM_IRQS];
+static irq_regs_t* current_regs[MAX_CPUS];
+
+static softirq_func_t softirq_funcs[NUM_SOFTIRQS];
+static volatile uint32_t softirq_pending = 0;
+static volatile int softirq_running = 0;
+
+static volatile int irq_depth[MAX_CPUS];        // interrupts currently on the stack
+static volatile int need_resched[MAX_CPUS];
+
+/*
+ * log2_bucket
+ *   DESCRIPTION: Histogram bucket for a cycle count
+ *   INPUTS: cycles
+ *   OUTPUTS: none
+ *   RETURN VALUE: index of the highest set bit, 0 for 0
+ *   SIDE EFFECTS: none
+ */
+static inline uint32_t log2_bucket(uint32_t cycles) {
+    uint32_t bit = 0;
+    if (cycles != 0)
+        asm ("bsrl %1, %0" : "=r" (bit) : "r" (cycles));
+    return bit;
+}
+
+/*
+ * run_softirqs
+ *   DESCRIPTION: Runs pending deferred work with interrupts enabled until
+ *                nothing is left. Work raised meanwhile (including by nested
+ *                interrupts) is picked up by the same loop, so only the
+ *                outermost caller ever runs it.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: must be called and returns with interrupts disabled
+ */
+static void run_softirqs(void) {
+    uint32_t pending;
+    int i;
+
+    if (softirq_running) return;
+    softirq_running = 1;
+
+    while ((pending = softirq_pending) != 0) {
+        softirq_pending = 0;
+        sti();
+        for (i = 0; i < NUM_SOFTIRQS; i++) {
+            if ((pending & (1 << i)) && softirq_funcs[i] != NULL)
+                softirq_funcs[i]();
+        }
+        cli();
+    }
+
+    softirq_running = 0;
+}
+
+/*
+ * do_irq
+ *   DESCRIPTION: Entry for every device interrupt. Runs the top half with
+ *                interrupts off, sends the EOI, then runs deferred work with
+ *                interrupts on. The outermost interrupt finally calls
+ *                schedule() if a top half asked for it.
+ *   INPUTS: irq - PIC line that fired
+ *           regs - registers saved by INTR_LINK
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may switch to another process before returning
+ */
+void do_irq(uint32_t irq, irq_regs_t* regs) {
+    uint64_t start = rdtsc();
+    uint32_t cpu = smp_cpu_index();
+    irq_regs_t* old_regs = current_regs[cpu];
+    int from_user = (regs->cs & 0x3) == 0x3;
+    irq_stats_t* st;
+    uint32_t cycles;
+
+    if (from_user)
+        acct_enter_kernel();
+    irq_depth[cpu]++;
+    current_regs[cpu] = regs;
+    TRACE(TRACE_IRQ_ENTER, irq, regs->eip);
+
+    if (irq < NUM_IRQS) {
+        if (irq_handlers[irq] != NULL)
+            irq_handlers[irq]();
+        send_eoi(irq);
+
+        cycles = (uint32_t) (rdtsc() - start);
+        st = &irq_stats[cpu][irq];
+        st->count++;
+        st->hist[log2_bucket(cycles)]++;
+        if (cycles > st->max_cycles)
+            st->max_cycles = cycles;
+    }
+
+    if (cpu == 0)
+        run_softirqs();
+
+    TRACE(TRACE_IRQ_EXIT, irq, 0);
+    current_regs[cpu] = old_regs;
+    irq_depth[cpu]--;
+
+    // switching stacks is only safe once nothing else is in progress here,
+    // a nested tick leaves need_resched for the interrupt it landed in.
+    // cpu must not be used after schedule(), this frame may be resumed on
+    // another CPU.
+    if (irq_depth[cpu] == 0 && !(cpu == 0 && softirq_running) && need_resched[cpu]) {
+        need_resched[cpu] = 0;
+        schedule();
+    }
+
+    // from_user lives on this stack, so after a switch it describes the
+    // process being resumed here
+    if (from_user)
+        acct_exit_kernel();
+}
+
+/*
+ * request_irq
+ *   DESCRIPTION: Installs the top half for an IRQ
+ *   INPUTS: irq - PIC line
+ *           handler - top half, runs with interrupts off before the EOI
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void request_irq(uint32_t irq, irq_handler_t handler) {
+    if (irq >= NUM_IRQS) return;
+    irq_handlers[irq] = handler;
+}
+
+/*
+ * open_softirq
+ *   DESCRIPTION: Registers deferred work
+ *   INPUTS: nr - softirq number
+ *           func - work to run on interrupt exit
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void open_softirq(uint32_t nr, softirq_func_t func) {
+    if (nr >= NUM_SOFTIRQS) return;
+    softirq_funcs[nr] = func;
+}
+
+/*
+ * raise_softirq
+ *   DESCRIPTION: Marks deferred work pending. Meant for top halves, so it
+ *                expects interrupts to be off.
+ *   INPUTS: nr - softirq number
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void raise_softirq(uint32_t nr) {
+    if (nr >= NUM_SOFTIRQS) return;
+    softirq_pending |= (1 << nr);
+}
+
+/*
+ * set_need_resched
+ *   DESCRIPTION: Asks do_irq to call schedule() on the way out, on the
+ *                calling CPU
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void set_need_resched(void) {
+    need_resched[smp_cpu_index()] = 1;
+}
+
+/*
+ * get_irq_regs
+ *   DESCRIPTION: Lets a top half see what it interrupted
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: saved registers of the innermost interrupt on this CPU, or NULL
+ *   SIDE EFFECTS: none
+ */
+irq_regs_t* get_irq_regs(void) {
+    return current_regs[smp_cpu_index()];
+}
+
+/*
+ * get_irq_stats
+ *   DESCRIPTION: Copies the counters and latency histogram of an IRQ,
+ *                summed over the CPUs
+ *   INPUTS: irq - PIC line or IRQ_RESCHED
+ *           stats - where to copy them
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on bad arguments
+ *   SIDE EFFECTS: none
+ */
+int32_t get_irq_stats(uint32_t irq, irq_stats_t* stats) {
+    irq_stats_t* st;
+    uint32_t flags;
+    int i, j;
+
+    if (irq >= NUM_IRQS || stats == NULL) return -1;
+    memset(stats, 0, sizeof(irq_stats_t));
+    cli_and_save(flags);
+    for (i = 0; i < MAX_CPUS; i++) {
+        st = &irq_stats[i][irq];
+        stats->count += st->count;
+        if (st->max_cycles > stats->max_cycles)
+            stats->max_cycles = st->max_cycles;
+        for (j = 0; j < IRQ_LAT_BUCKETS; j++)
+            stats->hist[j] += st->hist[j];
+    }
+    restore_flags(flags);
+    return 0;
+}
@@ -0,0 +1,66 @@
+/* irq.h - Common entry for device interrupts and deferred work
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _IRQ_H
+#define _IRQ_H
+
+#include "types.h"
+
+/* PIC lines 0-15, then the reschedule IPI the APs get from the BSP */
+#define IRQ_RESCHED         16
+#define NUM_IRQS            17
+/* latency histogram buckets, bucket i counts top halves of [2^i, 2^(i+1)) cycles */
+#define IRQ_LAT_BUCKETS     32
+
+/* Deferred work, lower numbers run first */
+#define SOFTIRQ_KEYBOARD    0
+#define NUM_SOFTIRQS        8
+
+#ifndef ASM
+
+/* Registers as INTR_LINK leaves them: pushal, then what the CPU pushed */
+typedef struct irq_regs_t {
+    uint32_t edi;
+    uint32_t esi;
+    uint32_t ebp;
+    uint32_t esp;
+    uint32_t ebx;
+    uint32_t edx;
+    uint32_t ecx;
+    uint32_t eax;
+    uint32_t eip;
+    uint32_t cs;
+    uint32_t eflags;
+} irq_regs_t;
+
+/* Per-IRQ counters, the cycles are from entry to the EOI */
+typedef struct irq_stats_t {
+    uint32_t count;
+    uint32_t max_cycles;
+    uint32_t hist[IRQ_LAT_BUCKETS];
+} irq_stats_t;
+
+typedef void (*irq_handler_t)(void);
+typedef void (*softirq_func_t)(void);
+
+/* Called by INTR_LINK for every device interrupt */
+void do_irq(uint32_t irq, irq_regs_t* regs);
+
+/* Installs the top half for an IRQ, it should only talk to the device and queue work */
+void request_irq(uint32_t irq, irq_handler_t handler);
+/* Registers the function run for a softirq number */
+void open_softirq(uint32_t nr, softirq_func_t func);
+/* Marks a softirq pending, it runs on interrupt exit with interrupts on */
+void raise_softirq(uint32_t nr);
+/* Asks for schedule() on the way out of the outermost interrupt */
+void set_need_resched(void);
+
+/* Registers of the interrupt being handled, NULL outside of one */
+irq_regs_t* get_irq_regs(void);
+/* Copies out the counters for one IRQ, -1 if irq is invalid */
+int32_t get_irq_stats(uint32_t irq, irq_stats_t* stats);
+
+#endif /* ASM */
+
+#endif /* _IRQ_H */
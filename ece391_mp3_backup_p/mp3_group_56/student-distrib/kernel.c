@@ -12,11 +12,18 @@
 #include "file_system_driver.h"
 #include "syscall.h"
 #include "terminal.h"
+#include "cpu.h"
+#include "fpu.h"
+#include "bench.h"
+#include "smp.h"
+#include "page_pool.h"
 
 #include "devices/i8259.h"
 
 
 #define RUN_TESTS
+/* Times the kernel paths listed in bench.h before the shells start */
+// #define RUN_BENCHMARKS
 
 /* Macros. */
 /* Check if the bit BIT in FLAGS is set. */
@@ -39,6 +46,11 @@ void entry(unsigned long magic, unsigned long addr) {
 
     multiboot_info_t *mbi;
 
+    /* Find out what the CPU supports before anything picks a code path */
+    init_cpu_features();
+    init_fpu();
+    init_lib_ops();
+
     /* Clear the screen. */
     clear();
 
@@ -161,12 +173,20 @@ void entry(unsigned long magic, unsigned long addr) {
     /* Initialize devices, memory, filesystem, enable device interrupts on the
      * PIC, any other initialization stuff... */
     init_paging();
+    page_pool_init();
     init_file_system();
     init_terminals_vidmaps();
+#ifdef SMP_ENABLED
+    smp_init();
+#endif
     clear_terminal(0);
     clear_terminal(1);
     clear_terminal(2);
     i8259_init();
+#ifdef RUN_BENCHMARKS
+    /* Before sti, the first PIT tick starts booting the shells */
+    run_benchmarks();
+#endif
     sti();
     
     /* Enable interrupts */
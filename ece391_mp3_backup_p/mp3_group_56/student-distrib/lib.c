@@ -2,10 +2,23 @@
  * vim:ts=4 noexpandtab */
 
 #include "lib.h"
+#include "cpu.h"
+#include "fpu.h"
+#include "spinlock.h"
 
 #define VIDEO       0xB8000
 #define NUM_COLS    80
 #define NUM_ROWS    25
+#define ROW_BYTES   (NUM_COLS * 2)
+#define TAB_WIDTH   4
+
+/* VGA CRT controller, start address and cursor location are in characters */
+#define VGA_CRTC_INDEX      0x3D4
+#define VGA_CRTC_DATA       0x3D5
+#define VGA_START_HIGH      0x0C
+#define VGA_START_LOW       0x0D
+#define VGA_CURSOR_HIGH     0x0E
+#define VGA_CURSOR_LOW      0x0F
 //#define ATTRIB      0xCF
 
 static int ATTRIB = 0xCF;
@@ -17,51 +30,271 @@ int curr_terminal_vmem = 0;
 static int terminal_screen_x[3];
 static int terminal_screen_y[3];
 
+/* Per-terminal history kept as a ring of rows. The live screen is the
+ * NUM_ROWS rows starting at sb_top, scrolling just moves sb_top forward
+ * and the visible window gets copied to the terminal's video page. */
+#define SCROLLBACK_MASK (SCROLLBACK_LINES - 1)
+static uint16_t scrollback[3][SCROLLBACK_LINES][NUM_COLS] __attribute__((aligned(16)));
+static int sb_top[3];       // ring index of live row 0
+static int sb_history[3];   // rows of history above the live screen
+static int sb_view[3];      // how many rows the view is scrolled back, 0 is live
+
+/* Every terminal page lives inside the 32KB text window, so the screen just
+ * points the CRTC at whichever one is active. -1 shows the kernel console. */
+static int display_term = -1;
+static uint16_t display_start = 0;
+
+/* The screen state above and the CRTC are shared by every CPU. The public
+ * screen functions take screen_lock, the static do_* ones expect it held. */
+static spinlock_t screen_lock = SPINLOCK_INIT("screen");
+static void do_clear_terminal(int term);
+static void do_putc_terminal(uint8_t c, int term);
+
+static void copy_rows_movs(void* dest, const void* src, uint32_t n);
+static void copy_rows_sse2(void* dest, const void* src, uint32_t n);
+
+/* copies whole screen rows, dest must not overlap src from above, picked in init_lib_ops */
+static void (*copy_rows)(void* dest, const void* src, uint32_t n) = copy_rows_movs;
+
+static void* memcpy_movs(void* dest, const void* src, uint32_t n);
+static void* memcpy_erms(void* dest, const void* src, uint32_t n);
+static void* memcpy_sse2(void* dest, const void* src, uint32_t n);
+static void* memcpy_nt(void* dest, const void* src, uint32_t n);
+static void* memset_stos(void* s, int32_t c, uint32_t n);
+static void* memset_erms(void* s, int32_t c, uint32_t n);
+
+/* copy and fill for anything below LIB_NT_THRESHOLD, picked in init_lib_ops */
+static void* (*memcpy_fast)(void* dest, const void* src, uint32_t n) = memcpy_movs;
+static void* (*memset_fast)(void* s, int32_t c, uint32_t n) = memset_stos;
+static const int8_t* memcpy_name = (int8_t*) "movsl";
+static const int8_t* memset_name = (int8_t*) "stosl";
+/* movnti needs SSE2 */
+static int32_t lib_use_nt = 0;
+
+/* attribute byte used by each terminal */
+static inline int terminal_attrib(int term) {
+    return 0xCF & (0xAF << term);
+}
+
+/* row y of the live screen (negative is history) in the terminal's ring */
+static inline uint16_t* sb_row(int term, int y) {
+    return scrollback[term][(sb_top[term] + y) & SCROLLBACK_MASK];
+}
+
+/* composite_terminal
+ * Inputs: term
+ * Return Value: none
+ * Function: copies the rows currently in view from the ring to the terminal's
+ *           video page, at most two copies since the window can wrap */
+static void composite_terminal(int term) {
+    char* temp_vmem = (char *)(VIDEO + FOUR_KB * (term+1));
+    int first = (sb_top[term] - sb_view[term]) & SCROLLBACK_MASK;
+    int rows = SCROLLBACK_LINES - first;
+
+    if (rows > NUM_ROWS) rows = NUM_ROWS;
+    copy_rows(temp_vmem, scrollback[term][first], rows * ROW_BYTES);
+    if (rows < NUM_ROWS)
+        copy_rows(temp_vmem + rows * ROW_BYTES, scrollback[term][0], (NUM_ROWS - rows) * ROW_BYTES);
+}
+
+/* scrollback_advance
+ * Inputs: term
+ * Return Value: none
+ * Function: scrolls the ring by one row, the old top row becomes history and
+ *           the new bottom row is blanked. Video memory is not touched. */
+static void scrollback_advance(int term) {
+    sb_top[term] = (sb_top[term] + 1) & SCROLLBACK_MASK;
+    memset_word(sb_row(term, NUM_ROWS - 1), (terminal_attrib(term) << 8) | ' ', NUM_COLS);
+    if (sb_history[term] < SCROLLBACK_LINES - NUM_ROWS)
+        sb_history[term]++;
+}
+
+/* update_terminal_cursor
+ * Inputs: term
+ * Return Value: none
+ * Function: moves the hardware cursor if term is on screen. When the view is
+ *           scrolled back the cursor lands past the last row and is hidden. */
+static void update_terminal_cursor(int term) {
+    int row = terminal_screen_y[term] + sb_view[term];
+
+    // keep a hidden cursor just below the screen instead of in the next page
+    if (row > NUM_ROWS) row = NUM_ROWS;
+    if (get_terminal_idx() == term)
+        update_cursor_terminal(terminal_screen_x[term], row);
+}
+
+/* snap_to_live
+ * Inputs: term
+ * Return Value: none
+ * Function: new output always shows the live screen */
+static inline void snap_to_live(int term) {
+    if (sb_view[term] != 0) {
+        sb_view[term] = 0;
+        composite_terminal(term);
+    }
+}
+
+/* void init_lib_ops(void);
+ * Inputs: void
+ * Return Value: none
+ * Function: selects the row copier and the memcpy/memset kernels from the
+ *           CPUID features. ERMS makes rep movsb/stosb the best choice at
+ *           every size, otherwise big copies take SSE2 and the rest stay on
+ *           the dword string instructions. */
+void init_lib_ops(void) {
+    if (cpu_has_feature(CPU_FEATURE_SSE2))
+        copy_rows = copy_rows_sse2;
+    else
+        copy_rows = copy_rows_movs;
+
+    lib_use_nt = cpu_has_feature(CPU_FEATURE_SSE2);
+    if (cpu_has_feature(CPU_FEATURE_ERMS)) {
+        memcpy_fast = memcpy_erms;
+        memcpy_name = (int8_t*) "erms";
+        memset_fast = memset_erms;
+        memset_name = (int8_t*) "erms";
+    } else if (cpu_has_feature(CPU_FEATURE_SSE2)) {
+        memcpy_fast = memcpy_sse2;
+        memcpy_name = (int8_t*) "sse2";
+    }
+}
+
+/* void get_lib_ops(const int8_t** copy, const int8_t** fill);
+ * Inputs: copy, fill = where to put the names
+ * Return Value: none
+ * Function: names the memcpy and memset kernels init_lib_ops picked */
+void get_lib_ops(const int8_t** copy, const int8_t** fill) {
+    *copy = memcpy_name;
+    *fill = memset_name;
+}
+
+/* copy_rows_movs
+ * Inputs: dest, src, n = bytes to copy (whole rows)
+ * Return Value: none
+ * Function: row copy for cpus without SSE2 */
+static void copy_rows_movs(void* dest, const void* src, uint32_t n) {
+    memmove(dest, src, n);
+}
+
+/* copy_rows_sse2
+ * Inputs: dest, src, n = bytes to copy, a multiple of 32 (rows are 160 bytes)
+ * Return Value: none
+ * Function: copies 32 bytes per iteration through xmm0/xmm1. dest must be below
+ *           src when the areas overlap. kernel_fpu_begin saves whatever
+ *           process owns the SSE registers first. */
+static void copy_rows_sse2(void* dest, const void* src, uint32_t n) {
+    uint32_t flags;
+
+    if (n == 0) return;
+    flags = kernel_fpu_begin();
+    asm volatile ("                         \n\
+            1:                              \n\
+            movdqu  (%%esi), %%xmm0         \n\
+            movdqu  16(%%esi), %%xmm1       \n\
+            movdqu  %%xmm0, (%%edi)         \n\
+            movdqu  %%xmm1, 16(%%edi)       \n\
+            addl    $32, %%esi              \n\
+            addl    $32, %%edi              \n\
+            subl    $32, %%ecx              \n\
+            jnz     1b                      \n\
+            "
+            : "+S"(src), "+D"(dest), "+c"(n)
+            :
+            : "memory", "cc"
+    );
+    kernel_fpu_end(flags);
+}
+
 
 /* void clear(void);
  * Inputs: void
  * Return Value: none
- * Function: Clears video memory */
+ * Function: Clears video memory, or the terminal on screen once there is one */
 void clear(void) {
     int32_t i;
-    for (i = 0; i < NUM_ROWS * NUM_COLS; i++) {
-        *(uint8_t *)(video_mem + (i << 1)) = ' ';
-        *(uint8_t *)(video_mem + (i << 1) + 1) = ATTRIB;
-    }
+    uint32_t flags;
+
+    spin_lock_irqsave(&screen_lock, flags);
+    if (display_term >= 0) {
+        do_clear_terminal(display_term);
+    } else {
+        for (i = 0; i < NUM_ROWS * NUM_COLS; i++) {
+            *(uint8_t *)(video_mem + (i << 1)) = ' ';
+            *(uint8_t *)(video_mem + (i << 1) + 1) = ATTRIB;
+        }
 
-    screen_x = 0;
-    screen_y = 0;
-    update_cursor();
+        screen_x = 0;
+        screen_y = 0;
+        update_cursor();
+    }
+    spin_unlock_irqrestore(&screen_lock, flags);
 }
 
 /* void clear_terminal
  * Inputs: term
  * Return Value: none
- * Function: clears vidmem to given terminal */
+ * Function: clears the live rows of the given terminal, history is kept */
 void clear_terminal(int term) {
+    uint32_t flags;
+
+    spin_lock_irqsave(&screen_lock, flags);
+    do_clear_terminal(term);
+    spin_unlock_irqrestore(&screen_lock, flags);
+}
+
+static void do_clear_terminal(int term) {
     int32_t i;
-    int temp_att = 0xCF & (0xAF<<term);
-    char* temp_vmem = (char *)(VIDEO + FOUR_KB * (term+1));
-    
-    for (i = 0; i < NUM_ROWS * NUM_COLS; i++) {
-        *(uint8_t *)(temp_vmem + (i << 1)) = ' ';
-        *(uint8_t *)(temp_vmem + (i << 1) + 1) = temp_att;
+    int temp_att = terminal_attrib(term);
+
+    for (i = 0; i < NUM_ROWS; i++) {
+        memset_word(sb_row(term, i), (temp_att << 8) | ' ', NUM_COLS);
     }
+    sb_view[term] = 0;
+    composite_terminal(term);
 
     terminal_screen_x[term] = 0;
     terminal_screen_y[term] = 0;
-    if(get_terminal_idx() == term) 
-        update_cursor_terminal(terminal_screen_x[term], terminal_screen_y[term]);
+    update_terminal_cursor(term);
 }
 
+/* void scroll_terminal_history
+ * Inputs: term, rows = rows to move the view back (negative moves forward)
+ * Return Value: none
+ * Function: browses the terminal's history, clamped to what has been kept */
+void scroll_terminal_history(int term, int rows) {
+    uint32_t flags;
+    int view;
 
-/* void set_vid_mem
- * Inputs: t
- * Return Value: na
- * Function: updates cursor for terminal */
-void set_vid_mem(int t)
+    spin_lock_irqsave(&screen_lock, flags);
+    view = sb_view[term] + rows;
+    if (view < 0) view = 0;
+    if (view > sb_history[term]) view = sb_history[term];
+    if (view != sb_view[term]) {
+        sb_view[term] = view;
+        composite_terminal(term);
+        update_terminal_cursor(term);
+    }
+    spin_unlock_irqrestore(&screen_lock, flags);
+}
+
+/* void show_terminal
+ * Inputs: t = terminal to put on screen
+ * Return Value: none
+ * Function: points the CRTC start address at the terminal's page and moves
+ *           the cursor there. Kernel console output follows the terminal. */
+void show_terminal(int t)
 {
-    if(t == get_terminal_idx()) update_cursor_terminal(terminal_screen_x[t], terminal_screen_y[t]);    
+    uint32_t flags;
+
+    spin_lock_irqsave(&screen_lock, flags);
+    display_term = t;
+    display_start = (FOUR_KB / 2) * (t + 1);
+    outb(VGA_START_HIGH, VGA_CRTC_INDEX);
+    outb((uint8_t) (display_start >> 8), VGA_CRTC_DATA);
+    outb(VGA_START_LOW, VGA_CRTC_INDEX);
+    outb((uint8_t) (display_start & 0xFF), VGA_CRTC_DATA);
+    update_terminal_cursor(t);
+    spin_unlock_irqrestore(&screen_lock, flags);
 }
 
 int get_screen_x(){return screen_x;};
@@ -83,16 +316,21 @@ void update_attrib() {
  * Function: deletes the previous character if any and updates screen pos */
 void backspace(int term)
 {
-    
+    uint32_t flags;
+
+    spin_lock_irqsave(&screen_lock, flags);
     if(terminal_screen_x[term] == 0)
     {
-        if(terminal_screen_y[term] == 0) return;
+        if(terminal_screen_y[term] == 0) {
+            spin_unlock_irqrestore(&screen_lock, flags);
+            return;
+        }
         terminal_screen_x[term] = NUM_COLS;
         terminal_screen_y[term]--;
     }
     terminal_screen_x[term] --;
     
-    putc_terminal(' ', term);
+    do_putc_terminal(' ', term);
     if(terminal_screen_x[term] == 0)
     {
         terminal_screen_x[term] = NUM_COLS;
@@ -100,9 +338,8 @@ void backspace(int term)
     }
     terminal_screen_x[term] --;
    
-    if(get_terminal_idx() == term) 
-        update_cursor_terminal(terminal_screen_x[term], terminal_screen_y[term]);
-
+    update_terminal_cursor(term);
+    spin_unlock_irqrestore(&screen_lock, flags);
 };
 
 /* Standard printf().
@@ -249,13 +486,11 @@ int32_t puts(int8_t* s) {
  * Return Value: none
  * Function: moves the screen up by one line */
 void move_screen_up(void) { 
-    int32_t i;
-    cli();
-    for (i = 0; i < (NUM_ROWS-1) * NUM_COLS; i++) {
-        video_mem[i<<1] = video_mem[(i+NUM_COLS)<<1];
-    }
-    for(i = 0; i<NUM_COLS; i++) video_mem[((NUM_ROWS-1) * NUM_COLS + i)<<1] = 0;
-    sti();
+    uint32_t flags;
+    cli_and_save(flags);
+    copy_rows(video_mem, video_mem + ROW_BYTES, (NUM_ROWS - 1) * ROW_BYTES);
+    memset_word(video_mem + (NUM_ROWS - 1) * ROW_BYTES, (ATTRIB << 8) | ' ', NUM_COLS);
+    restore_flags(flags);
 }
 
 /* void move_screen_up(term);
@@ -264,13 +499,19 @@ void move_screen_up(void) {
  * Function: moves the screen up by one line for multi term*/
 void move_screen_up_terminal(int term)
 {
-    int32_t i;
-    char* temp_video_mem = (char *)(VIDEO + FOUR_KB * (term+1));
-    for (i = 0; i < (NUM_ROWS-1) * NUM_COLS; i++) {
-        temp_video_mem[i<<1] = temp_video_mem[(i+NUM_COLS)<<1];
-    }
-    for(i = 0; i<NUM_COLS; i++) temp_video_mem[((NUM_ROWS-1) * NUM_COLS + i)<<1] = 0;
-    
+    move_screen_up_terminal_lines(term, 1);
+}
+
+/* void move_screen_up_terminal_lines(term, lines);
+ * Inputs: term, lines = number of lines to scroll
+ * Return Value: none
+ * Function: advances the terminal's ring by lines and redraws the window once */
+void move_screen_up_terminal_lines(int term, int lines)
+{
+    if (lines <= 0) return;
+    while (lines-- > 0)
+        scrollback_advance(term);
+    composite_terminal(term);
 }
 
 /* void putc(uint8_t c);
@@ -278,10 +519,19 @@ void move_screen_up_terminal(int term)
  * Return Value: void
  *  Function: Output a character to the console */
 void putc(uint8_t c) {
+    uint32_t flags;
+
+    spin_lock_irqsave(&screen_lock, flags);
+    if (display_term >= 0) {
+        do_putc_terminal(c, display_term);
+        spin_unlock_irqrestore(&screen_lock, flags);
+        return;
+    }
     if (c == '\n' || c == '\r') {
         screen_y++;
         screen_x = 0;
     } else if (c == '\0') {
+        spin_unlock_irqrestore(&screen_lock, flags);
         return;
     } else {
         *(uint8_t *)(video_mem + ((NUM_COLS * screen_y + screen_x) << 1)) = c;
@@ -298,6 +548,7 @@ void putc(uint8_t c) {
     }
 
     if(curr_terminal_vmem == get_terminal_idx()) update_cursor();    
+    spin_unlock_irqrestore(&screen_lock, flags);
 }
 
 /* void putc(uint8_t c, term);
@@ -306,19 +557,29 @@ void putc(uint8_t c) {
  *  Function: Output a character to the given term */
 void putc_terminal(uint8_t c, int term)
 {
-    int temp_att = 0xCF & (0xAF<<term);
-    char* temp_vmem = (char *)(VIDEO + FOUR_KB * (term+1));
+    uint32_t flags;
+
+    spin_lock_irqsave(&screen_lock, flags);
+    do_putc_terminal(c, term);
+    spin_unlock_irqrestore(&screen_lock, flags);
+}
+
+static void do_putc_terminal(uint8_t c, int term)
+{
+    uint16_t cell = (terminal_attrib(term) << 8) | c;
+    uint16_t* temp_vmem = (uint16_t *)(VIDEO + FOUR_KB * (term+1));
     
+    if (c == '\0') return;
+    snap_to_live(term);
+
     if (c == '\n' || c == '\r') {
         terminal_screen_y[term]++;
         terminal_screen_x[term] = 0;
-    } else if (c == '\0') {
-        return;
     } else {
-        if((NUM_COLS * terminal_screen_y[term] + terminal_screen_x[term]) > 4000 || (NUM_COLS * terminal_screen_y[term] + terminal_screen_x[term]) < 0)
+        if((NUM_COLS * terminal_screen_y[term] + terminal_screen_x[term]) >= NUM_ROWS * NUM_COLS || (NUM_COLS * terminal_screen_y[term] + terminal_screen_x[term]) < 0)
             return;
-        *(uint8_t *)(temp_vmem + ((NUM_COLS * terminal_screen_y[term] + terminal_screen_x[term]) << 1)) = c;
-        *(uint8_t *)(temp_vmem + ((NUM_COLS * terminal_screen_y[term] + terminal_screen_x[term]) << 1) + 1) = temp_att;
+        sb_row(term, terminal_screen_y[term])[terminal_screen_x[term]] = cell;
+        temp_vmem[NUM_COLS * terminal_screen_y[term] + terminal_screen_x[term]] = cell;
         terminal_screen_x[term]++;
         terminal_screen_y[term] = (terminal_screen_y[term] + (terminal_screen_x[term] / NUM_COLS)); // % NUM_ROWS;
         terminal_screen_x[term] %= NUM_COLS;
@@ -330,8 +591,80 @@ void putc_terminal(uint8_t c, int term)
         terminal_screen_y[term]=NUM_ROWS-1;
     }
 
-    if(get_terminal_idx() == term) 
-        update_cursor_terminal(terminal_screen_x[term], terminal_screen_y[term]);
+    update_terminal_cursor(term);
+}
+
+/* int32_t puts_terminal(s, n, term);
+ * Inputs: s = bytes to print, n = number of bytes, term to print to
+ * Return Value: number of bytes written
+ * Function: Output a buffer to the given term. Text goes into the ring and
+ *           straight to video memory until the first scroll, after that only
+ *           the ring is written and the window is redrawn once at the end.
+ *           Tabs print as TAB_WIDTH spaces like terminal_write always did,
+ *           a form feed clears the screen. */
+int32_t puts_terminal(const int8_t* s, int32_t n, int term)
+{
+    int32_t i, j, width;
+    int x, y;
+    int scrolled = 0;
+    uint16_t cell;
+    uint16_t* temp_vmem = (uint16_t *)(VIDEO + FOUR_KB * (term+1));
+    uint32_t flags;
+
+    spin_lock_irqsave(&screen_lock, flags);
+    x = terminal_screen_x[term];
+    y = terminal_screen_y[term];
+    snap_to_live(term);
+    for (i = 0; i < n; i++) {
+        if (s[i] == '\0') continue;
+
+        // form feed clears the live rows like ctrl-L, history is kept
+        if (s[i] == '\f') {
+            for (j = 0; j < NUM_ROWS; j++)
+                memset_word(sb_row(term, j), (terminal_attrib(term) << 8) | ' ', NUM_COLS);
+            x = 0;
+            y = 0;
+            scrolled = 1;
+            continue;
+        }
+
+        if (s[i] == '\n' || s[i] == '\r') {
+            y++;
+            x = 0;
+        } else {
+            width = (s[i] == '\t') ? TAB_WIDTH : 1;
+            cell = (terminal_attrib(term) << 8) | (uint8_t) ((width == 1) ? s[i] : ' ');
+            for (j = 0; j < width; j++) {
+                sb_row(term, y)[x] = cell;
+                if (!scrolled)
+                    temp_vmem[NUM_COLS * y + x] = cell;
+                x++;
+                y += x / NUM_COLS;
+                x %= NUM_COLS;
+                if (y == NUM_ROWS) {
+                    scrollback_advance(term);
+                    scrolled = 1;
+                    y = NUM_ROWS - 1;
+                }
+            }
+            continue;
+        }
+
+        if (y == NUM_ROWS) {
+            scrollback_advance(term);
+            scrolled = 1;
+            y = NUM_ROWS - 1;
+        }
+    }
+
+    if (scrolled)
+        composite_terminal(term);
+
+    terminal_screen_x[term] = x;
+    terminal_screen_y[term] = y;
+    update_terminal_cursor(term);
+    spin_unlock_irqrestore(&screen_lock, flags);
+    return n;
 }
 
 /* useless */
@@ -387,15 +720,15 @@ void update_cursor() {
 /* update_cursor
  * Inputs: x,y
  * Return Value: None
- * Function: updates the pos of the cursor to screen x and y */
+ * Function: updates the pos of the cursor to screen x and y of the page on screen */
 void update_cursor_terminal(int x, int y)
 {
-    uint16_t pos = y * NUM_COLS + x;
+    uint16_t pos = display_start + y * NUM_COLS + x;
  
-	outb(0x0F, 0x3D4);
-	outb((uint8_t) (pos & 0xFF), 0x3D5);
-	outb(0x0E, 0x3D4);
-	outb((uint8_t) ((pos >> 8) & 0xFF), 0x3D5);
+	outb(VGA_CURSOR_LOW, VGA_CRTC_INDEX);
+	outb((uint8_t) (pos & 0xFF), VGA_CRTC_DATA);
+	outb(VGA_CURSOR_HIGH, VGA_CRTC_INDEX);
+	outb((uint8_t) ((pos >> 8) & 0xFF), VGA_CRTC_DATA);
 }
 
 /* int8_t* itoa(uint32_t value, int8_t* buf, int32_t radix);
@@ -471,20 +804,33 @@ uint32_t strlen(const int8_t* s) {
  *          int32_t c = value to set memory to
  *         uint32_t n = number of bytes to set
  * Return Value: new string
- * Function: set n consecutive bytes of pointer s to value c */
+ * Function: set n consecutive bytes of pointer s to value c. Fills bigger
+ *           than the cache bypass it, the rest go to the fill picked in
+ *           init_lib_ops */
 void* memset(void* s, int32_t c, uint32_t n) {
+    if (n >= LIB_NT_THRESHOLD && lib_use_nt)
+        return memset_nt(s, c, n);
+    return memset_fast(s, c, n);
+}
+
+/* void* memset_stos(void* s, int32_t c, uint32_t n);
+ * Inputs: s, c, n as for memset
+ * Return Value: s
+ * Function: byte stores up to a 4 byte boundary, then rep stosl */
+static void* memset_stos(void* s, int32_t c, uint32_t n) {
+    void* ret = s;
     c &= 0xFF;
     asm volatile ("                 \n\
-            .memset_top:            \n\
+            1:                      \n\
             testl   %%ecx, %%ecx    \n\
-            jz      .memset_done    \n\
+            jz      4f              \n\
             testl   $0x3, %%edi     \n\
-            jz      .memset_aligned \n\
+            jz      2f              \n\
             movb    %%al, (%%edi)   \n\
             addl    $1, %%edi       \n\
             subl    $1, %%ecx       \n\
-            jmp     .memset_top     \n\
-            .memset_aligned:        \n\
+            jmp     1b              \n\
+            2:                      \n\
             movw    %%ds, %%dx      \n\
             movw    %%dx, %%es      \n\
             movl    %%ecx, %%edx    \n\
@@ -492,19 +838,79 @@ void* memset(void* s, int32_t c, uint32_t n) {
             andl    $0x3, %%edx     \n\
             cld                     \n\
             rep     stosl           \n\
-            .memset_bottom:         \n\
+            3:                      \n\
             testl   %%edx, %%edx    \n\
-            jz      .memset_done    \n\
+            jz      4f              \n\
             movb    %%al, (%%edi)   \n\
             addl    $1, %%edi       \n\
             subl    $1, %%edx       \n\
-            jmp     .memset_bottom  \n\
-            .memset_done:           \n\
+            jmp     3b              \n\
+            4:                      \n\
             "
-            :
-            : "a"(c << 24 | c << 16 | c << 8 | c), "D"(s), "c"(n)
+            : "+D"(s), "+c"(n)
+            : "a"(c << 24 | c << 16 | c << 8 | c)
             : "edx", "memory", "cc"
     );
+    return ret;
+}
+
+/* void* memset_erms(void* s, int32_t c, uint32_t n);
+ * Inputs: s, c, n as for memset
+ * Return Value: s
+ * Function: rep stosb, which ERMS cpus run as fast as the wide forms
+ *           without any alignment work */
+static void* memset_erms(void* s, int32_t c, uint32_t n) {
+    void* ret = s;
+    asm volatile ("                 \n\
+            movw    %%ds, %%dx      \n\
+            movw    %%dx, %%es      \n\
+            cld                     \n\
+            rep     stosb           \n\
+            "
+            : "+D"(s), "+c"(n)
+            : "a"(c)
+            : "edx", "memory", "cc"
+    );
+    return ret;
+}
+
+/* void* memset_nt(void* s, int32_t c, uint32_t n);
+ * Inputs: s, c, n as for memset
+ * Return Value: s
+ * Function: fills with movnti, which goes around the cache so a big fill
+ *           does not evict everything else. movnti and sfence only use
+ *           general registers, CR0.TS does not affect them. Falls back to
+ *           memset_stos without SSE2. */
+void* memset_nt(void* s, int32_t c, uint32_t n) {
+    uint8_t* d = (uint8_t*) s;
+    uint32_t head, body;
+
+    if (!lib_use_nt) return memset_stos(s, c, n);
+    c &= 0xFF;
+    head = (4 - ((uint32_t) d & 0x3)) & 0x3;
+    if (head > n) head = n;
+    memset_stos(d, c, head);
+    d += head;
+    n -= head;
+    body = n & ~0xF;
+    if (body != 0) {
+        asm volatile ("                         \n\
+                1:                              \n\
+                movnti  %%eax, (%%edi)          \n\
+                movnti  %%eax, 4(%%edi)         \n\
+                movnti  %%eax, 8(%%edi)         \n\
+                movnti  %%eax, 12(%%edi)        \n\
+                addl    $16, %%edi              \n\
+                subl    $16, %%ecx              \n\
+                jnz     1b                      \n\
+                sfence                          \n\
+                "
+                : "+D"(d), "+c"(body)
+                : "a"(c << 24 | c << 16 | c << 8 | c)
+                : "memory", "cc"
+        );
+    }
+    memset_stos(d, c, n & 0xF);
     return s;
 }
 
@@ -554,21 +960,33 @@ void* memset_dword(void* s, int32_t c, uint32_t n) {
  *         const void* src = source of copy
  *              uint32_t n = number of byets to copy
  * Return Value: pointer to dest
- * Function: copy n bytes of src to dest */
+ * Function: copy n bytes of src to dest. Copies bigger than the cache
+ *           bypass it, the rest go to the copier picked in init_lib_ops */
 void* memcpy(void* dest, const void* src, uint32_t n) {
+    if (n >= LIB_NT_THRESHOLD && lib_use_nt)
+        return memcpy_nt(dest, src, n);
+    return memcpy_fast(dest, src, n);
+}
+
+/* void* memcpy_movs(void* dest, const void* src, uint32_t n);
+ * Inputs: dest, src, n as for memcpy
+ * Return Value: dest
+ * Function: byte copies up to a 4 byte boundary of dest, then rep movsl */
+static void* memcpy_movs(void* dest, const void* src, uint32_t n) {
+    void* ret = dest;
     asm volatile ("                 \n\
-            .memcpy_top:            \n\
+            1:                      \n\
             testl   %%ecx, %%ecx    \n\
-            jz      .memcpy_done    \n\
+            jz      4f              \n\
             testl   $0x3, %%edi     \n\
-            jz      .memcpy_aligned \n\
+            jz      2f              \n\
             movb    (%%esi), %%al   \n\
             movb    %%al, (%%edi)   \n\
             addl    $1, %%edi       \n\
             addl    $1, %%esi       \n\
             subl    $1, %%ecx       \n\
-            jmp     .memcpy_top     \n\
-            .memcpy_aligned:        \n\
+            jmp     1b              \n\
+            2:                      \n\
             movw    %%ds, %%dx      \n\
             movw    %%dx, %%es      \n\
             movl    %%ecx, %%edx    \n\
@@ -576,21 +994,122 @@ void* memcpy(void* dest, const void* src, uint32_t n) {
             andl    $0x3, %%edx     \n\
             cld                     \n\
             rep     movsl           \n\
-            .memcpy_bottom:         \n\
+            3:                      \n\
             testl   %%edx, %%edx    \n\
-            jz      .memcpy_done    \n\
+            jz      4f              \n\
             movb    (%%esi), %%al   \n\
             movb    %%al, (%%edi)   \n\
             addl    $1, %%edi       \n\
             addl    $1, %%esi       \n\
             subl    $1, %%edx       \n\
-            jmp     .memcpy_bottom  \n\
-            .memcpy_done:           \n\
+            jmp     3b              \n\
+            4:                      \n\
             "
+            : "+S"(src), "+D"(dest), "+c"(n)
             :
-            : "S"(src), "D"(dest), "c"(n)
             : "eax", "edx", "memory", "cc"
     );
+    return ret;
+}
+
+/* void* memcpy_erms(void* dest, const void* src, uint32_t n);
+ * Inputs: dest, src, n as for memcpy
+ * Return Value: dest
+ * Function: rep movsb, which ERMS cpus run in wide chunks on their own */
+static void* memcpy_erms(void* dest, const void* src, uint32_t n) {
+    void* ret = dest;
+    asm volatile ("                 \n\
+            movw    %%ds, %%dx      \n\
+            movw    %%dx, %%es      \n\
+            cld                     \n\
+            rep     movsb           \n\
+            "
+            : "+S"(src), "+D"(dest), "+c"(n)
+            :
+            : "edx", "memory", "cc"
+    );
+    return ret;
+}
+
+/* void* memcpy_sse2(void* dest, const void* src, uint32_t n);
+ * Inputs: dest, src, n as for memcpy
+ * Return Value: dest
+ * Function: 32 bytes per iteration through xmm0/xmm1 with aligned stores.
+ *           kernel_fpu_begin costs about as much as copying a few hundred
+ *           bytes, so short copies stay on rep movsl. */
+static void* memcpy_sse2(void* dest, const void* src, uint32_t n) {
+    uint8_t* d = (uint8_t*) dest;
+    const uint8_t* s = (const uint8_t*) src;
+    uint32_t head, body, flags;
+
+    if (n < LIB_SSE2_THRESHOLD) return memcpy_movs(dest, src, n);
+    head = (16 - ((uint32_t) d & 0xF)) & 0xF;
+    memcpy_movs(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+    body = n & ~0x1F;
+    flags = kernel_fpu_begin();
+    asm volatile ("                         \n\
+            1:                              \n\
+            movdqu  (%%esi), %%xmm0         \n\
+            movdqu  16(%%esi), %%xmm1       \n\
+            movdqa  %%xmm0, (%%edi)         \n\
+            movdqa  %%xmm1, 16(%%edi)       \n\
+            addl    $32, %%esi              \n\
+            addl    $32, %%edi              \n\
+            subl    $32, %%ecx              \n\
+            jnz     1b                      \n\
+            "
+            : "+S"(s), "+D"(d), "+c"(body)
+            :
+            : "memory", "cc"
+    );
+    kernel_fpu_end(flags);
+    memcpy_movs(d, s, n & 0x1F);
+    return dest;
+}
+
+/* void* memcpy_nt(void* dest, const void* src, uint32_t n);
+ * Inputs: dest, src, n as for memcpy
+ * Return Value: dest
+ * Function: copies with movnti stores that skip the cache, for copies that
+ *           would flush it anyway. Only general registers are used. */
+static void* memcpy_nt(void* dest, const void* src, uint32_t n) {
+    uint8_t* d = (uint8_t*) dest;
+    const uint8_t* s = (const uint8_t*) src;
+    uint32_t head, body;
+
+    head = (4 - ((uint32_t) d & 0x3)) & 0x3;
+    if (head > n) head = n;
+    memcpy_movs(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+    body = n & ~0xF;
+    if (body != 0) {
+        asm volatile ("                         \n\
+                1:                              \n\
+                movl    (%%esi), %%eax          \n\
+                movl    4(%%esi), %%edx         \n\
+                movnti  %%eax, (%%edi)          \n\
+                movnti  %%edx, 4(%%edi)         \n\
+                movl    8(%%esi), %%eax         \n\
+                movl    12(%%esi), %%edx        \n\
+                movnti  %%eax, 8(%%edi)         \n\
+                movnti  %%edx, 12(%%edi)        \n\
+                addl    $16, %%esi              \n\
+                addl    $16, %%edi              \n\
+                subl    $16, %%ecx              \n\
+                jnz     1b                      \n\
+                sfence                          \n\
+                "
+                : "+S"(s), "+D"(d), "+c"(body)
+                :
+                : "eax", "edx", "memory", "cc"
+        );
+    }
+    memcpy_movs(d, s, n & 0xF);
     return dest;
 }
 
@@ -600,25 +1119,34 @@ void* memcpy(void* dest, const void* src, uint32_t n) {
  *         const void* src = source of move
  *              uint32_t n = number of byets to move
  * Return Value: pointer to dest
- * Function: move n bytes of src to dest */
+ * Function: move n bytes of src to dest. Forward moves are safe with any
+ *           of the cached copiers, which read each chunk before writing it.
+ *           Backward moves copy the odd tail bytes, then dwords. */
 void* memmove(void* dest, const void* src, uint32_t n) {
+    void* ret = dest;
+    if ((uint32_t) dest <= (uint32_t) src || (uint32_t) dest >= (uint32_t) src + n)
+        return memcpy_fast(dest, src, n);
     asm volatile ("                             \n\
             movw    %%ds, %%dx                  \n\
             movw    %%dx, %%es                  \n\
-            cld                                 \n\
-            cmp     %%edi, %%esi                \n\
-            jae     .memmove_go                 \n\
-            leal    -1(%%esi, %%ecx), %%esi     \n\
-            leal    -1(%%edi, %%ecx), %%edi     \n\
+            movl    %%ecx, %%edx                \n\
+            andl    $0x3, %%ecx                 \n\
+            leal    -1(%%esi, %%edx), %%esi     \n\
+            leal    -1(%%edi, %%edx), %%edi     \n\
             std                                 \n\
-            .memmove_go:                        \n\
             rep     movsb                       \n\
+            subl    $3, %%esi                   \n\
+            subl    $3, %%edi                   \n\
+            movl    %%edx, %%ecx                \n\
+            shrl    $2, %%ecx                   \n\
+            rep     movsl                       \n\
+            cld                                 \n\
             "
+            : "+D"(dest), "+S"(src), "+c"(n)
             :
-            : "D"(dest), "S"(src), "c"(n)
             : "edx", "memory", "cc"
     );
-    return dest;
+    return ret;
 }
 
 /* int32_t strncmp(const int8_t* s1, const int8_t* s2, uint32_t n)
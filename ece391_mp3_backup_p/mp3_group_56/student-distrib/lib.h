@@ -12,6 +12,16 @@
 #define TERMINAL_VID_MEM 4096
 #define FOUR_KB          4096
 
+/* memcpy/memset at least this big skip the cache when the cpu has SSE2 */
+#define LIB_NT_THRESHOLD    (256 * 1024)
+/* SSE2 copies below this are not worth saving the FPU state for */
+#define LIB_SSE2_THRESHOLD  2048
+
+/* rows of history per terminal (live screen included), must be a power of 2 */
+#define SCROLLBACK_LINES 2048
+/* rows moved by one Shift+PgUp/PgDn */
+#define SCROLLBACK_STEP  12
+
 int32_t printf(int8_t *format, ...);
 void putc(uint8_t c);
 
@@ -29,6 +39,8 @@ void* memset_word(void* s, int32_t c, uint32_t n);
 void* memset_dword(void* s, int32_t c, uint32_t n);
 void* memcpy(void* dest, const void* src, uint32_t n);
 void* memmove(void* dest, const void* src, uint32_t n);
+void* memset_nt(void* s, int32_t c, uint32_t n);
+void get_lib_ops(const int8_t** copy, const int8_t** fill);
 int32_t strncmp(const int8_t* s1, const int8_t* s2, uint32_t n);
 int8_t* strcpy(int8_t* dest, const int8_t*src);
 int8_t* strncpy(int8_t* dest, const int8_t*src, uint32_t n);
@@ -46,10 +58,15 @@ void update_cursor(void);
 /* moves the contents of the screen up one line */
 void move_screen_up(void);
 void move_screen_up_terminal(int term);
+/* moves the contents of a terminal up several lines, redrawing once */
+void move_screen_up_terminal_lines(int term, int lines);
+/* picks the fastest helpers for this CPU, call after init_cpu_features */
+void init_lib_ops(void);
 
 
 
-void set_vid_mem(int t);
+/* puts a terminal's page on screen by moving the VGA start address */
+void show_terminal(int t);
 
 /* MULTI TERMINAL LIB FUNCTIONS */
 /* update cursor pos */
@@ -65,6 +82,10 @@ void set_screen_y(int y);
 void putc_terminal(uint8_t c, int term);
 /* clear for scheduling */
 void clear_terminal(int term);
+/* writes n bytes to a terminal, redrawing the screen at most once */
+int32_t puts_terminal(const int8_t* s, int32_t n, int term);
+/* moves a terminal's view through its scrollback history */
+void scroll_terminal_history(int term, int rows);
 
 /* Port read functions */
 /* Inb reads a byte and returns its value as a zero-extended 32-bit
@@ -110,6 +131,34 @@ static inline uint32_t inl(port) {
     return val;
 }
 
+/* Reads the 64-bit time-stamp counter */
+static inline uint64_t rdtsc(void) {
+    uint64_t val;
+    asm volatile ("rdtsc"
+            : "=A"(val)
+            :
+            : "memory"
+    );
+    return val;
+}
+
+/* Divides *n by base in place and returns the remainder. There is no libgcc
+ * for 64-bit division, but divl takes a 64-bit dividend as long as the
+ * quotient fits, so the high word is divided first. */
+static inline uint32_t div64_32(uint64_t* n, uint32_t base) {
+    uint32_t hi = (uint32_t) (*n >> 32);
+    uint32_t lo = (uint32_t) *n;
+    uint32_t rem = hi % base;
+
+    hi /= base;
+    asm ("divl %2"
+            : "+a"(lo), "+d"(rem)
+            : "rm"(base)
+    );
+    *n = ((uint64_t) hi << 32) | lo;
+    return rem;
+}
+
 /* Writes a byte to a port */
 #define outb(data, port)                \
 do {                                    \
@@ -0,0 +1,214 @@
+#include "page_pool.h"
+#include "paging.h"
+#include "lib.h"
+#include "syscall.h"
+#include "syscall_helpers.h"
+#include "spinlock.h"
+#include "smp.h"
+
+/*
+ * Every PCB slot owns the 4MB frame at 8MB + pid * 4MB. A frame that was
+ * used is dirty until it is zeroed again, either bit by bit by
+ * page_pool_idle while some process spins waiting for the keyboard or the
+ * RTC, or all at once by execute when the idle zeroer did not get to it.
+ * pool_lock covers the frame state, the scratch window is in the BSP's page
+ * directory so only the BSP zeroes while idle.
+ */
+static uint8_t frame_state[MAX_NUM_PROGRAMS];
+static uint32_t frame_progress[MAX_NUM_PROGRAMS];  // bytes zeroed so far
+static int32_t scratch_frame = -1;                  // frame behind the scratch window
+static page_pool_stats_t pool_stats;
+static spinlock_t pool_lock = SPINLOCK_INIT("page pool");
+
+/*
+ * frame_addr
+ *   DESCRIPTION: Physical address of a slot's frame
+ *   INPUTS: frame - PCB slot
+ *   OUTPUTS: none
+ *   RETURN VALUE: the address
+ *   SIDE EFFECTS: none
+ */
+static uint32_t frame_addr(uint32_t frame) {
+    return EIGHT_MB + frame * FOUR_MB;
+}
+
+/*
+ * page_pool_init
+ *   DESCRIPTION: Marks every frame dirty, nothing is known about memory
+ *                at boot, and prepares the scratch page directory entry
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sets the scratch page directory entry, not present
+ */
+void page_pool_init(void) {
+    page_dir_desc_t* pde = &page_dir[PAGE_POOL_SCRATCH_ADDR / FOUR_MB];
+    uint32_t i;
+
+    for (i = 0; i < MAX_NUM_PROGRAMS; i++) {
+        frame_state[i] = FRAME_DIRTY;
+        frame_progress[i] = 0;
+    }
+    pde->p = 0;
+    pde->rw = 1;
+    pde->us = 0;
+    pde->ps = 1;
+    pde->g = 0;
+    scratch_frame = -1;
+}
+
+/*
+ * page_pool_idle
+ *   DESCRIPTION: Zeroes the next PAGE_POOL_CHUNK bytes of a free dirty
+ *                frame through the scratch window. Meant for loops that
+ *                would otherwise spin, it returns quickly when every frame
+ *                is clean or in use.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may remap the scratch window, interrupts are off for
+ *                 one chunk, does nothing on an AP
+ */
+void page_pool_idle(void) {
+    page_dir_desc_t* pde = &page_dir[PAGE_POOL_SCRATCH_ADDR / FOUR_MB];
+    uint32_t flags, i;
+    uint64_t start;
+
+    if (smp_cpu_index() != 0) return;
+    spin_lock_irqsave(&pool_lock, flags);
+    for (i = 0; i < MAX_NUM_PROGRAMS; i++) {
+        if (frame_state[i] == FRAME_DIRTY && pcb_flags[i] == 0) break;
+    }
+    if (i == MAX_NUM_PROGRAMS) {
+        spin_unlock_irqrestore(&pool_lock, flags);
+        return;
+    }
+
+    start = rdtsc();
+    if (scratch_frame != i) {
+        pde->base_31_12 = frame_addr(i) / FOUR_KB;
+        pde->p = 1;
+        tlb_invalidate(PAGE_POOL_SCRATCH_ADDR);
+        scratch_frame = i;
+    }
+    memset_nt((void*) (PAGE_POOL_SCRATCH_ADDR + frame_progress[i]), 0, PAGE_POOL_CHUNK);
+    frame_progress[i] += PAGE_POOL_CHUNK;
+    if (frame_progress[i] == FOUR_MB) {
+        frame_state[i] = FRAME_CLEAN;
+        pool_stats.frames_zeroed++;
+    }
+    pool_stats.idle_chunks++;
+    pool_stats.idle_cycles += rdtsc() - start;
+    spin_unlock_irqrestore(&pool_lock, flags);
+}
+
+/*
+ * page_pool_pick
+ *   DESCRIPTION: Finds a free PCB slot. The frame comes with the slot, so
+ *                a slot whose frame is already clean is taken first.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the slot, MAX_NUM_PROGRAMS if all are taken
+ *   SIDE EFFECTS: none
+ */
+uint32_t page_pool_pick(void) {
+    uint32_t i, first_free = MAX_NUM_PROGRAMS;
+
+    for (i = 0; i < MAX_NUM_PROGRAMS; i++) {
+        if (pcb_flags[i] != 0) continue;
+        if (frame_state[i] == FRAME_CLEAN) return i;
+        if (first_free == MAX_NUM_PROGRAMS) first_free = i;
+    }
+    return first_free;
+}
+
+/*
+ * page_pool_take
+ *   DESCRIPTION: Claims a frame for a new process. The user page must already
+ *                point at it. A clean frame costs nothing, otherwise whatever
+ *                the idle zeroer has not reached is zeroed here, except the
+ *                range the program image is about to be copied over.
+ *   INPUTS: frame - PCB slot
+ *           keep_start, keep_end - offsets in the frame the caller fills itself
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes the user page, counts a hit or a miss
+ */
+void page_pool_take(uint32_t frame, uint32_t keep_start, uint32_t keep_end) {
+    uint32_t flags, done;
+    uint64_t start;
+
+    spin_lock_irqsave(&pool_lock, flags);
+    if (frame_state[frame] == FRAME_CLEAN) {
+        frame_state[frame] = FRAME_USED;
+        pool_stats.hits++;
+        spin_unlock_irqrestore(&pool_lock, flags);
+        return;
+    }
+    // the idle zeroer leaves used frames alone, so the rest can run with interrupts on
+    frame_state[frame] = FRAME_USED;
+    done = frame_progress[frame];
+    spin_unlock_irqrestore(&pool_lock, flags);
+
+    start = rdtsc();
+    // only whole 16 byte blocks inside the kept range are skipped
+    keep_start = (keep_start + 15) & ~15;
+    keep_end &= ~15;
+    if (keep_start > FOUR_MB) keep_start = FOUR_MB;
+    if (keep_end < keep_start) keep_end = keep_start;
+    if (keep_end > FOUR_MB) keep_end = FOUR_MB;
+
+    if (done < keep_start)
+        memset_nt((void*) (USER_MEM_VIRTUAL_ADDR + done), 0, keep_start - done);
+    if (done < keep_end)
+        done = keep_end;
+    memset_nt((void*) (USER_MEM_VIRTUAL_ADDR + done), 0, FOUR_MB - done);
+
+    spin_lock_irqsave(&pool_lock, flags);
+    pool_stats.misses++;
+    pool_stats.miss_cycles += rdtsc() - start;
+    spin_unlock_irqrestore(&pool_lock, flags);
+}
+
+/*
+ * page_pool_release
+ *   DESCRIPTION: Gives a frame back after its process halted
+ *   INPUTS: frame - PCB slot
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: the frame is dirty until zeroed again
+ */
+void page_pool_release(uint32_t frame) {
+    uint32_t flags;
+
+    spin_lock_irqsave(&pool_lock, flags);
+    frame_state[frame] = FRAME_DIRTY;
+    frame_progress[frame] = 0;
+    spin_unlock_irqrestore(&pool_lock, flags);
+}
+
+/*
+ * get_page_pool_stats
+ *   DESCRIPTION: Copies the pool counters. The time saved is estimated as
+ *                one full frame of idle zeroing per hit.
+ *   INPUTS: stats - where to copy them
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void get_page_pool_stats(page_pool_stats_t* stats) {
+    uint64_t per_chunk;
+    uint32_t flags;
+
+    if (stats == NULL) return;
+    spin_lock_irqsave(&pool_lock, flags);
+    *stats = pool_stats;
+    spin_unlock_irqrestore(&pool_lock, flags);
+
+    stats->saved_cycles = 0;
+    if (stats->idle_chunks != 0) {
+        per_chunk = stats->idle_cycles;
+        div64_32(&per_chunk, stats->idle_chunks);
+        stats->saved_cycles = per_chunk * (FOUR_MB / PAGE_POOL_CHUNK) * stats->hits;
+    }
+}
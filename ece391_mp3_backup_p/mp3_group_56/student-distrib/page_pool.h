@@ -0,0 +1,48 @@
+/* page_pool.h - zeroes free user frames while the kernel is idle
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _PAGE_POOL_H
+#define _PAGE_POOL_H
+
+#include "types.h"
+
+/* kernel only window the idle zeroer maps a frame through */
+#define PAGE_POOL_SCRATCH_ADDR  0x0C000000
+/* bytes zeroed per idle call, interrupts are off for one chunk */
+#define PAGE_POOL_CHUNK         0x10000
+
+/* Frame states, one per PCB slot */
+#define FRAME_DIRTY     0
+#define FRAME_CLEAN     1
+#define FRAME_USED      2
+
+#ifndef ASM
+
+/* Counters for how execute found its frames */
+typedef struct page_pool_stats_t {
+    uint32_t hits;              // frame was already zero
+    uint32_t misses;            // execute had to zero it
+    uint32_t frames_zeroed;     // frames finished by the idle zeroer
+    uint32_t idle_chunks;       // idle calls that did some work
+    uint64_t idle_cycles;       // time spent zeroing while idle
+    uint64_t miss_cycles;       // time spent zeroing inside execute
+    uint64_t saved_cycles;      // hits times the cost of one frame
+} page_pool_stats_t;
+
+/* Marks every frame dirty */
+void page_pool_init(void);
+/* Zeroes one chunk of a free dirty frame, called from wait loops */
+void page_pool_idle(void);
+/* Picks a free PCB slot, preferring one whose frame is clean */
+uint32_t page_pool_pick(void);
+/* Claims the frame mapped at the user page, zeroing it if needed */
+void page_pool_take(uint32_t frame, uint32_t keep_start, uint32_t keep_end);
+/* Hands a frame back once its process is gone */
+void page_pool_release(uint32_t frame);
+/* Copies out the counters */
+void get_page_pool_stats(page_pool_stats_t* stats);
+
+#endif /* ASM */
+
+#endif /* _PAGE_POOL_H */
@@ -1,5 +1,7 @@
 #include "paging.h"
 
+static tlb_stats_t tlb_stats;
+
 /* 
  * init_paging
  *   DESCRIPTION: Initializes the page directory with page tables
@@ -73,7 +75,8 @@ void init_paging () {
         video_memory_page_table[i].a = 0;
         video_memory_page_table[i].d = 0;
         video_memory_page_table[i].pat = 0;
-        video_memory_page_table[i].g = 0;
+        // video memory is mapped the same way in every process
+        video_memory_page_table[i].g = (i >= VIDEO / FOUR_KB && i <= 3 + VIDEO / FOUR_KB);
         video_memory_page_table[i].avail = 0;
         video_memory_page_table[i].base_31_12 = i;
     }
@@ -81,4 +84,81 @@ void init_paging () {
     load_page_dir((unsigned int *) (&page_dir));
     enable_paging();
 
+    // without PGE the g bits are ignored and every flush drops the kernel too
+    if (cpu_has_feature(CPU_FEATURE_PGE))
+        enable_global_pages();
+}
+
+/* 
+ * tlb_flush_all
+ *   DESCRIPTION: Reloads CR3. Global pages (kernel, video) stay cached.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: flushes the TLB, counts the flush
+ */
+void tlb_flush_all(void) {
+    tlb_stats.full_flushes++;
+    flush_tlb();
+}
+
+/* 
+ * tlb_invalidate
+ *   DESCRIPTION: Drops the TLB entry of the page containing vaddr
+ *   INPUTS: vaddr - virtual address whose mapping changed
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: invlpg, counts the invalidation
+ */
+void tlb_invalidate(uint32_t vaddr) {
+    tlb_stats.invalidations++;
+    invalidate_page(vaddr);
+}
+
+/* 
+ * tlb_note_skip
+ *   DESCRIPTION: Records a remap that left the entry unchanged
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: counts the skip
+ */
+void tlb_note_skip(void) {
+    tlb_stats.skipped++;
+}
+
+/* 
+ * get_tlb_stats
+ *   DESCRIPTION: Copies the TLB counters
+ *   INPUTS: stats - where to copy them
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void get_tlb_stats(tlb_stats_t* stats) {
+    if (stats == NULL) return;
+    *stats = tlb_stats;
+}
+
+/* 
+ * map_mmio_4mb
+ *   DESCRIPTION: Identity maps the 4MB region holding addr with caching off,
+ *                for memory mapped registers such as the APICs
+ *   INPUTS: addr - any address in the region
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sets a page directory entry, invalidates it
+ */
+void map_mmio_4mb(uint32_t addr) {
+    uint32_t idx = addr >> 22;
+
+    page_dir[idx].p = 1;
+    page_dir[idx].rw = 1;
+    page_dir[idx].us = 0;
+    page_dir[idx].pwt = 1;
+    page_dir[idx].pcd = 1;
+    page_dir[idx].ps = 1;
+    page_dir[idx].g = 1;
+    page_dir[idx].base_31_12 = (idx << 22) / FOUR_KB;
+    tlb_invalidate(addr);
 }
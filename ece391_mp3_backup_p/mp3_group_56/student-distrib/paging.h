@@ -3,6 +3,7 @@
 
 #include "types.h"
 #include "lib.h"
+#include "cpu.h"
 
 /* Constants that are commonly used for paging */
 #define NUM_ENTRIES  1024
@@ -39,6 +40,37 @@ extern void enable_paging();
 // Flushes the TLB
 extern void flush_tlb();
 
+// Invalidates the TLB entry for a single page
+/*
+   INPUTS: any virtual address inside the page
+   OUTPUT: NONE
+   RETURN VALUE: NONE
+   SIDE EFFECTS: invlpg on that address
+*/
+extern void invalidate_page(uint32_t vaddr);
+
+// Sets CR4.PGE, only call when the CPU has PGE
+extern void enable_global_pages();
+
+/* Counters for how often the TLB gets thrown away */
+typedef struct tlb_stats_t {
+    uint32_t full_flushes;      // CR3 reloads
+    uint32_t invalidations;     // single page invlpg
+    uint32_t skipped;           // remaps that changed nothing
+} tlb_stats_t;
+
+/* Flushes every non-global TLB entry and counts it */
+void tlb_flush_all(void);
+/* Invalidates one page and counts it */
+void tlb_invalidate(uint32_t vaddr);
+/* Counts a remap that needed no invalidation */
+void tlb_note_skip(void);
+/* Copies out the counters */
+void get_tlb_stats(tlb_stats_t* stats);
+
+/* Identity maps the 4MB around a device's registers, uncached */
+void map_mmio_4mb(uint32_t addr);
+
 
 /* Page directory descriptor */
 typedef union page_dir_desc_t {
@@ -0,0 +1,208 @@
+/* profile.c - Sampling profiler fed by the PIT or RTC interrupt
+ * vim:ts=4 noexpandtab
+ */
+
+#include "profile.h"
+#include "lib.h"
+#include "irq.h"
+#include "syscall.h"
+#include "syscall_helpers.h"
+#include "devices/rtc.h"
+
+/* Samples are keyed by program rather than pid: every process runs at the
+ * same virtual address and pids are reused, while names let the user tool
+ * find the ELF file to symbolise against. */
+static prof_entry_t prof_table[PROF_BUCKETS];
+static uint8_t prof_progs[PROF_MAX_PROGS][PROF_NAME_SIZE];
+static uint32_t prof_nprogs = 0;
+
+static volatile int prof_running = 0;
+static uint32_t prof_source = PROF_SOURCE_PIT;
+static uint32_t prof_hz = 0;
+static uint32_t prof_div = 1;       // RTC interrupts per sample
+static uint32_t prof_div_count = 0;
+static uint32_t prof_samples = 0;
+static uint32_t prof_dropped = 0;
+
+/*
+ * prof_hash
+ *   DESCRIPTION: Bucket a (program, eip) pair starts probing from
+ *   INPUTS: prog - program index
+ *           eip - sampled address
+ *   OUTPUTS: none
+ *   RETURN VALUE: bucket index
+ *   SIDE EFFECTS: none
+ */
+static inline uint32_t prof_hash(uint32_t prog, uint32_t eip) {
+    // Fibonacci hashing, neighbouring instructions land far apart
+    return ((eip ^ (prog << 24)) * 2654435761U) >> (32 - PROF_BUCKET_BITS);
+}
+
+/*
+ * profile_tick
+ *   DESCRIPTION: Records where the interrupted code was. Runs in the PIT
+ *                and RTC top halves, only the configured source samples.
+ *   INPUTS: source - PROF_SOURCE_* of the calling interrupt
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: bumps a histogram bucket
+ */
+void profile_tick(uint32_t source) {
+    irq_regs_t* regs;
+    pcb_t* pcb;
+    uint32_t prog, eip, idx, i;
+
+    if (!prof_running || source != prof_source) return;
+    if (++prof_div_count < prof_div) return;
+    prof_div_count = 0;
+
+    regs = get_irq_regs();
+    if (regs == NULL) return;
+    eip = regs->eip;
+    pcb = get_acct_pcb();
+    prog = (pcb != NULL) ? pcb->prof_prog : PROF_PROG_NONE;
+
+    prof_samples++;
+    idx = prof_hash(prog, eip);
+    for (i = 0; i < PROF_MAX_PROBE; i++, idx = (idx + 1) & PROF_BUCKET_MASK) {
+        if (prof_table[idx].count == 0) {
+            prof_table[idx].eip = eip;
+            prof_table[idx].prog = prog;
+        } else if (prof_table[idx].eip != eip || prof_table[idx].prog != prog) {
+            continue;
+        }
+        prof_table[idx].count++;
+        return;
+    }
+    prof_dropped++;
+}
+
+/*
+ * profile_prog_index
+ *   DESCRIPTION: Looks up a program name, adding it when there is room.
+ *                Called by execute so sampling never compares strings.
+ *   INPUTS: name - program name, at most PROF_NAME_SIZE bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: index into the program table, PROF_PROG_NONE when full
+ *   SIDE EFFECTS: may add a name to the table
+ */
+uint32_t profile_prog_index(const uint8_t* name) {
+    uint32_t i;
+
+    for (i = 0; i < prof_nprogs; i++) {
+        if (strncmp((const int8_t*) prof_progs[i], (const int8_t*) name, PROF_NAME_SIZE) == 0)
+            return i;
+    }
+    if (prof_nprogs == PROF_MAX_PROGS) return PROF_PROG_NONE;
+    strncpy((int8_t*) prof_progs[prof_nprogs], (const int8_t*) name, PROF_NAME_SIZE);
+    return prof_nprogs++;
+}
+
+/*
+ * profile_start
+ *   DESCRIPTION: Picks the sample source and starts sampling. Rates above
+ *                the RTC's usual 1024 Hz speed the chip up, rtc.c keeps
+ *                the virtualized rtc_read rate the same.
+ *   INPUTS: hz - 0 for every PIT tick, else a power of 2 up to PROF_MAX_HZ
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on a bad rate
+ *   SIDE EFFECTS: may reprogram the RTC
+ */
+static int32_t profile_start(uint32_t hz) {
+    uint32_t rtc_hz;
+
+    if (hz != 0 && (hz < 2 || hz > PROF_MAX_HZ || (hz & (hz - 1)) != 0))
+        return -1;
+
+    prof_running = 0;
+    prof_hz = hz;
+    prof_div_count = 0;
+    if (hz == 0) {
+        prof_source = PROF_SOURCE_PIT;
+        prof_div = 1;
+        rtc_set_hw_freq(RTC_MAX_FREQ);
+    } else {
+        prof_source = PROF_SOURCE_RTC;
+        rtc_hz = (hz > RTC_MAX_FREQ) ? hz : RTC_MAX_FREQ;
+        prof_div = rtc_hz / hz;
+        rtc_set_hw_freq(rtc_hz);
+    }
+    prof_running = 1;
+    return 0;
+}
+
+/*
+ * profile_read
+ *   DESCRIPTION: Copies the header and every non-empty bucket that fits
+ *   INPUTS: buf - user buffer, starts with a prof_header_t
+ *           nbytes - size of buf
+ *   OUTPUTS: none
+ *   RETURN VALUE: bytes written, -1 on a bad buffer
+ *   SIDE EFFECTS: none
+ */
+static int32_t profile_read(void* buf, uint32_t nbytes) {
+    prof_header_t* header = (prof_header_t*) buf;
+    prof_entry_t* entry = (prof_entry_t*) (header + 1);
+    uint32_t room, i, flags;
+
+    if (buf == NULL || nbytes < sizeof(prof_header_t) || nbytes > FOUR_MB) return -1;
+    if ((uint32_t) buf < USER_MEM_VIRTUAL_ADDR || (uint32_t) buf + nbytes > USER_MEM_VIRTUAL_ADDR + FOUR_MB) return -1;
+
+    room = (nbytes - sizeof(prof_header_t)) / sizeof(prof_entry_t);
+    header->nentries = 0;
+
+    // a consistent snapshot, the RTC may be firing at 8 kHz
+    cli_and_save(flags);
+    header->hz = prof_hz;
+    header->running = prof_running;
+    header->samples = prof_samples;
+    header->dropped = prof_dropped;
+    header->nprogs = prof_nprogs;
+    memcpy(header->progs, prof_progs, sizeof(prof_progs));
+    for (i = 0; i < PROF_BUCKETS && header->nentries < room; i++) {
+        if (prof_table[i].count == 0) continue;
+        *entry++ = prof_table[i];
+        header->nentries++;
+    }
+    restore_flags(flags);
+
+    return sizeof(prof_header_t) + header->nentries * sizeof(prof_entry_t);
+}
+
+/*
+ * profile
+ *   DESCRIPTION: System call controlling the profiler
+ *   INPUTS: cmd - PROF_* command
+ *           buf - PROF_READ destination
+ *           arg - rate for PROF_START, size of buf for PROF_READ
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 or bytes read on success, -1 on failure
+ *   SIDE EFFECTS: starts, stops or clears sampling
+ */
+int32_t profile(uint32_t cmd, void* buf, uint32_t arg) {
+    uint32_t flags;
+
+    switch (cmd) {
+        case PROF_START:
+            return profile_start(arg);
+
+        case PROF_STOP:
+            prof_running = 0;
+            rtc_set_hw_freq(RTC_MAX_FREQ);
+            return 0;
+
+        case PROF_RESET:
+            cli_and_save(flags);
+            memset(prof_table, 0, sizeof(prof_table));
+            prof_samples = 0;
+            prof_dropped = 0;
+            restore_flags(flags);
+            return 0;
+
+        case PROF_READ:
+            return profile_read(buf, arg);
+
+        default:
+            return -1;
+    }
+}
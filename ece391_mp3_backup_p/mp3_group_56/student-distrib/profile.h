@@ -0,0 +1,67 @@
+/* profile.h - Sampling profiler fed by the PIT or RTC interrupt
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _PROFILE_H
+#define _PROFILE_H
+
+/* profile() commands */
+#define PROF_START          0   // arg = sample rate in Hz, 0 samples on every PIT tick
+#define PROF_STOP           1
+#define PROF_RESET          2   // drops the samples, keeps the program table
+#define PROF_READ           3   // buf/arg = where to copy and its size
+
+/* the RTC can interrupt at 8 kHz, anything from 2 Hz up is a power of 2 */
+#define PROF_MAX_HZ         8192
+
+/* (program, eip) buckets */
+#define PROF_BUCKET_BITS    11
+#define PROF_BUCKETS        (1 << PROF_BUCKET_BITS)
+#define PROF_BUCKET_MASK    (PROF_BUCKETS - 1)
+/* slots tried before a sample counts as dropped */
+#define PROF_MAX_PROBE      8
+
+/* distinct program names remembered since boot */
+#define PROF_MAX_PROGS      32
+#define PROF_NAME_SIZE      32
+/* program index for samples taken with no process on the stack */
+#define PROF_PROG_NONE      0xFF
+
+/* where a sample came from */
+#define PROF_SOURCE_PIT     0
+#define PROF_SOURCE_RTC     1
+
+#ifndef ASM
+
+#include "types.h"
+
+/* What PROF_READ writes first */
+typedef struct prof_header_t {
+    uint32_t hz;            // rate of the last PROF_START, 0 for the PIT
+    uint32_t running;
+    uint32_t samples;
+    uint32_t dropped;       // samples that found no free bucket
+    uint32_t nprogs;
+    uint32_t nentries;      // entries that follow the program names
+    uint8_t progs[PROF_MAX_PROGS][PROF_NAME_SIZE];
+} prof_header_t;
+
+/* One bucket with samples in it */
+typedef struct prof_entry_t {
+    uint32_t eip;
+    uint32_t prog;          // index into progs, or PROF_PROG_NONE
+    uint32_t count;
+} prof_entry_t;
+
+/* profile system call */
+int32_t profile(uint32_t cmd, void* buf, uint32_t arg);
+
+/* Called from the PIT and RTC top halves */
+void profile_tick(uint32_t source);
+
+/* Program index for a name, added to the table if new, PROF_PROG_NONE if full */
+uint32_t profile_prog_index(const uint8_t* name);
+
+#endif /* ASM */
+
+#endif /* _PROFILE_H */
@@ -0,0 +1,447 @@
+/* smp.c - Multiprocessor table parsing and application processor start-up
+ * vim:ts=4 noexpandtab
+ */
+
+#include "smp.h"
+#include "lib.h"
+#include "paging.h"
+#include "spinlock.h"
+#include "fpu.h"
+#include "irq.h"
+#include "devices/apic.h"
+
+/* The BSP starts the three shells and then keeps terminal 0, terminals 1
+ * and 2 are split over the APs that came up (smp_assign_terminals). Each
+ * CPU schedules only the terminals in its own terminal_mask, so a process
+ * stays on one CPU from then on. What a running process touches per CPU
+ * is kept per CPU: the TSS (esp0), the page directory (the user page),
+ * the FPU owner and the interrupt nesting state, all found through
+ * smp_cpu_index(). Device interrupts still all go to the BSP, which passes
+ * each PIT tick on to the APs with a RESCHED_VECTOR IPI. profile_tick only
+ * runs in the BSP's PIT handler, so processes on the APs are not sampled. */
+
+extern uint8_t ap_trampoline[], ap_trampoline_end[];
+extern uint8_t ap_tramp_gdt_desc[], ap_tramp_cr3[], ap_tramp_cr4[];
+extern uint8_t ap_tramp_stack[], ap_tramp_entry[];
+
+// the BSP's entry is usable before smp_init, and without it
+static cpu_t cpus[MAX_CPUS] = {
+    { .online = 1, .tss_sel = KERNEL_TSS, .tss = &tss, .page_dir = page_dir, .terminal_mask = 0x7 }
+};
+static uint32_t num_cpus = 1;
+static uint32_t num_online = 1;
+static spinlock_t online_lock = SPINLOCK_INIT("cpus online");
+static uint32_t lapic_base = 0;
+static volatile uint32_t low_memory_restored = 0;
+
+static uint8_t ap_stacks[MAX_CPUS][AP_STACK_SIZE] __attribute__((aligned(16)));
+static tss_t ap_tss[MAX_CPUS];
+static page_dir_desc_t ap_page_dirs[MAX_CPUS][NUM_ENTRIES] __attribute__((aligned(FOUR_KB)));
+
+/* low memory pages that were mapped before the tables were searched */
+static uint8_t low_page_present[BIOS_ROM_END / FOUR_KB];
+
+/*
+ * tramp_word
+ *   DESCRIPTION: Where one of the trampoline's data words ended up in the copy
+ *   INPUTS: sym - the word in the kernel image
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer into the copy at AP_TRAMPOLINE_ADDR
+ *   SIDE EFFECTS: none
+ */
+static inline uint32_t* tramp_word(uint8_t* sym) {
+    return (uint32_t*) (AP_TRAMPOLINE_ADDR + (sym - ap_trampoline));
+}
+
+/*
+ * map_low_memory
+ *   DESCRIPTION: Identity maps the first megabyte for the BIOS tables and
+ *                the trampoline, or puts back the mappings from before
+ *   INPUTS: map - 1 to map, 0 to restore
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: flushes the TLB when restoring
+ */
+static void map_low_memory(int map) {
+    uint32_t i;
+
+    for (i = 0; i < BIOS_ROM_END / FOUR_KB; i++) {
+        if (map) {
+            low_page_present[i] = video_memory_page_table[i].p;
+            video_memory_page_table[i].p = 1;
+            video_memory_page_table[i].base_31_12 = i;
+            tlb_invalidate(i * FOUR_KB);
+        } else {
+            video_memory_page_table[i].p = low_page_present[i];
+        }
+    }
+    if (!map) tlb_flush_all();
+}
+
+/*
+ * checksum_ok
+ *   DESCRIPTION: MP structures sum to 0 byte-wise
+ *   INPUTS: p - start, len - bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the sum is 0
+ *   SIDE EFFECTS: none
+ */
+static int checksum_ok(const uint8_t* p, uint32_t len) {
+    uint8_t sum = 0;
+    while (len--)
+        sum += *p++;
+    return sum == 0;
+}
+
+/*
+ * find_mp_float
+ *   DESCRIPTION: Searches one range for the MP floating pointer
+ *   INPUTS: start, len - physical range, 16 byte aligned
+ *   OUTPUTS: none
+ *   RETURN VALUE: the structure, NULL if absent
+ *   SIDE EFFECTS: none
+ */
+static mp_float_t* find_mp_float(uint32_t start, uint32_t len) {
+    uint32_t addr;
+    mp_float_t* mp;
+
+    for (addr = start; addr + sizeof(mp_float_t) <= start + len; addr += 16) {
+        mp = (mp_float_t*) addr;
+        if (mp->signature == MP_FLOAT_SIG && checksum_ok((uint8_t*) mp, mp->length * 16))
+            return mp;
+    }
+    return NULL;
+}
+
+/*
+ * parse_mp_tables
+ *   DESCRIPTION: Looks for the MP floating pointer where the spec says it
+ *                can be (EBDA, end of base memory, BIOS ROM) and records
+ *                the CPUs, the I/O APIC and the ISA interrupt wiring
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 if usable tables were found, -1 else
+ *   SIDE EFFECTS: fills cpus[], sets up the I/O APIC
+ */
+static int parse_mp_tables(void) {
+    uint32_t ebda = (uint32_t) (*(uint16_t*) BDA_EBDA_SEGMENT) << 4;
+    uint32_t base_mem = (uint32_t) (*(uint16_t*) BDA_BASE_MEM_KB) * 1024;
+    mp_float_t* mp = NULL;
+    mp_config_t* config;
+    mp_processor_t* proc;
+    mp_ioapic_t* io;
+    mp_ioint_t* ioint;
+    uint8_t* entry;
+    uint8_t isa_bus = 0xFF;
+    uint32_t ioapic_addr = 0;
+    uint32_t i;
+
+    if (ebda != 0 && ebda < BIOS_ROM_END)
+        mp = find_mp_float(ebda, 1024);
+    if (mp == NULL && base_mem >= 1024 && base_mem <= BIOS_ROM_START)
+        mp = find_mp_float(base_mem - 1024, 1024);
+    if (mp == NULL)
+        mp = find_mp_float(BIOS_ROM_START, BIOS_ROM_END - BIOS_ROM_START);
+    // a default configuration (features[0] != 0) has no table to read
+    if (mp == NULL || mp->config_addr == 0 || mp->config_addr >= BIOS_ROM_END)
+        return -1;
+
+    config = (mp_config_t*) mp->config_addr;
+    if (config->signature != MP_CONFIG_SIG || !checksum_ok((uint8_t*) config, config->length))
+        return -1;
+    lapic_base = config->lapic_addr;
+
+    // processors and buses first, the interrupt entries refer to the bus ids
+    num_cpus = 0;
+    entry = (uint8_t*) (config + 1);
+    for (i = 0; i < config->entry_count; i++) {
+        switch (*entry) {
+            case MP_ENTRY_PROCESSOR:
+                proc = (mp_processor_t*) entry;
+                if ((proc->flags & MP_CPU_ENABLED) && num_cpus < MAX_CPUS) {
+                    // the BSP is entry 0 so it keeps the original TSS
+                    if (proc->flags & MP_CPU_BSP) {
+                        cpus[num_cpus].apic_id = cpus[0].apic_id;
+                        cpus[0].apic_id = proc->lapic_id;
+                    } else {
+                        cpus[num_cpus].apic_id = proc->lapic_id;
+                    }
+                    num_cpus++;
+                }
+                entry += sizeof(mp_processor_t);
+                break;
+            case MP_ENTRY_BUS:
+                if (strncmp((int8_t*) ((mp_bus_t*) entry)->bus_type, (int8_t*) "ISA", 3) == 0)
+                    isa_bus = ((mp_bus_t*) entry)->bus_id;
+                entry += sizeof(mp_bus_t);
+                break;
+            case MP_ENTRY_IOAPIC:
+                io = (mp_ioapic_t*) entry;
+                // the first enabled one, QEMU and most boards have exactly one
+                if ((io->flags & 0x1) && ioapic_addr == 0)
+                    ioapic_addr = io->addr;
+                entry += sizeof(mp_ioapic_t);
+                break;
+            default:
+                entry += 8;     // the other entry types are all 8 bytes
+                break;
+        }
+    }
+    // one CPU is served just as well by the 8259
+    if (num_cpus < 2 || ioapic_addr == 0) {
+        num_cpus = 1;
+        return -1;
+    }
+
+    map_mmio_4mb(lapic_base);
+    map_mmio_4mb(ioapic_addr);
+    lapic_init(lapic_base);
+    // PIC mode boards wire the 8259 straight to the BSP until the IMCR is set
+    ioapic_init(ioapic_addr, lapic_id(), mp->features[1] & MP_IMCR_PRESENT);
+
+    entry = (uint8_t*) (config + 1);
+    for (i = 0; i < config->entry_count; i++) {
+        if (*entry == MP_ENTRY_IOINT) {
+            ioint = (mp_ioint_t*) entry;
+            if (ioint->int_type == 0 && ioint->src_bus == isa_bus)
+                ioapic_set_isa_override(ioint->src_irq, ioint->dst_pin, ioint->flags);
+        }
+        entry += (*entry == MP_ENTRY_PROCESSOR) ? sizeof(mp_processor_t) : 8;
+    }
+    return 0;
+}
+
+/*
+ * find_cpu
+ *   DESCRIPTION: Entry with a given local APIC id, for an AP that has not
+ *                loaded its TSS yet
+ *   INPUTS: id - local APIC id
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer into cpus[], the BSP's if the id is unknown
+ *   SIDE EFFECTS: none
+ */
+static cpu_t* find_cpu(uint32_t id) {
+    uint32_t i;
+
+    for (i = 0; i < num_cpus; i++) {
+        if (cpus[i].apic_id == id) return &cpus[i];
+    }
+    return &cpus[0];
+}
+
+/*
+ * setup_cpu_tss
+ *   DESCRIPTION: Gives an AP its own TSS and GDT descriptor, interrupts from
+ *                user mode on that CPU would land on its own stack
+ *   INPUTS: idx - index into cpus[], at least 1
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes a GDT entry
+ */
+static void setup_cpu_tss(uint32_t idx) {
+    cpu_t* cpu = &cpus[idx];
+    seg_desc_t the_tss_desc;
+
+    cpu->tss = &ap_tss[idx];
+    memset(cpu->tss, 0, sizeof(tss_t));
+    cpu->tss->ldt_segment_selector = KERNEL_LDT;
+    cpu->tss->ss0 = KERNEL_DS;
+    cpu->tss->esp0 = (uint32_t) ap_stacks[idx] + AP_STACK_SIZE;
+    cpu->tss_sel = AP_TSS_BASE + 8 * (idx - 1);
+
+    the_tss_desc.granularity   = 0x0;
+    the_tss_desc.opsize        = 0x0;
+    the_tss_desc.reserved      = 0x0;
+    the_tss_desc.avail         = 0x0;
+    the_tss_desc.present       = 0x1;
+    the_tss_desc.dpl           = 0x0;
+    the_tss_desc.sys           = 0x0;
+    the_tss_desc.type          = 0x9;
+    SET_TSS_PARAMS(the_tss_desc, cpu->tss, TSS_SIZE - 1);
+    ap_tss_desc_ptr[idx - 1] = the_tss_desc;
+}
+
+/*
+ * smp_init
+ *   DESCRIPTION: Reads the MP tables, switches to the local APIC and starts
+ *                every other CPU one at a time. Does nothing unless the
+ *                tables list more than one CPU and an I/O APIC.
+ *   INPUTS: none
+ *   OUTPUTS: prints how many CPUs came up
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: the APs run ap_main and idle until they get terminals,
+ *                 i8259_init will hand the ISA interrupts to the I/O APIC
+ */
+void smp_init(void) {
+    uint32_t i, wait, cr3, cr4;
+
+    map_low_memory(1);
+    if (parse_mp_tables() == -1) {
+        map_low_memory(0);
+        printf("SMP: running on one CPU\n");
+        return;
+    }
+    request_irq(IRQ_RESCHED, set_need_resched);
+
+    memcpy((void*) AP_TRAMPOLINE_ADDR, ap_trampoline, ap_trampoline_end - ap_trampoline);
+    asm volatile ("movl %%cr3, %0; movl %%cr4, %1" : "=r" (cr3), "=r" (cr4));
+    // gdt_desc in x86_desc.S is the bare 6 bytes lgdt wants
+    memcpy(tramp_word(ap_tramp_gdt_desc), &gdt_desc, 6);
+    *tramp_word(ap_tramp_cr3) = cr3;
+    *tramp_word(ap_tramp_cr4) = cr4;
+    *tramp_word(ap_tramp_entry) = (uint32_t) ap_main;
+
+    for (i = 1; i < num_cpus; i++) {
+        setup_cpu_tss(i);
+        cpus[i].page_dir = ap_page_dirs[i];
+        cpus[i].terminal_mask = 0;
+        cpus[i].schedule_index = 0;
+        *tramp_word(ap_tramp_stack) = (uint32_t) ap_stacks[i] + AP_STACK_SIZE;
+        lapic_start_ap(cpus[i].apic_id, AP_TRAMPOLINE_ADDR);
+        // one at a time, they share the trampoline's stack word
+        for (wait = 0; wait < 100000 && !cpus[i].online; wait++)
+            asm volatile ("pause");
+    }
+
+    map_low_memory(0);
+    low_memory_restored = 1;
+    printf("SMP: %u of %u CPUs online\n", smp_num_online(), num_cpus);
+}
+
+/*
+ * ap_main
+ *   DESCRIPTION: First C code on an AP. Turns on the caches INIT left off,
+ *                loads the IDT and this CPU's TSS, enables its local APIC
+ *                and reports in. Once the BSP has put low memory back it
+ *                takes its own copy of the page directory and idles with
+ *                interrupts on, waiting for the BSP's reschedule IPIs.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: never returns
+ *   SIDE EFFECTS: marks the CPU online
+ */
+void ap_main(void) {
+    cpu_t* cpu;
+
+    // caches on like the BSP, MP so WAIT honours TS for the lazy FPU switch
+    asm volatile (
+        "movl %%cr0, %%eax  ;\
+         andl %0, %%eax     ;\
+         orl %1, %%eax      ;\
+         movl %%eax, %%cr0  ;\
+         wbinvd             ;\
+        "
+        :
+        : "i" (~(CR0_CD | CR0_NW | CR0_EM)), "i" (CR0_MP)
+        : "eax", "memory"
+    );
+    lapic_init(lapic_base);
+    cpu = find_cpu(lapic_id());
+    asm volatile ("lidt idt_desc_ptr" : : : "memory");
+    ltr(cpu->tss_sel);
+
+    spin_lock(&online_lock);
+    num_online++;
+    spin_unlock(&online_lock);
+    cpu->online = 1;
+
+    // the trampoline's identity mapping must not end up in the copy
+    while (!low_memory_restored)
+        asm volatile ("pause");
+    memcpy(cpu->page_dir, page_dir, sizeof(page_dir));
+    load_page_dir((unsigned int*) cpu->page_dir);
+
+    for (;;)
+        asm volatile ("sti; hlt");
+}
+
+/*
+ * smp_assign_terminals
+ *   DESCRIPTION: Splits terminals 1 and 2 over the APs that are online and
+ *                leaves terminal 0 to the BSP. Called from schedule() on
+ *                the BSP with interrupts off, so no AP can be sent a tick
+ *                before the BSP has saved the process it is switching from.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes every CPU's terminal_mask
+ */
+void smp_assign_terminals(void) {
+    uint32_t aps[MAX_CPUS];
+    uint32_t n = 0;
+    uint32_t i, t;
+
+    for (i = 1; i < num_cpus; i++) {
+        if (cpus[i].online) aps[n++] = i;
+    }
+    if (n == 0) return;
+
+    // the shells that move may have their FPU registers live on the BSP
+    kernel_fpu_end(kernel_fpu_begin());
+
+    for (t = 1; t < 3; t++)
+        cpus[aps[(t - 1) % n]].terminal_mask |= 1 << t;
+    cpus[0].terminal_mask = 1 << 0;
+}
+
+/*
+ * smp_send_resched
+ *   DESCRIPTION: Called from the PIT top half on the BSP, gives every AP
+ *                with terminals its own scheduling tick
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sends IPIs
+ */
+void smp_send_resched(void) {
+    uint32_t i;
+
+    for (i = 1; i < num_cpus; i++) {
+        if (cpus[i].online && cpus[i].terminal_mask != 0)
+            lapic_send_fixed_ipi(cpus[i].apic_id, RESCHED_VECTOR);
+    }
+}
+
+/*
+ * set_kernel_stack
+ *   DESCRIPTION: Sets esp0 in the calling CPU's TSS
+ *   INPUTS: esp0 - top of the kernel stack of the process about to run
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void set_kernel_stack(uint32_t esp0) {
+    tss_t* t = this_cpu()->tss;
+
+    t->ss0 = (uint16_t) KERNEL_DS;
+    t->esp0 = esp0;
+}
+
+/*
+ * smp_num_online
+ *   DESCRIPTION: CPUs that have reached ap_main, plus the BSP
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: count
+ *   SIDE EFFECTS: none
+ */
+uint32_t smp_num_online(void) {
+    uint32_t n;
+
+    spin_lock(&online_lock);
+    n = num_online;
+    spin_unlock(&online_lock);
+    return n;
+}
+
+/*
+ * this_cpu
+ *   DESCRIPTION: Entry of the calling CPU
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer into cpus[]
+ *   SIDE EFFECTS: none
+ */
+cpu_t* this_cpu(void) {
+    return &cpus[smp_cpu_index()];
+}
@@ -0,0 +1,155 @@
+/* smp.h - Multiprocessor table parsing and application processor start-up
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _SMP_H
+#define _SMP_H
+
+#include "x86_desc.h"
+
+/* Uncomment to look for other CPUs and, if there are any, switch
+ * interrupts to the I/O APIC and give terminals 1 and 2 to them. Off until
+ * it has been booted with several CPUs, everything runs on the BSP. */
+// #define SMP_ENABLED
+
+/* real mode entry for the APs, must be page aligned and below 1 MB */
+#define AP_TRAMPOLINE_ADDR  0x7000
+#define AP_STACK_SIZE       4096
+
+/* CR0 bits an AP comes out of INIT with, they turn the caches off */
+#define CR0_CD              0x40000000
+#define CR0_NW              0x20000000
+
+/* MP floating pointer and configuration table (Intel MP spec 1.4) */
+#define MP_FLOAT_SIG        0x5F504D5F  // "_MP_"
+#define MP_CONFIG_SIG       0x504D4350  // "PCMP"
+#define MP_ENTRY_PROCESSOR  0
+#define MP_ENTRY_BUS        1
+#define MP_ENTRY_IOAPIC     2
+#define MP_ENTRY_IOINT      3
+#define MP_ENTRY_LOCALINT   4
+#define MP_CPU_ENABLED      0x01
+#define MP_CPU_BSP          0x02
+#define MP_IMCR_PRESENT     0x80
+
+/* BIOS data area words that locate the EBDA and the end of base memory */
+#define BDA_EBDA_SEGMENT    0x40E
+#define BDA_BASE_MEM_KB     0x413
+#define BIOS_ROM_START      0xF0000
+#define BIOS_ROM_END        0x100000
+
+#ifndef ASM
+
+#include "types.h"
+#include "paging.h"
+
+typedef struct __attribute__((packed)) mp_float_t {
+    uint32_t signature;
+    uint32_t config_addr;
+    uint8_t length;         // in 16 byte units
+    uint8_t spec_rev;
+    uint8_t checksum;
+    uint8_t features[5];
+} mp_float_t;
+
+typedef struct __attribute__((packed)) mp_config_t {
+    uint32_t signature;
+    uint16_t length;
+    uint8_t spec_rev;
+    uint8_t checksum;
+    uint8_t oem_id[8];
+    uint8_t product_id[12];
+    uint32_t oem_table;
+    uint16_t oem_table_size;
+    uint16_t entry_count;
+    uint32_t lapic_addr;
+    uint16_t ext_length;
+    uint8_t ext_checksum;
+    uint8_t reserved;
+} mp_config_t;
+
+typedef struct __attribute__((packed)) mp_processor_t {
+    uint8_t type;
+    uint8_t lapic_id;
+    uint8_t lapic_ver;
+    uint8_t flags;
+    uint32_t signature;
+    uint32_t features;
+    uint32_t reserved[2];
+} mp_processor_t;
+
+typedef struct __attribute__((packed)) mp_bus_t {
+    uint8_t type;
+    uint8_t bus_id;
+    uint8_t bus_type[6];
+} mp_bus_t;
+
+typedef struct __attribute__((packed)) mp_ioapic_t {
+    uint8_t type;
+    uint8_t id;
+    uint8_t ver;
+    uint8_t flags;
+    uint32_t addr;
+} mp_ioapic_t;
+
+typedef struct __attribute__((packed)) mp_ioint_t {
+    uint8_t type;
+    uint8_t int_type;
+    uint16_t flags;
+    uint8_t src_bus;
+    uint8_t src_irq;
+    uint8_t dst_ioapic;
+    uint8_t dst_pin;
+} mp_ioint_t;
+
+/* One per CPU, schedule() only looks at the calling CPU's entry */
+typedef struct cpu_t {
+    uint32_t apic_id;
+    volatile uint32_t online;
+    uint16_t tss_sel;
+    tss_t* tss;                         // the global tss for the BSP
+    page_dir_desc_t* page_dir;          // own copy, the user page differs per CPU
+    volatile uint32_t terminal_mask;    // run queue: terminals this CPU schedules
+    int32_t schedule_index;             // terminal whose process is running here
+} cpu_t;
+
+/* Finds the other CPUs in the MP table, starts them and sets up the APICs */
+void smp_init(void);
+
+/* Number of CPUs running kernel code */
+uint32_t smp_num_online(void);
+
+/* Entry of the calling CPU, the BSP's before smp_init */
+cpu_t* this_cpu(void);
+
+/* Stack the calling CPU switches to on an interrupt from user mode */
+void set_kernel_stack(uint32_t esp0);
+
+/* Called by the BSP once the three shells run, moves terminals 1 and 2 to the APs */
+void smp_assign_terminals(void);
+
+/* Passes a PIT tick on to every AP that has terminals */
+void smp_send_resched(void);
+
+/* Where the trampoline jumps once an AP is in protected mode with paging */
+void ap_main(void);
+
+/*
+ * smp_cpu_index
+ *   DESCRIPTION: Index of the calling CPU in cpus[], read off the task
+ *                register since every CPU loads its own TSS selector
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 for the BSP, 1 to MAX_CPUS - 1 for the APs
+ *   SIDE EFFECTS: none
+ */
+static inline uint32_t smp_cpu_index(void) {
+    uint16_t sel;
+
+    asm volatile ("str %0" : "=r" (sel));
+    return (sel < AP_TSS_BASE) ? 0 : (sel - AP_TSS_BASE) / 8 + 1;
+}
+
+#endif /* ASM */
+
+#endif /* _SMP_H */
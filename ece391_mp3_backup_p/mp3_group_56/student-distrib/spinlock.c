@@ -0,0 +1,193 @@
+#include "spinlock.h"
+
+/* every lock that has been taken at least once, for get_lock_stats */
+static lock_stats_t* lock_list[MAX_LOCKS];
+static uint32_t num_locks = 0;
+static spinlock_t list_lock = SPINLOCK_INIT(0);
+
+/*
+ * lock_list_add
+ *   DESCRIPTION: Remembers a lock the first time it is taken. Locks set up
+ *                again at the same address, like the ones in a PCB, stay
+ *                listed once.
+ *   INPUTS: stats - the lock's counters
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may add to lock_list, drops locks past MAX_LOCKS
+ */
+static void lock_list_add(lock_stats_t* stats) {
+    uint32_t i;
+
+    for (i = 0; i < num_locks; i++) {
+        if (lock_list[i] == stats) return;
+    }
+    if (num_locks < MAX_LOCKS)
+        lock_list[num_locks++] = stats;
+}
+
+/*
+ * lock_stats_clear
+ *   DESCRIPTION: Zeroes a lock's counters, keeping its name and the start
+ *                of a hold that may be in progress
+ *   INPUTS: stats - the counters
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void lock_stats_clear(lock_stats_t* stats) {
+    const char* name = stats->name;
+    uint64_t held_since = stats->held_since;
+
+    memset(stats, 0, sizeof(lock_stats_t));
+    stats->name = name;
+    stats->held_since = held_since;
+}
+
+/*
+ * spin_lock_init
+ *   DESCRIPTION: Sets up a spinlock that lives in memory that is reused,
+ *                such as a PCB
+ *   INPUTS: lock - the lock
+ *           name - what get_lock_stats reports it as
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: releases the lock
+ */
+void spin_lock_init(spinlock_t* lock, const char* name) {
+    lock->next = 0;
+    lock->owner = 0;
+#ifdef LOCK_STATS
+    lock->stats.name = name;
+    lock_stats_clear(&lock->stats);
+#endif
+}
+
+/*
+ * rwlock_init
+ *   DESCRIPTION: Sets up a reader-writer lock that lives in reused memory
+ *   INPUTS: lock - the lock
+ *           name - what get_lock_stats reports it as
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: releases the lock
+ */
+void rwlock_init(rwlock_t* lock, const char* name) {
+    lock->count = 0;
+#ifdef LOCK_STATS
+    lock->stats.name = name;
+    lock_stats_clear(&lock->stats);
+#endif
+}
+
+/*
+ * lock_stat_acquired
+ *   DESCRIPTION: Called by spin_lock and write_lock once the lock is held
+ *   INPUTS: stats - the lock's counters
+ *           spin_start - TSC when the taker arrived
+ *           contended - nonzero if it had to wait
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: starts the hold timer, lists the lock on first use
+ */
+void lock_stat_acquired(lock_stats_t* stats, uint64_t spin_start, int32_t contended) {
+    uint64_t now = rdtsc();
+    uint32_t flags;
+
+    stats->acquired++;
+    if (contended) {
+        stats->contended++;
+        stats->spin_cycles += now - spin_start;
+    }
+    stats->held_since = now;
+    // the list lock has no name, listing it would take it again
+    if (stats->acquired == 1 && stats->name != 0) {
+        spin_lock_irqsave(&list_lock, flags);
+        lock_list_add(stats);
+        spin_unlock_irqrestore(&list_lock, flags);
+    }
+}
+
+/*
+ * lock_stat_released
+ *   DESCRIPTION: Called by spin_unlock and write_unlock while still holding
+ *   INPUTS: stats - the lock's counters
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: adds the hold time
+ */
+void lock_stat_released(lock_stats_t* stats) {
+    uint32_t held = (uint32_t) (rdtsc() - stats->held_since);
+
+    stats->hold_cycles += held;
+    if (held > stats->max_hold)
+        stats->max_hold = held;
+}
+
+/*
+ * lock_stat_read
+ *   DESCRIPTION: Called by read_lock. Readers hold the lock together, so
+ *                the counts are bumped atomically and the spin time is only
+ *                approximate when several readers wait at once.
+ *   INPUTS: stats - the lock's counters
+ *           spin_start - TSC when the reader arrived
+ *           contended - nonzero if it had to wait for a writer
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: lists the lock on first use
+ */
+void lock_stat_read(lock_stats_t* stats, uint64_t spin_start, int32_t contended) {
+    uint32_t before = 1;
+    uint32_t flags;
+
+    asm volatile ("lock xaddl %0, %1" : "+r" (before), "+m" (stats->acquired) : : "memory");
+    if (contended) {
+        asm volatile ("lock incl %0" : "+m" (stats->contended) : : "memory");
+        stats->spin_cycles += rdtsc() - spin_start;
+    }
+    if (before == 0 && stats->name != 0) {
+        spin_lock_irqsave(&list_lock, flags);
+        lock_list_add(stats);
+        spin_unlock_irqrestore(&list_lock, flags);
+    }
+}
+
+/*
+ * get_lock_stats
+ *   DESCRIPTION: Copies one listed lock's counters
+ *   INPUTS: idx - position in the list, in order of first use
+ *           stats - where to copy them
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if there is no such lock
+ *   SIDE EFFECTS: none
+ */
+int32_t get_lock_stats(uint32_t idx, lock_stats_t* stats) {
+    uint32_t flags;
+    int32_t ret = -1;
+
+    if (stats == NULL) return -1;
+    spin_lock_irqsave(&list_lock, flags);
+    if (idx < num_locks) {
+        *stats = *lock_list[idx];
+        ret = 0;
+    }
+    spin_unlock_irqrestore(&list_lock, flags);
+    return ret;
+}
+
+/*
+ * reset_lock_stats
+ *   DESCRIPTION: Zeroes every listed lock's counters, the locks stay listed
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void reset_lock_stats(void) {
+    uint32_t flags, i;
+
+    spin_lock_irqsave(&list_lock, flags);
+    for (i = 0; i < num_locks; i++) {
+        lock_stats_clear(lock_list[i]);
+    }
+    spin_unlock_irqrestore(&list_lock, flags);
+}
@@ -0,0 +1,221 @@
+/* spinlock.h - Busy-wait locks for state shared with interrupts and CPUs
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _SPINLOCK_H
+#define _SPINLOCK_H
+
+#include "types.h"
+#include "lib.h"
+
+/* Comment out to drop the counters and the rdtsc on every lock and unlock */
+#define LOCK_STATS
+
+/* Most locks that get_lock_stats can list */
+#define MAX_LOCKS       32
+
+/* Bit a writer owns in rwlock_t.count, the rest counts readers */
+#define RW_WRITER       0x80000000
+
+/* Counters kept per lock, only touched while the lock is held except for
+ * the reader count of an rwlock, which is bumped atomically */
+typedef struct lock_stats_t {
+    const char* name;
+    uint32_t acquired;          // times taken, readers included
+    uint32_t contended;         // times the taker had to spin
+    uint64_t spin_cycles;       // time spent spinning
+    uint64_t hold_cycles;       // time held, writers only for an rwlock
+    uint32_t max_hold;          // longest single hold
+    uint64_t held_since;
+} lock_stats_t;
+
+#ifdef LOCK_STATS
+#define LOCK_STATS_INIT(name)   { name, 0, 0, 0, 0, 0, 0 }
+#else
+#define LOCK_STATS_INIT(name)
+#endif
+
+/* Ticket lock: takers are served in the order they arrived, so a CPU
+ * hammering the lock cannot starve the others. On one CPU the lock never
+ * spins, the irqsave forms are what keep interrupt handlers out. */
+typedef struct spinlock_t {
+    volatile uint32_t next;     // ticket the next taker gets
+    volatile uint32_t owner;    // ticket being served
+#ifdef LOCK_STATS
+    lock_stats_t stats;
+#endif
+} spinlock_t;
+
+#define SPINLOCK_INIT(name)     { 0, 0, LOCK_STATS_INIT(name) }
+
+/* Many readers or one writer. Readers are not blocked by waiting writers,
+ * so use it where writes are rare. */
+typedef struct rwlock_t {
+    volatile uint32_t count;
+#ifdef LOCK_STATS
+    lock_stats_t stats;
+#endif
+} rwlock_t;
+
+#define RWLOCK_INIT(name)       { 0, LOCK_STATS_INIT(name) }
+
+/* Sets up a lock that is not statically initialized */
+void spin_lock_init(spinlock_t* lock, const char* name);
+void rwlock_init(rwlock_t* lock, const char* name);
+
+/* Bookkeeping for the inline functions below, see spinlock.c */
+void lock_stat_acquired(lock_stats_t* stats, uint64_t spin_start, int32_t contended);
+void lock_stat_released(lock_stats_t* stats);
+void lock_stat_read(lock_stats_t* stats, uint64_t spin_start, int32_t contended);
+
+/* Copies the counters of the idx-th lock used so far, -1 past the last */
+int32_t get_lock_stats(uint32_t idx, lock_stats_t* stats);
+/* Zeroes the counters of every listed lock */
+void reset_lock_stats(void);
+
+/* Spins until the lock is ours */
+static inline void spin_lock(spinlock_t* lock) {
+    uint32_t ticket = 1;
+    int32_t contended = 0;
+#ifdef LOCK_STATS
+    uint64_t start = rdtsc();
+#endif
+
+    asm volatile ("lock xaddl %0, %1"
+        : "+r" (ticket), "+m" (lock->next)
+        :
+        : "memory"
+    );
+    while (lock->owner != ticket) {
+        contended = 1;
+        asm volatile ("pause" : : : "memory");
+    }
+#ifdef LOCK_STATS
+    lock_stat_acquired(&lock->stats, start, contended);
+#else
+    (void) contended;
+#endif
+}
+
+/* Serves the next ticket, only the holder writes owner */
+static inline void spin_unlock(spinlock_t* lock) {
+#ifdef LOCK_STATS
+    lock_stat_released(&lock->stats);
+#endif
+    asm volatile ("" : : : "memory");
+    lock->owner = lock->owner + 1;
+}
+
+/* Takes a reader's share, waiting out any writer */
+static inline void read_lock(rwlock_t* lock) {
+    uint32_t old;
+    int32_t contended = 0;
+#ifdef LOCK_STATS
+    uint64_t start = rdtsc();
+#endif
+
+    while (1) {
+        while (lock->count & RW_WRITER) {
+            contended = 1;
+            asm volatile ("pause" : : : "memory");
+        }
+        old = 1;
+        asm volatile ("lock xaddl %0, %1"
+            : "+r" (old), "+m" (lock->count)
+            :
+            : "memory"
+        );
+        if (!(old & RW_WRITER)) break;
+        // a writer got in between, back off
+        asm volatile ("lock decl %0" : "+m" (lock->count) : : "memory");
+    }
+#ifdef LOCK_STATS
+    lock_stat_read(&lock->stats, start, contended);
+#else
+    (void) contended;
+#endif
+}
+
+/* Drops a reader's share */
+static inline void read_unlock(rwlock_t* lock) {
+    asm volatile ("lock decl %0" : "+m" (lock->count) : : "memory");
+}
+
+/* Waits until there are no readers or writers and takes the lock */
+static inline void write_lock(rwlock_t* lock) {
+    uint32_t old;
+    int32_t contended = 0;
+#ifdef LOCK_STATS
+    uint64_t start = rdtsc();
+#endif
+
+    while (1) {
+        old = 0;
+        asm volatile ("lock cmpxchgl %2, %1"
+            : "+a" (old), "+m" (lock->count)
+            : "r" (RW_WRITER)
+            : "memory", "cc"
+        );
+        if (old == 0) break;
+        contended = 1;
+        asm volatile ("pause" : : : "memory");
+    }
+#ifdef LOCK_STATS
+    lock_stat_acquired(&lock->stats, start, contended);
+#else
+    (void) contended;
+#endif
+}
+
+/* Clears the writer bit, readers that backed off may still be counted */
+static inline void write_unlock(rwlock_t* lock) {
+#ifdef LOCK_STATS
+    lock_stat_released(&lock->stats);
+#endif
+    asm volatile ("lock subl %1, %0"
+        : "+m" (lock->count)
+        : "i" (RW_WRITER)
+        : "memory", "cc"
+    );
+}
+
+/* The irqsave forms turn interrupts off first, so a handler on this CPU
+ * cannot spin on a lock the code it interrupted holds. flags gets the old
+ * EFLAGS and the unlock puts them back. */
+#define spin_lock_irqsave(lock, flags)      \
+do {                                        \
+    cli_and_save(flags);                    \
+    spin_lock(lock);                        \
+} while (0)
+
+#define spin_unlock_irqrestore(lock, flags) \
+do {                                        \
+    spin_unlock(lock);                      \
+    restore_flags(flags);                   \
+} while (0)
+
+#define read_lock_irqsave(lock, flags)      \
+do {                                        \
+    cli_and_save(flags);                    \
+    read_lock(lock);                        \
+} while (0)
+
+#define read_unlock_irqrestore(lock, flags) \
+do {                                        \
+    read_unlock(lock);                      \
+    restore_flags(flags);                   \
+} while (0)
+
+#define write_lock_irqsave(lock, flags)     \
+do {                                        \
+    cli_and_save(flags);                    \
+    write_lock(lock);                       \
+} while (0)
+
+#define write_unlock_irqrestore(lock, flags) \
+do {                                        \
+    write_unlock(lock);                     \
+    restore_flags(flags);                   \
+} while (0)
+
+#endif /* _SPINLOCK_H */
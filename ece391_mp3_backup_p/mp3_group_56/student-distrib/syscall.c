@@ -7,6 +7,11 @@
 #include "exceptions.h"
 #include "terminal.h"
 #include "devices/i8259.h"
+#include "trace.h"
+#include "devices/pit.h"
+#include "profile.h"
+#include "page_pool.h"
+#include "smp.h"
 
 extern int terminal_idx;
 extern int new_terminal_flag;
@@ -21,9 +26,9 @@ extern int new_terminal_flag;
  */
 int32_t execute (const uint8_t* command) {
     if(!is_pcb_available() || command == NULL) return -1;
-    // cli();
 
     int i;
+    uint32_t flags;
     
     uint8_t filename[128];
     for (i = 0; i < 128; i++) {
@@ -53,12 +58,13 @@ int32_t execute (const uint8_t* command) {
     }
 
     /* Check if PCBs are available */
-    uint32_t new_pid_idx;
-    for (new_pid_idx = 0; new_pid_idx < MAX_NUM_PROGRAMS; new_pid_idx++) {
-        if (pcb_flags[new_pid_idx] == 0) {
-            break;
-        }
+    // the slot decides the frame, so a slot with an already zeroed frame wins
+    spin_lock_irqsave(&pcb_lock, flags);
+    uint32_t new_pid_idx = page_pool_pick();
+    if (new_pid_idx < MAX_NUM_PROGRAMS) {
+        pcb_flags[new_pid_idx] = 1; // enable PCB block
     }
+    spin_unlock_irqrestore(&pcb_lock, flags);
 
     if (new_pid_idx >= MAX_NUM_PROGRAMS) {
         return -1;
@@ -66,7 +72,6 @@ int32_t execute (const uint8_t* command) {
 
     /////////////// POINT OF NO RETURN ///////////////
     /* Set up PCB */
-    pcb_flags[new_pid_idx] = 1; // enable PCB block
     pcb_t * new_pcb = (pcb_t *)(EIGHT_MB - (new_pid_idx + 1) * EIGHT_KB); // puts PCB pointer at bottom of kernel memory
 
     // Set commands
@@ -77,6 +82,12 @@ int32_t execute (const uint8_t* command) {
 
     new_pcb->pid = new_pid_idx;
     new_pcb->child_pid = -1;  
+    strncpy((int8_t *) new_pcb->name, (const int8_t *) filename, PROC_NAME_SIZE - 1);
+    new_pcb->name[PROC_NAME_SIZE - 1] = '\0';
+    new_pcb->prof_prog = profile_prog_index(new_pcb->name);
+    memset(&new_pcb->acct, 0, sizeof(proc_acct_t));
+    rwlock_init(&new_pcb->fd_lock, "fd table");
+    new_pcb->fpu_used = 0;
 
     // setup ops table
     new_pcb->file_desc_arr[0].ops_ptr = stdin_ops_table;
@@ -91,9 +102,11 @@ int32_t execute (const uint8_t* command) {
 
     /* Set up 4MB page for user program */
     setup_user_page(((new_pid_idx * FOUR_MB) + EIGHT_MB) / FOUR_KB);
+    uint32_t image_length = ((inode_t *) (inode_ptr + exec_dentry.inode_num))->length;
+    page_pool_take(new_pid_idx, PROGRAM_START - USER_MEM_VIRTUAL_ADDR, PROGRAM_START - USER_MEM_VIRTUAL_ADDR + image_length);
 
     /* Copy to user memory */
-    read_data(exec_dentry.inode_num, 0, (uint8_t *) PROGRAM_START, ((inode_t *) (inode_ptr + exec_dentry.inode_num))->length);
+    read_data(exec_dentry.inode_num, 0, (uint8_t *) PROGRAM_START, image_length);
     
     /* Save regs needed for PCB */
     // Read bytes 24 - 27 to get eip
@@ -101,8 +114,7 @@ int32_t execute (const uint8_t* command) {
     read_data(exec_dentry.inode_num, EIP_START, eip_ptr, sizeof(uint32_t));
 
     /* Set up TSS */ // TSS - contains process state information of the parent task to restore it
-    tss.ss0 = (uint16_t) KERNEL_DS;
-    tss.esp0 = (uint32_t) new_pcb + EIGHT_KB - STACK_FENCE_SIZE; // offset of kernel stack segment
+    set_kernel_stack((uint32_t) new_pcb + EIGHT_KB - STACK_FENCE_SIZE); // offset of kernel stack segment
     
     uint32_t user_eip = *((uint32_t *) eip_ptr);
     uint32_t user_esp = PROGRAM_START - STACK_FENCE_SIZE;
@@ -136,7 +148,6 @@ int32_t execute (const uint8_t* command) {
         new_terminal_flag = 0; // reset flag
         set_terminal_arr(new_pid_idx, new_pid_idx);
         terminal_switch(new_pid_idx);
-        send_eoi(0);
     } else {
         new_pcb->parent_pid = get_curr_pcb_ptr()->pid; // point to parent PCB pointer
         get_curr_pcb_ptr()->child_pid = new_pid_idx;
@@ -154,6 +165,11 @@ int32_t execute (const uint8_t* command) {
         : "memory"
     );
 
+    // the parent's kernel time stops here, the child's user time starts
+    acct_exit_kernel();
+    new_pcb->acct.stamp = rdtsc();
+    fpu_switch(new_pcb);
+
     // set up iret context and jump process
     asm volatile ("\
         andl $0x00FF, %%eax     ;\
@@ -201,7 +217,7 @@ int32_t execute (const uint8_t* command) {
  */
 int32_t halt (uint8_t status) {
     // When closing, do I need to check if current PCB has any child PCBs?
-    // cli();
+    uint32_t flags;
     pcb_t * pcb = get_curr_pcb_ptr();
     /* push user context if its base shell since we have no processes left */
     // TODO: change this when dynamically loading shells
@@ -210,7 +226,10 @@ int32_t halt (uint8_t status) {
         // recover context from halt(esp, eip, USER_CS, USER_DS);
         // 0x00FF - clears the bottom 8 bytes of the return value
         // 0x0200 - turns on bit of EFLAGS
-        // sti();
+        acct_exit_kernel();
+        // the shell starts over, so does its FPU state
+        fpu_release(pcb);
+        fpu_switch(pcb);
         asm volatile ("\
             andl $0x00FF, %%eax     ;\
             movw %%ax, %%ds         ;\
@@ -241,26 +260,34 @@ int32_t halt (uint8_t status) {
     }
 
     // release FD array for this pcb
+    write_lock_irqsave(&pcb->fd_lock, flags);
     for (i = 0; i < MAX_FILE_DESC; i++) {
         if (pcb->file_desc_arr[i].flags) {
-            pcb->file_desc_arr->ops_ptr.close(i);
+            pcb->file_desc_arr[i].ops_ptr.close(i);
         }
 
         pcb->file_desc_arr[i].flags = 0;
     }
+    write_unlock_irqrestore(&pcb->fd_lock, flags);
 
 
     /* remove current pcb from present flags */
+    fpu_release(pcb);
+    spin_lock_irqsave(&pcb_lock, flags);
+    page_pool_release(pcb->pid);
     pcb_flags[pcb->pid] = 0;
+    spin_unlock_irqrestore(&pcb_lock, flags);
     pcb->pid = -1;
     pcb->parent_pid = -1;
     
     /* Set TSS again */
-    tss.ss0 = (uint16_t) KERNEL_DS; // segment selector for kernel data segment
-    tss.esp0 = (uint32_t) parent_pcb + EIGHT_KB - STACK_FENCE_SIZE;; 
+    set_kernel_stack((uint32_t) parent_pcb + EIGHT_KB - STACK_FENCE_SIZE);
     
     /* Restore parent paging and flush tlb to update paging structure */
     setup_user_page(((parent_pcb->pid  * FOUR_MB) + EIGHT_MB) / FOUR_KB);
+    /* The parent picks its execute back up from now */
+    parent_pcb->acct.stamp = rdtsc();
+    fpu_switch(parent_pcb);
     /* Save process context (ebp, esp) then return to execute the next process */
     asm volatile ("\
         movl %%ebx, %%ebp      ;\
@@ -286,14 +313,43 @@ int32_t halt (uint8_t status) {
 */
 int32_t open (const uint8_t* filename) {
     dentry_t file_dentry;
-    uint32_t fd;
+    template_ops_table_t ops;
+    uint32_t fd, flags;
+    int32_t inode, is_trace;
     
     // ensure the filename is valid
     if (filename == NULL || strlen((const int8_t *) filename) > 32) {
         return -1;
     }
 
+    // devices with no file in the image are matched by name first
+    is_trace = strncmp((const int8_t *) filename, (const int8_t *) TRACE_DEVICE_NAME, FILENAME_SIZE) == 0;
+    if (is_trace) {
+        ops = tracebuf_ops_table;
+        inode = 0;      // CPU whose ring trace_read hands out next
+    } else {
+        /* The dentry is populated by the filesystem function read_dentry_by_name */
+        if (read_dentry_by_name (filename, &file_dentry) == -1) { 
+            return -1; //file doesn't exist
+        }
+        switch (file_dentry.file_type) {
+            case 0: // rtc driver
+                ops = rtc_ops_table;
+                break;
+            case 1: // dir
+                ops = dir_ops_table;
+                break;
+            case 2: // file
+                ops = file_ops_table;
+                break;
+            default:
+                return -1;
+        }
+        inode = file_dentry.inode_num;
+    }
+
     pcb_t * pcb = get_curr_pcb_ptr();
+    write_lock_irqsave(&pcb->fd_lock, flags);
     // ensure the file desc has space AND find the index to emplace this file
     for (fd = 2; fd < MAX_FILE_DESC; fd++) {
         // is the index empty?
@@ -304,40 +360,17 @@ int32_t open (const uint8_t* filename) {
 
     // Ensure there was space left
     if (fd >= MAX_FILE_DESC) {
+        write_unlock_irqrestore(&pcb->fd_lock, flags);
         return -1;
     }
 
-    /* The filename exists, the file_descriptor has space, and the dentry has been populated
-       by the filesystem function read_dentry_by_name */
-    /* So set all of the fields */
-    if (read_dentry_by_name (filename, &file_dentry) == -1) { 
-        return -1; //file doesn't exist
-    }
-
-    int32_t status;
-    switch (file_dentry.file_type) {
-        case 0: // rtc driver
-            status = rtc_open(filename);
-            if (fd < 0) return -1;
-            pcb->file_desc_arr[fd].ops_ptr = rtc_ops_table;
-            break;
-        case 1: // dir
-            status = dir_open(filename);
-            if (fd < 0) return -1;
-            pcb->file_desc_arr[fd].ops_ptr = dir_ops_table;
-            break;
-        case 2: // file
-            status = file_open(filename);
-            if (fd < 0) return -1;
-            pcb->file_desc_arr[fd].ops_ptr = file_ops_table;
-            break;
-        default:
-            return -1;
-    }
-
+    /* The filename exists and the file_descriptor has space, so set all of the fields */
+    ops.open(filename);
+    pcb->file_desc_arr[fd].ops_ptr = ops;
     pcb->file_desc_arr[fd].flags = 1;
-    pcb->file_desc_arr[fd].inode = file_dentry.inode_num;
+    pcb->file_desc_arr[fd].inode = inode;
     pcb->file_desc_arr[fd].file_pos = 0;
+    write_unlock_irqrestore(&pcb->fd_lock, flags);
     return fd;
 }
 
@@ -350,10 +383,16 @@ int32_t open (const uint8_t* filename) {
 *   SIDE EFFECTS: modifies file descriptor array in pcb
 */
 int32_t close (uint32_t fd) {
+    uint32_t flags;
+    int32_t ret = -1;
     if (fd >= MAX_FILE_DESC) return -1; // Checks if fd is 0 or 1
     pcb_t * pcb = get_curr_pcb_ptr();
-    if (!pcb->file_desc_arr[fd].flags) return -1; // Checks if fd is inactive
-    return pcb->file_desc_arr[fd].ops_ptr.close(fd);
+    write_lock_irqsave(&pcb->fd_lock, flags);
+    if (pcb->file_desc_arr[fd].flags) { // Checks if fd is inactive
+        ret = pcb->file_desc_arr[fd].ops_ptr.close(fd);
+    }
+    write_unlock_irqrestore(&pcb->fd_lock, flags);
+    return ret;
 }
 
 /* 
@@ -367,14 +406,19 @@ int32_t close (uint32_t fd) {
 *   SIDE EFFECTS: none
 */
 int32_t read (uint32_t fd, void* buf, uint32_t nbytes) {
+    int32_t (*read_op) (int32_t fd, void* buf, int32_t nbytes) = NULL;
+    uint32_t flags;
     if (fd >= MAX_FILE_DESC) return -1; // Checks if fd is 0 or 1
     pcb_t * pcb = get_curr_pcb_ptr();
-    if (!pcb->file_desc_arr[fd].flags) return -1; // Checks if fd is inactive
-    // file_desc_t file_desc = pcb->file_desc_arr[fd];
-    // inode_t * curr_inode = inode_ptr + file_desc.inode;
-
-    // if (file_desc.file_pos >= curr_inode->length) return 0;
-    return pcb->file_desc_arr[fd].ops_ptr.read(fd, buf, nbytes);
+    // reads can block, so only the lookup is done under the lock
+    read_lock_irqsave(&pcb->fd_lock, flags);
+    if (pcb->file_desc_arr[fd].flags) read_op = pcb->file_desc_arr[fd].ops_ptr.read;
+    read_unlock_irqrestore(&pcb->fd_lock, flags);
+    if (read_op == NULL) return -1; // Checks if fd is inactive
+
+    int32_t ret = read_op(fd, buf, nbytes);
+    if (ret > 0) pcb->acct.bytes_read += ret;
+    return ret;
 }
 
 /* 
@@ -388,10 +432,18 @@ int32_t read (uint32_t fd, void* buf, uint32_t nbytes) {
 *   SIDE EFFECTS: none
 */
 int32_t write (uint32_t fd, const void* buf, uint32_t nbytes) {
+    int32_t (*write_op) (int32_t fd, const void* buf, int32_t nbytes) = NULL;
+    uint32_t flags;
     if (fd >= MAX_FILE_DESC) return -1; // Checks if fd is 0 or 1
     pcb_t * pcb = get_curr_pcb_ptr();
-    if (!pcb->file_desc_arr[fd].flags) return -1; // Checks if fd is inactive
-    return pcb->file_desc_arr[fd].ops_ptr.write(fd, buf, nbytes);
+    read_lock_irqsave(&pcb->fd_lock, flags);
+    if (pcb->file_desc_arr[fd].flags) write_op = pcb->file_desc_arr[fd].ops_ptr.write;
+    read_unlock_irqrestore(&pcb->fd_lock, flags);
+    if (write_op == NULL) return -1; // Checks if fd is inactive
+
+    int32_t ret = write_op(fd, buf, nbytes);
+    if (ret > 0) pcb->acct.bytes_written += ret;
+    return ret;
 }
 
 /*
@@ -443,6 +495,104 @@ int32_t vidmap (uint8_t** screen_start) {
     return 0;
 }
 
+/*
+* getstats
+*   DESCRIPTION: Copies out system wide counters followed by one record per
+*                live process, as many as fit in the buffer
+*   INPUTS: buf - user buffer, starts with a stats_header_t
+*           nbytes - size of buf
+*   OUTPUTS: none
+*   RETURN VALUE: bytes written on success, -1 on failure
+*   SIDE EFFECTS: none
+*/
+int32_t getstats (void* buf, uint32_t nbytes) {
+    stats_header_t * header = (stats_header_t *) buf;
+    proc_stats_t * rec = (proc_stats_t *) (header + 1);
+    uint32_t room, written = 0;
+    uint64_t tsc = rdtsc();
+    page_pool_stats_t pool;
+    pcb_t * pcb;
+    pcb_t * root;
+    int32_t pid, t;
+
+    if (buf == NULL || nbytes < sizeof(stats_header_t) || nbytes > FOUR_MB) return -1;
+    if ((uint32_t) buf < USER_MEM_VIRTUAL_ADDR || (uint32_t) buf + nbytes > USER_MEM_VIRTUAL_ADDR + FOUR_MB) return -1;
+
+    room = (nbytes - sizeof(stats_header_t)) / sizeof(proc_stats_t);
+    header->ticks = get_pit_ticks();
+    header->tsc_lo = (uint32_t) tsc;
+    header->tsc_hi = (uint32_t) (tsc >> 32);
+    header->nprocs = 0;
+    get_page_pool_stats(&pool);
+    header->pool_hits = pool.hits;
+    header->pool_misses = pool.misses;
+    header->pool_zeroed = pool.frames_zeroed;
+    div64_32(&pool.saved_cycles, 1000000);
+    header->pool_saved_mcycles = (uint32_t) pool.saved_cycles;
+
+    for (pid = 0; pid < MAX_NUM_PROGRAMS; pid++) {
+        if (pcb_flags[pid] == 0) continue;
+        header->nprocs++;
+        if (written == room) continue;
+
+        pcb = get_pcb_ptr(pid);
+        // the terminal is the one whose base shell this process descends from
+        for (root = pcb; root->parent_pid != -1; root = get_pcb_ptr(root->parent_pid));
+        rec->terminal = -1;
+        for (t = 0; t < 3; t++) {
+            if (get_terminal_arr(t) == root->pid) rec->terminal = t;
+        }
+
+        rec->pid = pid;
+        rec->parent_pid = pcb->parent_pid;
+        memcpy(rec->name, pcb->name, PROC_NAME_SIZE);
+        rec->user_cycles = pcb->acct.user_cycles;
+        rec->kernel_cycles = pcb->acct.kernel_cycles;
+        rec->switches = pcb->acct.switches;
+        rec->page_faults = pcb->acct.page_faults;
+        rec->bytes_read = pcb->acct.bytes_read;
+        rec->bytes_written = pcb->acct.bytes_written;
+        memcpy(rec->syscalls, pcb->acct.syscalls, sizeof(rec->syscalls));
+        rec++;
+        written++;
+    }
+
+    return sizeof(stats_header_t) + written * sizeof(proc_stats_t);
+}
+
+/*
+* syscall_enter
+*   DESCRIPTION: Called by system_call_handler before dispatching, charges the
+*                time since the last stamp as user time and counts the call
+*   INPUTS: nr - system call number
+*           arg - first argument (ebx)
+*   OUTPUTS: none
+*   RETURN VALUE: none
+*   SIDE EFFECTS: updates the caller's accounting, records a trace event
+*/
+void syscall_enter (uint32_t nr, uint32_t arg) {
+    pcb_t * pcb = get_acct_pcb();
+
+    acct_enter_kernel();
+    if (pcb != NULL && nr < NUM_SYSCALL_SLOTS)
+        pcb->acct.syscalls[nr]++;
+    TRACE(TRACE_SYSCALL_ENTER, nr, arg);
+}
+
+/*
+* syscall_exit
+*   DESCRIPTION: Called by system_call_handler on the way back to user space
+*   INPUTS: nr - system call number
+*           ret - value being returned
+*   OUTPUTS: none
+*   RETURN VALUE: none
+*   SIDE EFFECTS: charges kernel time, records a trace event
+*/
+void syscall_exit (uint32_t nr, uint32_t ret) {
+    TRACE(TRACE_SYSCALL_EXIT, nr, ret);
+    acct_exit_kernel();
+}
+
 /*
 * set_handler
 *   DESCRIPTION: Sets the handler for the given signal
@@ -20,8 +20,40 @@
 
 #define EXCEPTION_OCCURRED_VAL 256
 
+/* per-call counters are indexed by system call number */
+#define NUM_SYSCALL_SLOTS 16
+/* program names are file names */
+#define PROC_NAME_SIZE 32
+
 #ifndef ASM
 
+/* What getstats writes first */
+typedef struct stats_header_t {
+    uint32_t ticks;         // PIT ticks since boot
+    uint32_t tsc_lo;
+    uint32_t tsc_hi;
+    uint32_t nprocs;        // live processes, even ones that did not fit
+    uint32_t pool_hits;     // executes that found a zeroed frame
+    uint32_t pool_misses;   // executes that zeroed their own
+    uint32_t pool_zeroed;   // frames zeroed while idle
+    uint32_t pool_saved_mcycles;
+} stats_header_t;
+
+/* One per live process after the header */
+typedef struct proc_stats_t {
+    int32_t pid;
+    int32_t parent_pid;
+    int32_t terminal;
+    uint8_t name[PROC_NAME_SIZE];
+    uint64_t user_cycles;
+    uint64_t kernel_cycles;
+    uint32_t switches;
+    uint32_t page_faults;
+    uint32_t bytes_read;
+    uint32_t bytes_written;
+    uint32_t syscalls[NUM_SYSCALL_SLOTS];
+} proc_stats_t;
+
 extern void system_call_handler();
 
 /* file operation functions */
@@ -35,6 +67,12 @@ int32_t write (uint32_t fd, const void* buf, uint32_t nbytes);
 
 int32_t getargs (uint8_t* buf, uint32_t nbytes);
 int32_t vidmap (uint8_t** screen_start);
+int32_t getstats (void* buf, uint32_t nbytes);
+int32_t profile (uint32_t cmd, void* buf, uint32_t arg);
+
+/* accounting and tracing around every system call */
+void syscall_enter (uint32_t nr, uint32_t arg);
+void syscall_exit (uint32_t nr, uint32_t ret);
 
 /* BOTH OF THESE SYSTEM_CALLS ARE EXTRA CREDIT TO IMPLEMENT */
 int32_t set_handler (uint32_t signum, void* handler_address);
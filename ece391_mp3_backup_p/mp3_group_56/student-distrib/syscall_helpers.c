@@ -1,5 +1,8 @@
 #include "syscall_helpers.h"
 #include "paging.h"
+#include "smp.h"
+
+spinlock_t pcb_lock = SPINLOCK_INIT("pcb table");
 
 /* 
  * read_dentry_by_name
@@ -39,7 +42,7 @@ int32_t read_dentry_by_name (const uint8_t* fname, dentry_t* dentry) {
 int32_t read_dentry_by_index (uint32_t index, dentry_t* dentry) {
     // Open up a file and set up the file object
     // NOTE: index is the directory index
-    if (index >= boot_block_ptr->num_inodes) {
+    if (index >= boot_block_ptr->num_dirs) {
         return -1;
     }
     
@@ -70,30 +73,41 @@ int32_t read_data (uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t lengt
     }
 
     inode_t * curr_inode = inode_ptr + inode;
-    int curr_byte_idx;
-    int data_block_idx;
-    int within_data_block_idx;
-    for (curr_byte_idx = offset; curr_byte_idx < length + offset; curr_byte_idx++) {
-        // reached end of file
-        if (curr_byte_idx >= curr_inode->length) {
-            break;
+    uint32_t pos = offset;
+    uint32_t end = offset + length;
+    uint32_t within_data_block_idx, chunk;
+
+    // stop at the end of the file
+    if (end > curr_inode->length || end < offset) {
+        end = curr_inode->length;
+    }
+
+    // copy up to one data block at a time instead of byte by byte
+    while (pos < end) {
+        // a length past what an inode can map is a corrupt inode
+        if (pos / DATA_BLOCK_SIZE >= DATA_BLOCKS_PER_INODE) {
+            return -1;
         }
 
-        // Get indices for data block and within data block
-        data_block_idx = curr_byte_idx / DATA_BLOCK_SIZE;
-        within_data_block_idx = curr_byte_idx % DATA_BLOCK_SIZE;
-        uint32_t data_block_num = curr_inode->data_blocks[data_block_idx];
+        uint32_t data_block_num = curr_inode->data_blocks[pos / DATA_BLOCK_SIZE];
 
         // bad data block
         if (data_block_num >= boot_block_ptr->num_data_blocks) {
             return -1;
         }
 
+        within_data_block_idx = pos % DATA_BLOCK_SIZE;
+        chunk = DATA_BLOCK_SIZE - within_data_block_idx;
+        if (chunk > end - pos) {
+            chunk = end - pos;
+        }
+
         data_block_t * data_block = data_block_ptr + data_block_num;
-        buf[curr_byte_idx - offset] = data_block->data[within_data_block_idx];
+        memcpy(buf + (pos - offset), data_block->data + within_data_block_idx, chunk);
+        pos += chunk;
     }
 
-    return curr_byte_idx - offset;
+    return pos - offset;
 }
 
 /* 
@@ -131,15 +145,26 @@ pcb_t * get_pcb_ptr(int32_t pid) {
 }
 
 /* 
- * setup_new_dir
- *   DESCRIPTION: Sets up a new directory entry
+ * setup_user_page
+ *   DESCRIPTION: Points the 128MB user page at a process's 4MB frame, in
+ *                the calling CPU's page directory
  *   INPUTS: base_31_12 - table address
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: Sets up a new directory entry to use
+ *   SIDE EFFECTS: Sets up a new directory entry to use, invalidates only the
+ *                 user page and skips everything if it already points there
 */
 void setup_user_page(uint32_t base_31_12) {
     page_dir_desc_t new_page_dir;
+    page_dir_desc_t* user_pde = &this_cpu()->page_dir[USER_MEM_VIRTUAL_ADDR / FOUR_MB];
+
+    // same frame means the TLB is still right, e.g. a tick that picks the
+    // process that is already mapped
+    if (user_pde->p && user_pde->ps && user_pde->base_31_12 == base_31_12) {
+        tlb_note_skip();
+        return;
+    }
+
     new_page_dir.p = 1;
     new_page_dir.rw = 1;
     new_page_dir.us = 1; 
@@ -151,8 +176,8 @@ void setup_user_page(uint32_t base_31_12) {
     new_page_dir.g = 0; 
     new_page_dir.avail = 0;
     new_page_dir.base_31_12 = base_31_12;
-    page_dir[USER_MEM_VIRTUAL_ADDR / FOUR_MB] = new_page_dir;
-    flush_tlb();
+    *user_pde = new_page_dir;
+    tlb_invalidate(USER_MEM_VIRTUAL_ADDR);
 }
 
 /* 
@@ -182,11 +207,89 @@ pcb_t * get_child_pcb(int32_t terminal_num)  {
  *   SIDE EFFECTS: none
 */
 int is_pcb_available() {
-    int i;
+    uint32_t flags;
+    int i, ret = 0;
+    spin_lock_irqsave(&pcb_lock, flags);
     for(i = 0; i < MAX_NUM_PROGRAMS; i++) {
         if (pcb_flags[i] == 0) {
-            return 1;
+            ret = 1;
+            break;
         }
     }
-    return 0;
+    spin_unlock_irqrestore(&pcb_lock, flags);
+    return ret;
+}
+
+/* 
+ * get_acct_pcb
+ *   DESCRIPTION: Gets the pcb of the running process for accounting. Early boot
+ *                and the idle loop run on the kernel's own stack, where
+ *                get_curr_pcb_ptr would point into the kernel image.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: pcb pointer, NULL if no live process owns this stack
+ *   SIDE EFFECTS: none
+*/
+pcb_t * get_acct_pcb(void) {
+    pcb_t * pcb = get_curr_pcb_ptr();
+
+    if ((uint32_t) pcb < EIGHT_MB - MAX_NUM_PROGRAMS * EIGHT_KB || (uint32_t) pcb >= EIGHT_MB)
+        return NULL;
+    if (pcb->pid < 0 || pcb->pid >= MAX_NUM_PROGRAMS || pcb_flags[pcb->pid] == 0)
+        return NULL;
+    return pcb;
+}
+
+/* 
+ * acct_enter_kernel
+ *   DESCRIPTION: Charges the time since the last stamp as user time
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: restamps the current process
+*/
+void acct_enter_kernel(void) {
+    pcb_t * pcb = get_acct_pcb();
+    uint64_t now = rdtsc();
+
+    if (pcb == NULL) return;
+    pcb->acct.user_cycles += now - pcb->acct.stamp;
+    pcb->acct.stamp = now;
+}
+
+/* 
+ * acct_exit_kernel
+ *   DESCRIPTION: Charges the time since the last stamp as kernel time
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: restamps the current process
+*/
+void acct_exit_kernel(void) {
+    pcb_t * pcb = get_acct_pcb();
+    uint64_t now = rdtsc();
+
+    if (pcb == NULL) return;
+    pcb->acct.kernel_cycles += now - pcb->acct.stamp;
+    pcb->acct.stamp = now;
+}
+
+/* 
+ * acct_switch
+ *   DESCRIPTION: Charges the outgoing process's kernel time and counts the
+ *                switch, the incoming one starts a fresh kernel stretch
+ *   INPUTS: next_pcb - process being switched to
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: restamps both processes
+*/
+void acct_switch(pcb_t * next_pcb) {
+    pcb_t * pcb = get_acct_pcb();
+    uint64_t now = rdtsc();
+
+    if (pcb != NULL) {
+        pcb->acct.kernel_cycles += now - pcb->acct.stamp;
+        pcb->acct.switches++;
+    }
+    next_pcb->acct.stamp = now;
 }
@@ -4,10 +4,24 @@
 #include "types.h"
 #include "file_system_driver.h"
 #include "syscall.h"
+#include "spinlock.h"
+#include "fpu.h"
 
 #define PCB_BITMASK 0xFFFFE000
 #define MAX_NUM_PROGRAMS 6
 
+/* CPU accounting, the stamp is when the current user or kernel stretch began */
+typedef struct proc_acct_t {
+    uint64_t user_cycles;
+    uint64_t kernel_cycles;
+    uint64_t stamp;
+    uint32_t switches;
+    uint32_t page_faults;
+    uint32_t bytes_read;
+    uint32_t bytes_written;
+    uint32_t syscalls[NUM_SYSCALL_SLOTS];
+} proc_acct_t;
+
 typedef struct pcb {
     int32_t pid; 
     int32_t parent_pid;
@@ -20,9 +34,17 @@ typedef struct pcb {
     uint32_t user_eip;
     uint8_t commands[LINE_BUFFER_SIZE];
     file_desc_t file_desc_arr[MAX_FILE_DESC];
+    uint8_t name[PROC_NAME_SIZE];
+    proc_acct_t acct;
+    uint32_t prof_prog;     // profiler's index for name
+    rwlock_t fd_lock;       // file_desc_arr, written by open, close and halt
+    uint32_t fpu_used;      // fpu_state holds this process's registers
+    uint8_t fpu_state[FPU_STATE_SIZE] __attribute__((aligned(FPU_STATE_ALIGN)));
 } pcb_t;
 
 uint32_t pcb_flags[MAX_NUM_PROGRAMS];
+/* Held while a slot in pcb_flags is claimed or given back */
+extern spinlock_t pcb_lock;
 
 /* file system helper functions */
 int32_t read_dentry_by_name (const uint8_t* fname, dentry_t* dentry);
@@ -36,4 +58,10 @@ int is_pcb_available();
 
 void setup_user_page(uint32_t table_addr);
 
+/* accounting helpers, all no-ops when no process owns the current stack */
+pcb_t * get_acct_pcb(void);
+void acct_enter_kernel(void);
+void acct_exit_kernel(void);
+void acct_switch(pcb_t * next_pcb);
+
 #endif
@@ -1,16 +1,23 @@
 #include "terminal.h"
 #include "./devices/i8259.h"
+#include "page_pool.h"
+#include "spinlock.h"
 
 // Store buffer for each terminal (0 for first, 1 for second, etc.)
 static unsigned int buffer_idx[3] = {0,0,0};
 static uint8_t line_buffer[3][LINE_BUFFER_SIZE];
 static volatile int enter_flag_pressed[3] = {0,0,0};
 static unsigned int save_buffer_idx[3] = {0,0,0};
+// line buffers, shared by the keyboard bottom half and terminal_read
+static spinlock_t line_lock = SPINLOCK_INIT("terminal lines");
 int terminal_idx = 0; //active one
 int first_shell_started = 0; //flag for first shell
 int new_terminal_flag = 0; //flag for starting a new shell
 int32_t terminal_pids[3] = {-1, -1, -1}; //pid array for terminal shells
 
+static uint32_t last_switch_cycles = 0;
+static uint32_t max_switch_cycles = 0;
+
 int save_screen_x[3] = {7,0,0};
 int save_screen_y[3] = {1,0,0};
 
@@ -37,15 +44,15 @@ int get_buffer_fill()
  * Return Value: none
  * Function: addes the current char to the buffer */
 void write_to_terminal(unsigned char ascii) {
+    uint32_t flags;
     
-    if(buffer_idx[terminal_idx] == 128)
-        return;
-    else
+    spin_lock_irqsave(&line_lock, flags);
+    if(buffer_idx[terminal_idx] != 128)
     {
         line_buffer[terminal_idx][buffer_idx[terminal_idx]] = ascii; //add to line buff
         buffer_idx[terminal_idx]++;
     }
-           
+    spin_unlock_irqrestore(&line_lock, flags);
 }
 /* terminal_backspace
  * Inputs: none
@@ -53,9 +60,15 @@ void write_to_terminal(unsigned char ascii) {
  * Function: removes the last char in the buffer */
 void terminal_backspace()
 {
-    if(buffer_idx[terminal_idx]==0) return;
-    
+    uint32_t flags;
     int term = terminal_idx;
+
+    spin_lock_irqsave(&line_lock, flags);
+    if(buffer_idx[term]==0) {
+        spin_unlock_irqrestore(&line_lock, flags);
+        return;
+    }
+    
     backspace(term);
     if(line_buffer[term][buffer_idx[term]] == '\t') // add extra for tab
     {
@@ -65,7 +78,7 @@ void terminal_backspace()
     }
     line_buffer[term][buffer_idx[term]-1] = 0;
     buffer_idx[term]--;
-    
+    spin_unlock_irqrestore(&line_lock, flags);
 }
 
 /* terminal clear
@@ -73,11 +86,14 @@ void terminal_backspace()
  * Return Value: none
  * Function: resets buffer_idx */
 void terminal_clear() {
+    uint32_t flags;
     int i;
+    spin_lock_irqsave(&line_lock, flags);
     for (i = 0; i < LINE_BUFFER_SIZE; i++) {
         line_buffer[terminal_idx][i] = '\0';
     }
     buffer_idx[terminal_idx] = 0;
+    spin_unlock_irqrestore(&line_lock, flags);
 }
 
 /* is_started
@@ -96,9 +112,12 @@ int is_started()
  * Function: saves buffer idx for terminal_read and resets it, sets flag to allow read */
 void terminal_enter()
 {
+    uint32_t flags;
+    spin_lock_irqsave(&line_lock, flags);
     enter_flag_pressed[terminal_idx] = 1;
     save_buffer_idx[terminal_idx] = buffer_idx[terminal_idx];
     buffer_idx[terminal_idx] = 0;
+    spin_unlock_irqrestore(&line_lock, flags);
 }
 
 /* 
@@ -123,26 +142,24 @@ int32_t terminal_close(int32_t fd) {
  * Return Value: number of bytes read, -1 for fail
  * Function: waits until enter is pressed then writes all bytes in buffer(including new ling) to input buf */
 int32_t terminal_read(int32_t fd, void * buf, int32_t nbytes) {
+    uint32_t flags;
     first_shell_started = 1;
     int term = terminal_idx;
-    while (get_schedule_idx() != terminal_idx || enter_flag_pressed[terminal_idx] != 1){}; //wait for enter
+    // spare time goes to zeroing free user frames
+    while (get_schedule_idx() != terminal_idx || enter_flag_pressed[terminal_idx] != 1)
+        page_pool_idle(); //wait for enter
     
+    // keys typed from here on go into the same buffer, copy the line out first
+    spin_lock_irqsave(&line_lock, flags);
     line_buffer[term][save_buffer_idx[term]] = '\n'; 
     save_buffer_idx[term]++;
     enter_flag_pressed[term] = 0;
     
     //memcpy to buf
-    if (nbytes < save_buffer_idx[term]) { 
-        memcpy(buf, (const void *) line_buffer[term], nbytes);
-        return nbytes;
-    }
-    else
-    {
-        memcpy(buf, (const void *) line_buffer[term], save_buffer_idx[term]);
-        return save_buffer_idx[term];
-    }
-    
-    return -1;
+    if (nbytes > save_buffer_idx[term]) nbytes = save_buffer_idx[term];
+    memcpy(buf, (const void *) line_buffer[term], nbytes);
+    spin_unlock_irqrestore(&line_lock, flags);
+    return nbytes;
 }
 
 /* terminal_write
@@ -150,7 +167,6 @@ int32_t terminal_read(int32_t fd, void * buf, int32_t nbytes) {
  * Return Value: num bytes wrote
  * Function: prints the chars in input buf to screen */
 int32_t terminal_write(int32_t fd, const void * buf, int32_t nbytes) {
-    int i;
     int term;
     if(!is_terminals_initialized()) //check for startup, before normal scheduling
     {
@@ -161,18 +177,8 @@ int32_t terminal_write(int32_t fd, const void * buf, int32_t nbytes) {
         term = get_schedule_idx();
     }
     
-    for (i = 0; i < nbytes; i++) {
-        if(((char*)buf)[i] == '\t') // add extra for tab
-        {
-            putc_terminal(' ', term);
-            putc_terminal(' ', term);
-            putc_terminal(' ', term);
-            putc_terminal(' ', term);
-        }
-        else
-            putc_terminal(((char*)buf)[i], term);
-    }
-    return nbytes;
+    // whole buffer goes out at once so a burst of newlines only scrolls once
+    return puts_terminal((const int8_t *) buf, nbytes, term);
     
 }
 
@@ -215,43 +221,47 @@ void set_saved_screen_y(int term, int y)
 /* terminal_switch
  * Inputs: t_idx
  * Return Value: none
- * Function: copies and swaps video mem for next process*/
+ * Function: puts another terminal on screen. All three pages stay mapped where
+ *           they are, so this is just a VGA start address write. */
 void terminal_switch (int t_idx)
 {
     if(t_idx > 2 || t_idx < 0 || new_terminal_flag == 1) return;
-    int old_vmem_addr = VIDEO / FOUR_KB + 1 + terminal_idx;
-    int new_vmem_addr = VIDEO / FOUR_KB + 1 + t_idx;
+    uint64_t start = rdtsc();
 
-    video_memory_page_table[old_vmem_addr].base_31_12 = old_vmem_addr; // unlink page
-    flush_tlb();
-    memcpy((void *) (old_vmem_addr * FOUR_KB), (void *) VIDEO, 4000); // copy current to storage
-    
     terminal_idx = t_idx;
+    show_terminal(terminal_idx);
 
-    memcpy((void *) VIDEO, (void *) (new_vmem_addr * FOUR_KB), 4000);
-    video_memory_page_table[new_vmem_addr].base_31_12 = VIDEO / FOUR_KB;
-    flush_tlb();
-    
-    set_vid_mem(terminal_idx); // update cursor this function is stupid
+    last_switch_cycles = (uint32_t) (rdtsc() - start);
+    if (last_switch_cycles > max_switch_cycles)
+        max_switch_cycles = last_switch_cycles;
+}
+
+/* get_switch_cycles
+ * Inputs: max = nonzero for the slowest switch seen, 0 for the last one
+ * Return Value: cycles spent in terminal_switch
+ * Function: for measuring switch latency */
+uint32_t get_switch_cycles(int max)
+{
+    return max ? max_switch_cycles : last_switch_cycles;
 }
 
 /* init_terminals_vidmaps
  * Inputs: NA
  * Return Value: none
- * Function: sets up user vidmap pages*/
+ * Function: sets up the terminal video pages and puts terminal 0 on screen */
 void init_terminals_vidmaps()
 {
-    // 8kb to 20kb is terminal vmem
-    video_memory_page_table[1 + (VIDEO / FOUR_KB)].p = 1; 
-    video_memory_page_table[1 + (VIDEO / FOUR_KB)].us = 1;
-    video_memory_page_table[1 + (VIDEO / FOUR_KB)].base_31_12 = VIDEO / FOUR_KB; 
-    video_memory_page_table[2 + (VIDEO / FOUR_KB)].p = 1; 
-    video_memory_page_table[2 + (VIDEO / FOUR_KB)].us = 1;
-    video_memory_page_table[2 + (VIDEO / FOUR_KB)].base_31_12 = 2 + (VIDEO / FOUR_KB);
-    video_memory_page_table[3 + (VIDEO / FOUR_KB)].p = 1; 
-    video_memory_page_table[3 + (VIDEO / FOUR_KB)].us = 1;
-    video_memory_page_table[3 + (VIDEO / FOUR_KB)].base_31_12 = 3 + (VIDEO / FOUR_KB);
-    flush_tlb();
+    int i;
+
+    // 0xB9000 to 0xBC000 is terminal vmem, inside the VGA text window so the
+    // pages are identity mapped and never move
+    for (i = 1; i <= 3; i++) {
+        video_memory_page_table[i + (VIDEO / FOUR_KB)].p = 1; 
+        video_memory_page_table[i + (VIDEO / FOUR_KB)].us = 1;
+        video_memory_page_table[i + (VIDEO / FOUR_KB)].base_31_12 = i + (VIDEO / FOUR_KB);
+        tlb_invalidate(VIDEO + i * FOUR_KB);
+    }
+    show_terminal(terminal_idx);
 }
 
 /* get_terminal_arr
@@ -22,6 +22,8 @@ void terminal_backspace();
 void terminal_enter();
 /* fnc to swap terminals */
 void terminal_switch(int t_idx);
+/* cycles taken by the last (or slowest) terminal switch */
+uint32_t get_switch_cycles(int max);
 /* init pages to hold vid data for 3 terms */
 void init_terminals_vidmaps();
 /* returns the pid of the input terminal index */
@@ -5,6 +5,12 @@
 #include "devices/rtc.h"
 #include "terminal.h"
 #include "syscall.h"
+#include "syscall_helpers.h"
+#include "paging.h"
+#include "irq.h"
+#include "page_pool.h"
+#include "spinlock.h"
+#include "fpu.h"
 
 #define PASS 1
 #define FAIL 0
@@ -481,6 +487,275 @@ int stdout(char* buf)
 /* Checkpoint 4 tests */
 /* Checkpoint 5 tests */
 
+/* Performance tests */
+/*
+ *   test_scroll_throughput
+ *   DESCRIPTION: Prints SCROLL_TEST_LINES lines through terminal_write, first one
+ *                line per write (like cat of short lines) then as one large write
+ *                (like cat of a big file), and reports cycles per line for each
+ *   INPUTS: none
+ *   OUTPUTS: cycle counts for both cases
+ *   RETURN VALUE: PASS
+ *   SIDE EFFECTS: scrolls the active terminal
+ */
+int test_scroll_throughput() {
+	TEST_HEADER;
+	static const int8_t line[] = "scroll test 0123\n";
+	static int8_t big_buf[SCROLL_TEST_LINES * (sizeof(line) - 1)];
+	const uint32_t len = sizeof(line) - 1;
+	uint32_t single_cycles, batch_cycles;
+	uint64_t start;
+	int i;
+
+	start = rdtsc();
+	for (i = 0; i < SCROLL_TEST_LINES; i++) {
+		terminal_write(1, line, len);
+	}
+	single_cycles = (uint32_t) (rdtsc() - start);
+
+	for (i = 0; i < SCROLL_TEST_LINES; i++) {
+		memcpy(&big_buf[i * len], line, len);
+	}
+	start = rdtsc();
+	terminal_write(1, big_buf, sizeof(big_buf));
+	batch_cycles = (uint32_t) (rdtsc() - start);
+
+	printf("line writes: %u cycles/line\n", single_cycles / SCROLL_TEST_LINES);
+	printf("batched write: %u cycles/line\n", batch_cycles / SCROLL_TEST_LINES);
+	return PASS;
+}
+
+/*
+ *   test_scrollback
+ *   DESCRIPTION: Fills the active terminal with numbered lines, pages back one
+ *                SCROLLBACK_STEP and checks that video memory shows the older
+ *                line, then returns to the live screen
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: PASS/FAIL
+ *   SIDE EFFECTS: writes to and scrolls the active terminal
+ */
+int test_scrollback() {
+	TEST_HEADER;
+	int8_t line[] = "line 00\n";
+	int term = get_terminal_idx();
+	uint8_t* vmem = (uint8_t *)(VIDEO + FOUR_KB * (term+1));
+	int result = PASS;
+	int i;
+
+	for (i = 0; i < 100; i++) {
+		line[5] = '0' + (i / 10);
+		line[6] = '0' + (i % 10);
+		terminal_write(1, line, 8);
+	}
+	// the live screen ends with line 99 on row 23, so row 0 holds line 76
+	scroll_terminal_history(term, SCROLLBACK_STEP);
+	if (vmem[5 * 2] != '6' || vmem[6 * 2] != '4')
+		result = FAIL;
+	scroll_terminal_history(term, -SCROLLBACK_STEP);
+	if (vmem[5 * 2] != '7' || vmem[6 * 2] != '6')
+		result = FAIL;
+	return result;
+}
+
+/*
+ *   test_switch_latency
+ *   DESCRIPTION: Switches to every terminal and back, then reports the cycles
+ *                the last and slowest terminal_switch took
+ *   INPUTS: none
+ *   OUTPUTS: cycle counts
+ *   RETURN VALUE: PASS/FAIL
+ *   SIDE EFFECTS: flips through the terminals on screen
+ */
+int test_switch_latency() {
+	TEST_HEADER;
+	int term = get_terminal_idx();
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		terminal_switch(i);
+		if (get_terminal_idx() != i)
+			return FAIL;
+	}
+	terminal_switch(term);
+
+	printf("last switch: %u cycles, slowest: %u cycles\n", get_switch_cycles(0), get_switch_cycles(1));
+	return PASS;
+}
+
+/*
+ *   test_user_page_switch
+ *   DESCRIPTION: Flips the user page between two process frames the way the
+ *                scheduler does, touching user memory after each flip so the
+ *                TLB miss is part of the cost, and reports cycles per switch
+ *                along with the TLB counters
+ *   INPUTS: none
+ *   OUTPUTS: cycles per switch and TLB counters
+ *   RETURN VALUE: PASS/FAIL
+ *   SIDE EFFECTS: leaves the user page pointing at pid 0's frame
+ */
+int test_user_page_switch() {
+	TEST_HEADER;
+	volatile uint8_t* user_mem = (volatile uint8_t *) USER_MEM_VIRTUAL_ADDR;
+	tlb_stats_t before, after;
+	uint32_t cycles;
+	uint64_t start;
+	int i;
+
+	get_tlb_stats(&before);
+	start = rdtsc();
+	for (i = 0; i < USER_PAGE_TEST_SWITCHES; i++) {
+		setup_user_page((EIGHT_MB + (i & 1) * FOUR_MB) / FOUR_KB);
+		(void) *user_mem;
+	}
+	setup_user_page(EIGHT_MB / FOUR_KB);
+	cycles = (uint32_t) (rdtsc() - start);
+	get_tlb_stats(&after);
+
+	printf("user page switch: %u cycles\n", cycles / USER_PAGE_TEST_SWITCHES);
+	printf("flushes %u, invlpg %u, skipped %u\n", after.full_flushes - before.full_flushes,
+		after.invalidations - before.invalidations, after.skipped - before.skipped);
+	return (after.full_flushes == before.full_flushes) ? PASS : FAIL;
+}
+
+/*
+ *   test_irq_stats
+ *   DESCRIPTION: Waits for the RTC to tick a few times, then prints the count,
+ *                worst top half and non-empty latency buckets for the PIT,
+ *                keyboard and RTC lines
+ *   INPUTS: none
+ *   OUTPUTS: per-IRQ counters
+ *   RETURN VALUE: PASS/FAIL
+ *   SIDE EFFECTS: none
+ */
+int test_irq_stats() {
+	TEST_HEADER;
+	uint32_t lines[3] = {0, 1, 8};
+	irq_stats_t stats;
+	uint32_t start_count;
+	int i, j;
+
+	get_irq_stats(8, &stats);
+	start_count = stats.count;
+	while (stats.count < start_count + 16)
+		get_irq_stats(8, &stats);
+
+	for (i = 0; i < 3; i++) {
+		if (get_irq_stats(lines[i], &stats) != 0)
+			return FAIL;
+		printf("irq %u: %u ints, max %u cycles\n", lines[i], stats.count, stats.max_cycles);
+		for (j = 0; j < IRQ_LAT_BUCKETS; j++) {
+			if (stats.hist[j] != 0)
+				printf("  >= 2^%d: %u\n", j, stats.hist[j]);
+		}
+	}
+	return (get_irq_stats(NUM_IRQS, &stats) == -1) ? PASS : FAIL;
+}
+
+/*
+ *   test_page_pool
+ *   DESCRIPTION: Runs the idle zeroer until one frame is clean, then checks
+ *                that page_pool_pick prefers it and that it reads back as zero
+ *   INPUTS: none
+ *   OUTPUTS: cycles per frame and the pool counters
+ *   RETURN VALUE: PASS/FAIL
+ *   SIDE EFFECTS: zeroes free user frames, leaves the user page on the picked frame
+ */
+int test_page_pool() {
+	TEST_HEADER;
+	volatile uint32_t* user_mem = (volatile uint32_t *) USER_MEM_VIRTUAL_ADDR;
+	page_pool_stats_t before, after;
+	uint32_t frame, i;
+
+	get_page_pool_stats(&before);
+	after = before;
+	for (i = 0; i < MAX_NUM_PROGRAMS * (FOUR_MB / PAGE_POOL_CHUNK); i++) {
+		page_pool_idle();
+		get_page_pool_stats(&after);
+		if (after.frames_zeroed != before.frames_zeroed) break;
+	}
+	if (after.frames_zeroed == before.frames_zeroed) return FAIL;
+
+	frame = page_pool_pick();
+	if (frame >= MAX_NUM_PROGRAMS) return FAIL;
+	setup_user_page((EIGHT_MB + frame * FOUR_MB) / FOUR_KB);
+	printf("frame %u: %u cycles per chunk, hits %u misses %u\n", frame,
+		(uint32_t) (after.idle_cycles - before.idle_cycles) / (after.idle_chunks - before.idle_chunks),
+		after.hits, after.misses);
+	for (i = 0; i < FOUR_MB / sizeof(uint32_t); i += FOUR_KB / sizeof(uint32_t)) {
+		if (user_mem[i] != 0) return FAIL;
+	}
+	return (user_mem[FOUR_MB / sizeof(uint32_t) - 1] == 0) ? PASS : FAIL;
+}
+
+/*
+ *   test_lock_stats
+ *   DESCRIPTION: Times an uncontended irqsave lock and unlock, then prints the
+ *                counters of every lock taken so far
+ *   INPUTS: none
+ *   OUTPUTS: cycles per lock/unlock pair and one line per lock
+ *   RETURN VALUE: PASS/FAIL
+ *   SIDE EFFECTS: none
+ */
+int test_lock_stats() {
+	TEST_HEADER;
+	static spinlock_t test_lock = SPINLOCK_INIT("test");
+	lock_stats_t stats;
+	uint64_t start, hold;
+	uint32_t flags, cycles, found = 0;
+	int i;
+
+	start = rdtsc();
+	for (i = 0; i < LOCK_TEST_ITERS; i++) {
+		spin_lock_irqsave(&test_lock, flags);
+		spin_unlock_irqrestore(&test_lock, flags);
+	}
+	cycles = (uint32_t) (rdtsc() - start);
+	printf("lock/unlock: %u cycles\n", cycles / LOCK_TEST_ITERS);
+
+#ifndef LOCK_STATS
+	return PASS;
+#endif
+	for (i = 0; get_lock_stats(i, &stats) == 0; i++) {
+		hold = stats.hold_cycles;
+		if (stats.acquired != 0) div64_32(&hold, stats.acquired);
+		printf("%s: %u taken, %u contended, hold avg %u max %u\n", stats.name,
+			stats.acquired, stats.contended, (uint32_t) hold, stats.max_hold);
+		if (strncmp(stats.name, "test", 5) == 0) found = stats.acquired;
+	}
+	return (found == LOCK_TEST_ITERS) ? PASS : FAIL;
+}
+
+/*
+ *   test_kernel_fpu
+ *   DESCRIPTION: Times kernel_fpu_begin/end pairs and checks that CR0.TS is
+ *                armed again afterwards so the next user FPU use traps
+ *   INPUTS: none
+ *   OUTPUTS: cycles per pair and the lazy switching counters
+ *   RETURN VALUE: PASS/FAIL
+ *   SIDE EFFECTS: none
+ */
+int test_kernel_fpu() {
+	TEST_HEADER;
+	fpu_stats_t stats;
+	uint64_t start;
+	uint32_t flags, cycles, cr0;
+	int i;
+
+	start = rdtsc();
+	for (i = 0; i < FPU_TEST_ITERS; i++) {
+		flags = kernel_fpu_begin();
+		kernel_fpu_end(flags);
+	}
+	cycles = (uint32_t) (rdtsc() - start);
+	asm volatile ("movl %%cr0, %0" : "=r" (cr0));
+
+	get_fpu_stats(&stats);
+	printf("kernel fpu begin/end: %u cycles\n", cycles / FPU_TEST_ITERS);
+	printf("traps %u, saves %u, restores %u, inits %u\n", stats.traps, stats.saves,
+		stats.restores, stats.inits);
+	return (cr0 & CR0_TS) ? PASS : FAIL;
+}
 
 /*
  *   launch_tests
@@ -511,4 +786,14 @@ void launch_tests() {
 
 	/* Checkpoint 3 Tests */
 	// TEST_OUTPUT("Test system call", test_sys_calls());
+
+	/* Performance Tests */
+	// TEST_OUTPUT("Scroll throughput", test_scroll_throughput());
+	// TEST_OUTPUT("Scrollback", test_scrollback());
+	// TEST_OUTPUT("Terminal switch latency", test_switch_latency());
+	// TEST_OUTPUT("User page switch", test_user_page_switch());
+	// TEST_OUTPUT("IRQ stats", test_irq_stats());
+	// TEST_OUTPUT("Page pool", test_page_pool());
+	// TEST_OUTPUT("Lock stats", test_lock_stats());
+	// TEST_OUTPUT("Kernel FPU", test_kernel_fpu());
 }
@@ -28,6 +28,21 @@ int test_directory_ls();
 int test_rtc_driver();
 int test_terminal_driver();
 
+/* Performance tests */
+#define SCROLL_TEST_LINES 1000
+
+int test_scroll_throughput();
+int test_scrollback();
+int test_switch_latency();
+#define USER_PAGE_TEST_SWITCHES 1000
+int test_user_page_switch();
+int test_irq_stats();
+int test_page_pool();
+#define LOCK_TEST_ITERS 1000
+int test_lock_stats();
+#define FPU_TEST_ITERS 1000
+int test_kernel_fpu();
+
 int stdin(char* buf);
 int stdout(char* buf);
 
@@ -0,0 +1,124 @@
+/* trace.c - Kernel event trace ring read out through the tracebuf device
+ * vim:ts=4 noexpandtab
+ */
+
+#include "trace.h"
+#include "lib.h"
+#include "syscall_helpers.h"
+#include "smp.h"
+
+/* One ring per CPU, only that CPU writes it. A writer claims a slot with
+ * a single xadd, which an interrupt on the same CPU cannot split, so no
+ * lock is needed and nobody waits. Older events are simply overwritten. */
+static trace_event_t trace_ring[MAX_CPUS][TRACE_RING_SIZE];
+static volatile uint32_t trace_head[MAX_CPUS];  // events ever recorded per CPU
+
+/*
+ * trace_event
+ *   DESCRIPTION: Claims the next slot and fills it with a timestamped event
+ *   INPUTS: type - TRACE_* event type
+ *           arg0, arg1 - event specific values
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: overwrites the oldest event once the ring is full
+ */
+void trace_event(uint32_t type, uint32_t arg0, uint32_t arg1) {
+    uint32_t cpu = smp_cpu_index();
+    uint32_t slot = 1;
+    uint64_t tsc = rdtsc();
+    pcb_t* pcb = get_acct_pcb();
+    trace_event_t* ev;
+
+    asm volatile ("xaddl %0, %1"
+        : "+r" (slot), "+m" (trace_head[cpu])
+        :
+        : "memory", "cc"
+    );
+    ev = &trace_ring[cpu][slot & TRACE_RING_MASK];
+    ev->tsc_lo = (uint32_t) tsc;
+    ev->tsc_hi = (uint32_t) (tsc >> 32);
+    ev->type = (uint8_t) type;
+    ev->cpu = (uint8_t) cpu;
+    ev->pid = (pcb != NULL) ? (uint8_t) pcb->pid : TRACE_NO_PID;
+    ev->arg0 = (uint8_t) arg0;
+    ev->arg1 = arg1;
+}
+
+/*
+ * trace_open
+ *   DESCRIPTION: Opens the tracebuf device
+ *   INPUTS: filename - ignored
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0
+ *   SIDE EFFECTS: none
+ */
+int32_t trace_open(const uint8_t* filename) {
+    return 0;
+}
+
+/*
+ * trace_close
+ *   DESCRIPTION: Closes the tracebuf device
+ *   INPUTS: fd - file descriptor
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0
+ *   SIDE EFFECTS: frees the file descriptor
+ */
+int32_t trace_close(int32_t fd) {
+    get_curr_pcb_ptr()->file_desc_arr[fd].flags = 0;
+    return 0;
+}
+
+/*
+ * trace_read
+ *   DESCRIPTION: Copies out whole events the reader has not seen yet. The
+ *                rings are handed out one CPU after the other, inode holds
+ *                the CPU being read and file_pos the sequence number of the
+ *                next event in its ring. A reader that fell more than a ring
+ *                behind skips ahead to the oldest event still kept. Events
+ *                of different CPUs can be put in order by their tsc.
+ *   INPUTS: fd - file descriptor
+ *           buf - user buffer
+ *           nbytes - size of buf
+ *   OUTPUTS: trace_event_t records into buf
+ *   RETURN VALUE: bytes copied, 0 when caught up, -1 on bad arguments
+ *   SIDE EFFECTS: advances file_pos
+ */
+int32_t trace_read(int32_t fd, void* buf, int32_t nbytes) {
+    file_desc_t* file = &get_curr_pcb_ptr()->file_desc_arr[fd];
+    trace_event_t* out = (trace_event_t *) buf;
+    uint32_t cpu = file->inode;
+    uint32_t pos = file->file_pos;
+    uint32_t head;
+    int32_t count = 0;
+
+    if (buf == NULL || nbytes < 0) return -1;
+
+    for (; cpu < MAX_CPUS; cpu++, pos = 0) {
+        head = trace_head[cpu];
+        if (head - pos > TRACE_RING_SIZE)
+            pos = head - TRACE_RING_SIZE;
+
+        while (pos != head && (count + 1) * (int32_t) sizeof(trace_event_t) <= nbytes) {
+            out[count++] = trace_ring[cpu][pos & TRACE_RING_MASK];
+            pos++;
+        }
+        if (pos != head) break;     // buf is full
+    }
+
+    file->inode = cpu;
+    file->file_pos = pos;
+    return count * sizeof(trace_event_t);
+}
+
+/*
+ * trace_write
+ *   DESCRIPTION: The trace can't be written to
+ *   INPUTS: fd, buf, nbytes - ignored
+ *   OUTPUTS: none
+ *   RETURN VALUE: -1
+ *   SIDE EFFECTS: none
+ */
+int32_t trace_write(int32_t fd, const void* buf, int32_t nbytes) {
+    return -1;
+}
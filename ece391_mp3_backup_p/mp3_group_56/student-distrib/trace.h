@@ -0,0 +1,62 @@
+/* trace.h - Kernel event trace ring read out through the tracebuf device
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+/* Comment out to compile every trace point away */
+#define TRACE_ENABLED
+
+/* events kept per CPU, must be a power of 2 (16 bytes each) */
+#define TRACE_RING_SIZE     4096
+#define TRACE_RING_MASK     (TRACE_RING_SIZE - 1)
+
+/* name the tracebuf device is opened by */
+#define TRACE_DEVICE_NAME   "tracebuf"
+
+/* pid of an event recorded while no process owned the stack */
+#define TRACE_NO_PID        0xFF
+
+/* Event types */
+#define TRACE_SYSCALL_ENTER 1   // arg0 = syscall number, arg1 = first argument
+#define TRACE_SYSCALL_EXIT  2   // arg0 = syscall number, arg1 = return value
+#define TRACE_SWITCH        3   // arg0 = pid switched to, arg1 = its terminal
+#define TRACE_IRQ_ENTER     4   // arg0 = irq, arg1 = interrupted eip
+#define TRACE_IRQ_EXIT      5   // arg0 = irq
+#define TRACE_PAGE_FAULT    6   // arg1 = faulting address (cr2)
+
+#ifndef ASM
+
+#include "types.h"
+
+/* One event as it sits in the ring and as tracebuf hands it out */
+typedef struct trace_event_t {
+    uint32_t tsc_lo;
+    uint32_t tsc_hi;
+    uint8_t type;
+    uint8_t cpu;                // smp_cpu_index() of the CPU that recorded it
+    uint8_t pid;                // TRACE_NO_PID outside of a process
+    uint8_t arg0;
+    uint32_t arg1;
+} trace_event_t;
+
+#ifdef TRACE_ENABLED
+#define TRACE(type, arg0, arg1)     trace_event((type), (arg0), (arg1))
+#else
+#define TRACE(type, arg0, arg1)     do { } while (0)
+#endif
+
+/* Records an event, safe from any context */
+void trace_event(uint32_t type, uint32_t arg0, uint32_t arg1);
+
+/* tracebuf device, reads whole events one CPU's ring after the other,
+ * each starting from the oldest event kept */
+int32_t trace_open(const uint8_t* filename);
+int32_t trace_close(int32_t fd);
+int32_t trace_read(int32_t fd, void* buf, int32_t nbytes);
+int32_t trace_write(int32_t fd, const void* buf, int32_t nbytes);
+
+#endif /* ASM */
+
+#endif /* _TRACE_H */
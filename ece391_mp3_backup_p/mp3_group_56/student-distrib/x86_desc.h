@@ -15,6 +15,11 @@
 #define USER_DS     0x002B
 #define KERNEL_TSS  0x0030
 #define KERNEL_LDT  0x0038
+/* TSS of CPU n (n >= 1) is at AP_TSS_BASE + 8 * (n - 1), the BSP uses KERNEL_TSS */
+#define AP_TSS_BASE 0x0040
+
+/* Most CPUs the GDT has TSS slots for */
+#define MAX_CPUS    8
 
 /* Size of the task state segment (TSS) */
 #define TSS_SIZE    104
@@ -129,6 +134,7 @@ extern uint32_t ldt;
 extern uint32_t tss_size;
 extern seg_desc_t tss_desc_ptr;
 extern tss_t tss;
+extern seg_desc_t ap_tss_desc_ptr[MAX_CPUS - 1];
  
 /* Sets runtime-settable parameters in the GDT entry for the LDT */
 #define SET_LDT_PARAMS(str, addr, lim)                          \
@@ -0,0 +1,11 @@
+# Regression workloads, run with "shell bench" and compare the times.
+# make copies it to to_fsdir/bench, put it into fsdir with the programs
+# built here: it needs this shell for scripts and time, and iobench.
+time cat frame0.txt
+time cat frame1.txt
+time grep fish
+time grep ece391|fish|frame
+time counter 1
+time iobench
+# ls is answered from the shell's cache, rehash reads the directory
+time rehash
@@ -2,6 +2,7 @@
 
 #include "ece391support.h"
 #include "ece391syscall.h"
+#include "ece391stdio.h"
 
 #define BUFSIZE 1024
 
@@ -10,12 +11,19 @@ int main ()
     uint32_t i, cnt, max = 0;
     uint8_t buf[BUFSIZE];
 
-    ece391_fdputs(1, (uint8_t*)"Enter the Test Number: (0): 100, (1): 10000, (2): 100000\n");
-    if (-1 == (cnt = ece391_read(0, buf, BUFSIZE-1)) ) {
-        ece391_fdputs(1, (uint8_t*)"Can't read the number from keyboard.\n");
-     return 3;
+    /* "counter 1" skips the prompt, so scripts can run it */
+    if (0 == ece391_getargs(buf, BUFSIZE-1) && '\0' != buf[0]) {
+        cnt = ece391_strlen(buf);
+        buf[cnt++] = '\n';
+        buf[cnt] = '\0';
+    } else {
+        ece391_fdputs(1, (uint8_t*)"Enter the Test Number: (0): 100, (1): 10000, (2): 100000\n");
+        if (-1 == (cnt = ece391_read(0, buf, BUFSIZE-1)) ) {
+            ece391_fdputs(1, (uint8_t*)"Can't read the number from keyboard.\n");
+         return 3;
+        }
+        buf[cnt] = '\0';
     }
-    buf[cnt] = '\0';
 
     if ((ece391_strlen(buf) > 2) || ((ece391_strlen(buf) == 2) && ((buf[0] < '0') || (buf[0] > '2')))) {
         ece391_fdputs(1, (uint8_t*)"Wrong Choice!\n");
@@ -34,11 +42,10 @@ int main ()
         }
     }
 
-    for (i = 0; i < max; i++) {
-        ece391_itoa(i+1, buf, 10);
-        ece391_fdputs(1, buf);
-        ece391_fdputs(1, (uint8_t*)"\n");
-    }
+    /* one write per ECE391_BUFSIZ bytes instead of two per line */
+    ece391_setvbuf(ece391_stdout, ECE391_IOFBF);
+    for (i = 0; i < max; i++)
+        ece391_printf("%u\n", i+1);
 
     return 0;
 }
@@ -2,8 +2,11 @@
 #include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
 #include <sys/wait.h>
 #include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "ece391support.h"
@@ -15,6 +18,31 @@ static uint32_t start_esp;
 static int32_t dir_fd = -1;
 static DIR* dir = NULL;
 
+/*
+ * Every emulated system call is counted and timed. With ECE391_STATS set
+ * in the environment a summary goes to stderr when the program halts, and
+ * getstats hands the counts back as this process's record. Programs run
+ * with ECE391_FSROOT set start in that directory, so a tree of large or
+ * generated files can stand in for the file system image; the programs
+ * executed from it have to be in the tree too.
+ */
+typedef struct emu_stat {
+    uint32_t calls;
+    uint32_t bytes;
+    double usec;
+} emu_stat_t;
+
+static emu_stat_t emu_stats[ECE391_SYSCALL_SLOTS];
+static const char* const emu_names[ECE391_SYSCALL_SLOTS] = {
+    NULL, "halt", "execute", "read", "write", "open", "close", "getargs",
+    "vidmap", "set_handler", "sigreturn", "getstats", "profile"
+};
+static char** emu_envp;
+static const char* emu_prog;
+static int emu_report_on;
+static double emu_start_usec;
+static uint64_t emu_start_tsc;
+
 
 /* 
  * (copied from the real system call support)
@@ -41,29 +69,128 @@ asm volatile ("                    \
 ")
 
 /* these wrappers require no changes */
+extern int32_t __ece391_halt (uint8_t status);
 extern int32_t __ece391_read (int32_t fd, void* buf, int32_t nbytes);
 extern int32_t __ece391_write (int32_t fd, const void* buf, int32_t nbytes);
 extern int32_t __ece391_close (int32_t fd);
 void fake_function () {
-DO_CALL(ece391_halt,1 /* SYS_HALT */);
+DO_CALL(__ece391_halt,1 /* SYS_HALT */);
 DO_CALL(__ece391_read,3 /* SYS_READ */);
 DO_CALL(__ece391_write,4 /* SYS_WRITE */);
 DO_CALL(__ece391_close,6 /* SYS_CLOSE */);
 
-/* Call the main() function, then halt with its return value. */
+/* Set up the accounting, call the main() function, flush stdio, then halt
+   with main's return value. */
 
 asm volatile ("                         \n\
 .GLOBAL _start                          \n\
 _start:                                 \n\
 	MOVL	%ESP,start_esp          \n\
+        CALL	emu_init                \n\
         CALL	main                    \n\
 	PUSHL	%EAX                    \n\
+	CALL	ece391_flushall         \n\
+	POPL	%EAX                    \n\
+	PUSHL	%EAX                    \n\
 	CALL	ece391_halt             \n\
 ");
 
 /* end of fake container function */
 }
 
+static inline uint64_t
+emu_rdtsc (void)
+{
+    uint32_t lo, hi;
+
+    asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/* Monotonic clock in microseconds, kept in a double so that nothing
+   here needs the 64 bit divide from libgcc */
+static double
+emu_now (void)
+{
+    struct timespec ts;
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void
+emu_account (int32_t nr, int32_t rval, double start)
+{
+    emu_stats[nr].calls++;
+    if ((SYS_READ == nr || SYS_WRITE == nr) && rval > 0)
+        emu_stats[nr].bytes += rval;
+    emu_stats[nr].usec += emu_now () - start;
+}
+
+static const char*
+emu_getenv (const char* name)
+{
+    uint32_t len = strlen (name);
+    char** env;
+
+    for (env = emu_envp; NULL != *env; env++) {
+        if (0 == strncmp (*env, name, len) && '=' == (*env)[len])
+	    return *env + len + 1;
+    }
+    return NULL;
+}
+
+/* Called from _start before main, while the stack still holds argc,
+   argv and the environment */
+void
+emu_init (void)
+{
+    int32_t argc = *(uint32_t*)start_esp;
+    char** argv = (char**)(start_esp + 4);
+    const char* root;
+    const char* slash;
+
+    emu_envp = argv + argc + 1;
+    emu_prog = argv[0];
+    if (NULL != (slash = strrchr (emu_prog, '/')))
+        emu_prog = slash + 1;
+    emu_report_on = (NULL != emu_getenv ("ECE391_STATS"));
+    if (NULL != (root = emu_getenv ("ECE391_FSROOT")) && -1 == chdir (root))
+        perror ("ECE391_FSROOT");
+    emu_start_usec = emu_now ();
+    emu_start_tsc = emu_rdtsc ();
+}
+
+/* One line per system call used, totals first */
+static void
+emu_report (void)
+{
+    uint32_t total = 0;
+    int32_t nr;
+
+    for (nr = 0; nr < ECE391_SYSCALL_SLOTS; nr++)
+        total += emu_stats[nr].calls;
+    fprintf (stderr, "== %s: %u syscalls, %u bytes read, %u bytes written, "
+             "%.3f ms wall\n", emu_prog, total, emu_stats[SYS_READ].bytes,
+	     emu_stats[SYS_WRITE].bytes, (emu_now () - emu_start_usec) / 1e3);
+    for (nr = 0; nr < ECE391_SYSCALL_SLOTS; nr++) {
+        if (0 == emu_stats[nr].calls)
+	    continue;
+	fprintf (stderr, "   %-12s %8u calls %10u bytes %12.1f us\n",
+	         emu_names[nr], emu_stats[nr].calls, emu_stats[nr].bytes,
+		 emu_stats[nr].usec);
+    }
+}
+
+int32_t
+ece391_halt (uint8_t status)
+{
+    emu_stats[SYS_HALT].calls++;
+    if (emu_report_on)
+        emu_report ();
+    return __ece391_halt (status);
+}
+
 int32_t 
 ece391_execute (const uint8_t* command)
 {
@@ -72,9 +199,13 @@ ece391_execute (const uint8_t* command)
     char* args[1024];
     uint8_t* scan;
     uint32_t n_arg;
+    double start = emu_now ();
+    int32_t rval;
 
-    if (1023 < ece391_strlen (command))
+    if (1023 < ece391_strlen (command)) {
+        emu_account (SYS_EXECUTE, -1, start);
 	return -1;
+    }
     buf[0] = '.';
     buf[1] = '/';
     ece391_strcpy (buf + 2, command);
@@ -99,32 +230,38 @@ ece391_execute (const uint8_t* command)
     }
     args[n_arg] = NULL;
     if (0 == fork ()) {
-	execv ((char*)buf, args);
+	execve ((char*)buf, args, emu_envp);
         kill (getpid (), 9);
     }
     (void)wait (&status);
     if (WIFEXITED (status))
-        return WEXITSTATUS (status);
-    if (9 == WTERMSIG (status))
-        return -1;
-    return 256;
+        rval = WEXITSTATUS (status);
+    else if (9 == WTERMSIG (status))
+        rval = -1;
+    else
+        rval = 256;
+    emu_account (SYS_EXECUTE, rval, start);
+    return rval;
 }
 
 int32_t 
 ece391_open (const uint8_t* filename)
 {
     uint32_t rval;
+    double start = emu_now ();
 
     if (0 == ece391_strcmp (filename, (uint8_t*)".")) {
 	dir = opendir (".");
         dir_fd = open ("/dev/null", O_RDONLY);
+	emu_account (SYS_OPEN, dir_fd, start);
 	return dir_fd;
     }
 
     asm volatile ("INT $0x80" : "=a" (rval) :
 		  "a" (5), "b" (filename), "c" (O_RDONLY));
     if (rval > 0xFFFFC000)
-        return -1;
+        rval = -1;
+    emu_account (SYS_OPEN, rval, start);
     return rval;
 }
 
@@ -135,6 +272,7 @@ ece391_getargs (uint8_t* buf, int32_t nbytes)
     uint8_t** argv = (uint8_t**)(start_esp + 4);
     int32_t idx, len;
 
+    emu_stats[SYS_GETARGS].calls++;
     idx = 1;
     while (idx < argc) {
         len = ece391_strlen (argv[idx]);
@@ -162,6 +300,7 @@ ece391_vidmap (uint8_t** screen_start)
     static int mem_fd = -1;
     void* mem_image;
 
+    emu_stats[SYS_VIDMAP].calls++;
     if(mem_fd == -1) {
         mem_fd = open ("/dev/mem", O_RDWR);
     }
@@ -183,39 +322,49 @@ ece391_read (int32_t fd, void* buf, int32_t nbytes)
     int32_t copied;
     uint8_t* from;
     uint8_t* to;
+    double start = emu_now ();
 
-    if (NULL == dir || dir_fd != fd)
-        return __ece391_read (fd, buf, nbytes);
-    if (NULL == (de = readdir (dir)))
+    if (NULL == dir || dir_fd != fd) {
+        copied = __ece391_read (fd, buf, nbytes);
+	emu_account (SYS_READ, copied, start);
+	return copied;
+    }
+    if (NULL == (de = readdir (dir))) {
+        emu_account (SYS_READ, 0, start);
         return 0;
+    }
     to = buf;
     from = (uint8_t*)de->d_name;
     copied = 0;
     while ('\0' != *from) {
         *to++ = *from++;
-        if (++copied == nbytes)
-	    return nbytes;
-	if (32 == copied)
-	    return 32;
+        if (++copied == nbytes || 32 == copied)
+	    break;
     }
     while (nbytes > copied && 32 > copied) {
         *to++ = '\0';
 	copied++;
     }
+    emu_account (SYS_READ, copied, start);
     return copied;
 }
 
 int32_t 
 ece391_write (int32_t fd, const void* buf, int32_t nbytes)
 {
+    double start = emu_now ();
+    int32_t rval = -1;
+
     if (NULL == dir || dir_fd != fd)
-        return __ece391_write (fd, buf, nbytes);
-    return -1;
+        rval = __ece391_write (fd, buf, nbytes);
+    emu_account (SYS_WRITE, rval, start);
+    return rval;
 }
 
 int32_t 
 ece391_close (int32_t fd)
 {
+    emu_stats[SYS_CLOSE].calls++;
     if (NULL == dir || dir_fd != fd)
         return __ece391_close (fd);
     (void)closedir (dir);
@@ -225,3 +374,75 @@ ece391_close (int32_t fd)
     return 0;
 }
 
+/* 
+ * Wall clock in microseconds for timing programs run under the emulator,
+ * wraps after about an hour
+ */
+uint32_t
+ece391_emu_usec (void)
+{
+    struct timeval tv;
+
+    (void)gettimeofday (&tv, NULL);
+    return (uint32_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* No signals or profiler under Linux, the calls are only counted */
+int32_t
+ece391_set_handler (int32_t signum, void* handler)
+{
+    emu_stats[SYS_SET_HANDLER].calls++;
+    return -1;
+}
+
+int32_t
+ece391_sigreturn (void)
+{
+    emu_stats[SYS_SIGRETURN].calls++;
+    return -1;
+}
+
+int32_t
+ece391_profile (int32_t cmd, void* buf, int32_t arg)
+{
+    emu_stats[SYS_PROFILE].calls++;
+    return -1;
+}
+
+/*
+ * The header and a single record for this process, filled from the
+ * emulator's own counts. Ticks are worked out from the wall clock at the
+ * PIT rate, the page pool counters are zero and all cycles count as user
+ * time.
+ */
+int32_t
+ece391_getstats (void* buf, int32_t nbytes)
+{
+    ece391_stats_header_t* header = buf;
+    ece391_proc_stats_t* rec = (ece391_proc_stats_t*)(header + 1);
+    uint64_t tsc = emu_rdtsc ();
+    int32_t nr;
+
+    emu_stats[SYS_GETSTATS].calls++;
+    if (NULL == buf || nbytes < (int32_t)sizeof (*header))
+        return -1;
+    memset (header, 0, sizeof (*header));
+    header->ticks = (uint32_t)(int32_t)((emu_now () - emu_start_usec) /
+                                       ECE391_TICK_USEC);
+    header->tsc_lo = (uint32_t)tsc;
+    header->tsc_hi = (uint32_t)(tsc >> 32);
+    header->nprocs = 1;
+    if (nbytes < (int32_t)(sizeof (*header) + sizeof (*rec)))
+        return sizeof (*header);
+
+    memset (rec, 0, sizeof (*rec));
+    rec->pid = 0;
+    rec->parent_pid = -1;
+    strncpy ((char*)rec->name, emu_prog, ECE391_NAME_SIZE - 1);
+    rec->user_cycles = tsc - emu_start_tsc;
+    rec->bytes_read = emu_stats[SYS_READ].bytes;
+    rec->bytes_written = emu_stats[SYS_WRITE].bytes;
+    for (nr = 0; nr < ECE391_SYSCALL_SLOTS; nr++)
+        rec->syscalls[nr] = emu_stats[nr].calls;
+    return sizeof (*header) + sizeof (*rec);
+}
@@ -2,88 +2,438 @@
 
 #include "ece391support.h"
 #include "ece391syscall.h"
+#include "ece391stdio.h"
 
 #define BUFSIZE 1024
 #define SBUFSIZE 33
 
+/*
+ * File data goes through a ring of RING_SIZE bytes. Reads land wherever the
+ * free space starts, nothing already buffered is moved to make room. The
+ * second RING_SIZE bytes mirror the start of the ring: a line that wraps
+ * around the end gets its wrapped part copied there so it can be searched
+ * in one piece.
+ */
+#define RING_SIZE 8192
+#define RING_MASK (RING_SIZE - 1)
+
+/* patterns shorter than this are found with the first byte scan alone */
+#define SHORT_PATTERN 4
+
+#define ONES  0x01010101
+#define HIGHS 0x80808080
+
+/* nonzero if any byte of x is zero */
+#define HAS_ZERO(x) (((x) - ONES) & ~(x) & HIGHS)
+
+#define NO_MATCH ((const uint8_t*)0)
+
+/* grep a|b|c prints the lines holding any of a, b or c, \| is a literal | */
+#define PATTERN_SEP '|'
+#define PATTERN_ESC '\\'
+/* the automaton has a state per pattern byte plus the root */
+#define AC_MAX_STATES BUFSIZE
+#define AC_NONE 0xFFFF
+
+static uint8_t ring[2 * RING_SIZE];
+
+/* the pattern and its Boyer-Moore-Horspool shift table */
+static const uint8_t* pat;
+static uint32_t pat_len;
+static uint32_t shift[256];
+
+/*
+ * Several patterns are compiled into one Aho-Corasick automaton, a DFA
+ * whose state is the longest pattern prefix the text ends with. Bytes that
+ * appear in no pattern share class 0, so the table has one column per
+ * distinct pattern byte plus one.
+ */
+static uint8_t byte_class[256];
+static uint32_t num_classes;
+static uint32_t num_states;
+static uint16_t delta[AC_MAX_STATES * 256];
+static uint16_t fail[AC_MAX_STATES];
+static uint8_t accepts[AC_MAX_STATES];
+
+/* single pattern or automaton search, picked in main */
+static const uint8_t* (*find_match) (const uint8_t* p, const uint8_t* end);
+
+#if defined(GREP_THROUGHPUT)
+/* wall clock in microseconds, from the emulator harness */
+extern uint32_t ece391_emu_usec (void);
+static uint32_t bytes_searched;
+#endif
+
+/*
+ * Finds the first c in [p, end). Four bytes are checked per step, xoring
+ * with c in every byte of a word zeroes the bytes that match.
+ */
+static const uint8_t*
+find_byte (const uint8_t* p, const uint8_t* end, uint8_t c)
+{
+    uint32_t spread = c * ONES;
+    uint32_t w;
+
+    for (; p < end && ((uint32_t)p & 3); p++)
+        if (c == *p)
+	    return p;
+    for (; p + 4 <= end; p += 4) {
+        w = *(const uint32_t*)p ^ spread;
+	if (HAS_ZERO (w))
+	    break;
+    }
+    for (; p < end; p++)
+        if (c == *p)
+	    return p;
+    return NO_MATCH;
+}
+
+/* Finds the last c in [p, end), only used on the tail of a read */
+static const uint8_t*
+find_last_byte (const uint8_t* p, const uint8_t* end, uint8_t c)
+{
+    while (end > p)
+        if (c == *--end)
+	    return end;
+    return NO_MATCH;
+}
+
+/* Builds the shift table: after a mismatch the window moves until the
+ * byte under its last position lines up with its last use in the pattern */
+static void
+prepare_pattern (const uint8_t* s)
+{
+    uint32_t i;
+
+    pat = s;
+    pat_len = ece391_strlen (s);
+    for (i = 0; i < 256; i++)
+        shift[i] = pat_len;
+    for (i = 0; i + 1 < pat_len; i++)
+        shift[pat[i]] = pat_len - 1 - i;
+}
+
+/* Finds the first occurrence of the pattern in [p, end) */
+static const uint8_t*
+find_pattern (const uint8_t* p, const uint8_t* end)
+{
+    const uint8_t* last;
+    uint32_t i;
+
+    if (pat_len < SHORT_PATTERN) {
+        while (NO_MATCH != (p = find_byte (p, end, pat[0]))) {
+	    if ((uint32_t)(end - p) < pat_len)
+	        return NO_MATCH;
+	    for (i = 1; i < pat_len && p[i] == pat[i]; i++);
+	    if (i == pat_len)
+	        return p;
+	    p++;
+	}
+	return NO_MATCH;
+    }
+
+    for (last = p + pat_len - 1; last < end; last += shift[*last]) {
+        if (*last != pat[pat_len - 1])
+	    continue;
+	p = last - (pat_len - 1);
+	for (i = 0; i < pat_len - 1 && p[i] == pat[i]; i++);
+	if (i == pat_len - 1)
+	    return p;
+    }
+    return NO_MATCH;
+}
+
+/*
+ * Splits the argument into patterns in place: each PATTERN_SEP becomes a
+ * '\0', and PATTERN_ESC PATTERN_SEP becomes a plain PATTERN_SEP. Any other
+ * PATTERN_ESC is kept as it is. Returns the number of patterns, the bytes
+ * used, separators included, go in *len.
+ */
+static uint32_t
+split_patterns (uint8_t* s, uint32_t* len)
+{
+    uint32_t i, j, count = 1;
+
+    for (i = j = 0; '\0' != s[i]; i++, j++) {
+        if (PATTERN_ESC == s[i] && PATTERN_SEP == s[i + 1]) {
+	    s[j] = s[++i];
+	} else if (PATTERN_SEP == s[i]) {
+	    s[j] = '\0';
+	    count++;
+	} else {
+	    s[j] = s[i];
+	}
+    }
+    s[j] = '\0';
+    *len = j;
+    return count;
+}
+
+/* Adds one pattern to the trie, returns -1 if it has no room left */
+static int32_t
+ac_add (const uint8_t* s, uint32_t len)
+{
+    uint32_t state = 0, i, c;
+
+    for (i = 0; i < len; i++) {
+        c = byte_class[s[i]];
+	if (AC_NONE == delta[state * num_classes + c]) {
+	    if (AC_MAX_STATES == num_states)
+	        return -1;
+	    delta[state * num_classes + c] = num_states++;
+	}
+	state = delta[state * num_classes + c];
+    }
+    accepts[state] = 1;
+    return 0;
+}
+
+/*
+ * Builds the automaton from the len bytes of patterns in s, each ended by
+ * a '\0' as split_patterns leaves them.
+ * Breadth first, each state's failure link is the state its longest
+ * proper suffix reaches; missing transitions are copied from there, so
+ * the scan never follows a failure link itself.
+ */
+static int32_t
+ac_build (const uint8_t* s, uint32_t len)
+{
+    static uint16_t queue[AC_MAX_STATES];
+    uint32_t qhead = 0, qtail = 0, state, next, c, i, start;
+
+    num_classes = 1;
+    for (i = 0; i < len; i++) {
+        if ('\0' != s[i] && 0 == byte_class[s[i]])
+	    byte_class[s[i]] = num_classes++;
+    }
+    for (i = 0; i < AC_MAX_STATES * num_classes; i++)
+        delta[i] = AC_NONE;
+    num_states = 1;
+
+    for (start = i = 0; ; i++) {
+        if (i < len && '\0' != s[i])
+	    continue;
+	if (i > start && -1 == ac_add (s + start, i - start))
+	    return -1;
+	if (i == len)
+	    break;
+	start = i + 1;
+    }
+
+    fail[0] = 0;
+    for (c = 0; c < num_classes; c++) {
+        next = delta[c];
+	if (AC_NONE == next) {
+	    delta[c] = 0;
+	} else {
+	    fail[next] = 0;
+	    queue[qtail++] = next;
+	}
+    }
+    while (qhead < qtail) {
+        state = queue[qhead++];
+	accepts[state] |= accepts[fail[state]];
+	for (c = 0; c < num_classes; c++) {
+	    next = delta[state * num_classes + c];
+	    if (AC_NONE == next) {
+	        delta[state * num_classes + c] = delta[fail[state] * num_classes + c];
+	    } else {
+	        fail[next] = delta[fail[state] * num_classes + c];
+		queue[qtail++] = next;
+	    }
+	}
+    }
+    return 0;
+}
+
+/* Runs the automaton over [p, end), returns the last byte of the first
+ * match. Newlines are in no pattern, so each line starts from the root. */
+static const uint8_t*
+ac_find (const uint8_t* p, const uint8_t* end)
+{
+    uint32_t state = 0;
+
+    for (; p < end; p++) {
+        state = delta[state * num_classes + byte_class[*p]];
+	if (accepts[state])
+	    return p;
+    }
+    return NO_MATCH;
+}
+
+/*
+ * Prints every line of [start, end) that holds a pattern. The block
+ * holds whole lines, the last one may lack its newline. Patterns have
+ * no newline in them, so a match never spans lines and the block is
+ * searched as a whole; line boundaries are only looked for around matches.
+ */
+static void
+search_block (const uint8_t* start, const uint8_t* end, const uint8_t* fname)
+{
+    const uint8_t* p = start;
+    const uint8_t* hit;
+    const uint8_t* line;
+    const uint8_t* eol;
+
+#if defined(GREP_THROUGHPUT)
+    bytes_searched += end - start;
+#endif
+    while (p < end && NO_MATCH != (hit = find_match (p, end))) {
+        for (line = hit; line > p && '\n' != line[-1]; line--);
+	if (NO_MATCH == (eol = find_byte (hit, end, '\n')))
+	    eol = end;
+	ece391_fputs (fname, ece391_stdout);
+	ece391_fputc (':', ece391_stdout);
+	ece391_fwrite (line, eol - line, ece391_stdout);
+	ece391_fputc ('\n', ece391_stdout);
+	p = eol + 1;
+    }
+}
+
 int32_t
-do_one_file (const char* s, const char* fname) 
+do_one_file (const char* s, const char* fname)
 {
-    int32_t fd, cnt, last, line_start, line_end, check, s_len;
-    uint8_t data[BUFSIZE+1];
+    int32_t fd, cnt, eof = 0;
+    uint32_t head = 0, count = 0, tail, room, seg, wrapped;
+    const uint8_t* nl;
 
-    s_len = ece391_strlen ((uint8_t*)s);
     if (-1 == (fd = ece391_open ((uint8_t*)fname))) {
-        ece391_fdputs (1, (uint8_t*)"file open failed\n");
+        ece391_fputs ((uint8_t*)"file open failed\n", ece391_stdout);
         return -1;
     }
-    last = 0;
-    while (1) {
-        cnt = ece391_read (fd, data + last, BUFSIZE - last);
-	if (-1 == cnt) {
-            ece391_fdputs (1, (uint8_t*)"file read failed\n");
-            return -1;
-	}
-	last += cnt;
-	line_start = 0;
-	while (1) {
-	    line_end = line_start;
-	    while (line_end < last && '\n' != data[line_end])
-		line_end++;
-	    if ('\n' != data[line_end] && 0 != cnt && line_start != 0) {
-		/* copy from line_start to last down to 0 and fix last */
-		data[line_end] = '\0';
-		ece391_strcpy (data, data + line_start);
-		last -= line_start;
-		break;
-	    }
-	    /* search the line */
-	    data[line_end] = '\0';
-	    for (check = line_start; check < line_end; check++) {
-		if (s[0] == data[check] && 
-		    0 == ece391_strncmp ((uint8_t*)(data + check), (uint8_t*)s, s_len)) {
-		    ece391_fdputs (1, (uint8_t*)fname);
-		    ece391_fdputs (1, (uint8_t*)":");
-		    ece391_fdputs (1, data + line_start);
-		    ece391_fdputs (1, (uint8_t*)"\n");
-		    break;
-		}
-	    }
-	    line_start = line_end + 1;
-	    if (line_start >= last) {
-	        last = 0;
-		break;
+    while (!eof || 0 != count) {
+        /* one read into the free space after the buffered data */
+        if (!eof && count < RING_SIZE) {
+	    if (0 == count)
+	        head = 0;
+	    tail = (head + count) & RING_MASK;
+	    room = RING_SIZE - count;
+	    if (room > RING_SIZE - tail)
+	        room = RING_SIZE - tail;
+	    cnt = ece391_read (fd, ring + tail, room);
+	    if (-1 == cnt) {
+		ece391_fputs ((uint8_t*)"file read failed\n", ece391_stdout);
+		return -1;
 	    }
+	    if (0 == cnt)
+	        eof = 1;
+	    count += cnt;
+	}
+
+	/* everything up to the last newline before the end of the ring */
+	seg = RING_SIZE - head;
+	if (seg > count)
+	    seg = count;
+	nl = find_last_byte (ring + head, ring + head + seg, '\n');
+	if (NO_MATCH != nl) {
+	    search_block (ring + head, nl + 1, (const uint8_t*)fname);
+	    seg = nl + 1 - (ring + head);
+	    head = (head + seg) & RING_MASK;
+	    count -= seg;
+	    continue;
+	}
+
+	/* a line that wraps, finish it in the mirror */
+	if (count > seg) {
+	    wrapped = count - seg;
+	    nl = find_byte (ring, ring + wrapped, '\n');
+	    if (NO_MATCH != nl)
+	        wrapped = nl + 1 - ring;
+	    else if (!eof && count < RING_SIZE)
+	        continue;
+	    ece391_memcpy (ring + RING_SIZE, ring, wrapped);
+	    search_block (ring + head, ring + RING_SIZE + wrapped, (const uint8_t*)fname);
+	    head = wrapped;
+	    count -= seg + wrapped;
+	    continue;
+	}
+
+	/* no newline yet, wait for one unless the file or the ring is done */
+	if (eof || count == RING_SIZE) {
+	    search_block (ring + head, ring + head + count, (const uint8_t*)fname);
+	    head = 0;
+	    count = 0;
 	}
-	if (0 == cnt)
-	    break;
     }
     if (-1 == ece391_close (fd)) {
-        ece391_fdputs (1, (uint8_t*)"file close failed\n");
+        ece391_fputs ((uint8_t*)"file close failed\n", ece391_stdout);
         return -1;
     }
     return 0;
 }
 
+#if defined(GREP_THROUGHPUT)
+/* bytes searched, time taken and MB/s, on stderr so the matches stay clean */
+static void
+report_throughput (uint32_t usec)
+{
+    uint8_t buf[12];
+    uint32_t rate;
+
+    if (0 == usec)
+        usec = 1;
+    ece391_itoa (bytes_searched, buf, 10);
+    ece391_fdputs (2, buf);
+    ece391_fdputs (2, (uint8_t*)" bytes in ");
+    ece391_itoa (usec, buf, 10);
+    ece391_fdputs (2, buf);
+    ece391_fdputs (2, (uint8_t*)" us, ");
+    /* bytes per microsecond is MB/s, kept in hundredths */
+    if (usec >= 100)
+        rate = bytes_searched / (usec / 100);
+    else
+        rate = bytes_searched * 100 / usec;
+    ece391_itoa (rate / 100, buf, 10);
+    ece391_fdputs (2, buf);
+    ece391_fdputs (2, (uint8_t*)".");
+    if (rate % 100 < 10)
+        ece391_fdputs (2, (uint8_t*)"0");
+    ece391_itoa (rate % 100, buf, 10);
+    ece391_fdputs (2, buf);
+    ece391_fdputs (2, (uint8_t*)" MB/s\n");
+}
+#endif
+
 int main ()
 {
     int32_t fd, cnt;
     uint8_t buf[SBUFSIZE];
     uint8_t search[BUFSIZE];
+    uint32_t search_len;
+#if defined(GREP_THROUGHPUT)
+    uint32_t start = ece391_emu_usec ();
+#endif
 
     if (0 != ece391_getargs (search, BUFSIZE)) {
         ece391_fdputs (1, (uint8_t*)"could not read argument\n");
         return 3;
     }
+    /* one pattern takes the skip search, several share one automaton */
+    if (1 == split_patterns (search, &search_len)) {
+        prepare_pattern (search);
+	if (0 == pat_len)
+	    return 0;
+	find_match = find_pattern;
+    } else {
+        if (-1 == ac_build (search, search_len)) {
+	    ece391_fdputs (1, (uint8_t*)"too many patterns\n");
+	    return 3;
+	}
+	if (1 == num_states)
+	    return 0;
+	find_match = ac_find;
+    }
+    /* matches are only written out when the buffer fills or grep ends */
+    ece391_setvbuf (ece391_stdout, ECE391_IOFBF);
 
     if (-1 == (fd = ece391_open ((uint8_t*)"."))) {
-        ece391_fdputs (1, (uint8_t*)"directory open failed\n");
+        ece391_fputs ((uint8_t*)"directory open failed\n", ece391_stdout);
 	return 2;
     }
 
     while (0 != (cnt = ece391_read (fd, buf, SBUFSIZE-1))) {
         if (-1 == cnt) {
-	    ece391_fdputs (1, (uint8_t*)"directory entry read failed\n");
+	    ece391_fputs ((uint8_t*)"directory entry read failed\n", ece391_stdout);
 	    return 3;
 	}
 	if ('.' == buf[0]) /* a directory... */
@@ -93,5 +443,9 @@ int main ()
 	    return 3;
     }
 
+#if defined(GREP_THROUGHPUT)
+    ece391_flushall ();
+    report_throughput (ece391_emu_usec () - start);
+#endif
     return 0;
 }
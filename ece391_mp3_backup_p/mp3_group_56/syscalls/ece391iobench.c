@@ -0,0 +1,160 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+#include "ece391stdio.h"
+
+/*
+ * Counts the system calls and cycles of reading a file a byte at a time
+ * and of printing lines, once with raw read/write and once through the
+ * stdio buffers. The trap counts come from the kernel's own accounting.
+ *
+ * usage: iobench [file]
+ */
+
+#define MAX_PROCS 6
+#define DEFAULT_FILE "fish"
+#define BENCH_LINES 200
+#define ARG_SIZE 128
+
+static uint8_t self_name[] = "iobench";
+
+static struct {
+    ece391_stats_header_t header;
+    ece391_proc_stats_t procs[MAX_PROCS];
+} stats;
+
+static inline uint32_t rdtsc_lo(void)
+{
+    uint32_t lo, hi;
+
+    asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+    return lo;
+}
+
+/* System calls made so far by this process, the getstats call included */
+static uint32_t trap_count(void)
+{
+    uint32_t i, n, total = 0;
+    int32_t j;
+
+    if (-1 == ece391_getstats(&stats, sizeof(stats)))
+        return 0;
+    n = stats.header.nprocs < MAX_PROCS ? stats.header.nprocs : MAX_PROCS;
+    for (i = 0; i < n; i++) {
+        if (0 != ece391_strcmp(stats.procs[i].name, self_name))
+            continue;
+        for (j = 0; j < ECE391_SYSCALL_SLOTS; j++)
+            total += stats.procs[i].syscalls[j];
+        return total;
+    }
+    return 0;
+}
+
+/* one row of the result table, the getstats that ends the run is not counted */
+static void report(const char* name, uint32_t bytes, uint32_t traps, uint32_t cycles)
+{
+    ece391_printf("%-14s %7u %7u %10u\n", name, bytes, traps - 1, cycles);
+}
+
+static uint32_t read_raw(const uint8_t* file)
+{
+    int32_t fd;
+    uint32_t bytes = 0;
+    uint8_t c;
+
+    if (-1 == (fd = ece391_open(file)))
+        return 0;
+    while (1 == ece391_read(fd, &c, 1))
+        bytes++;
+    ece391_close(fd);
+    return bytes;
+}
+
+static uint32_t read_buffered(const uint8_t* file)
+{
+    ece391_file_t* f;
+    uint32_t bytes = 0;
+
+    if (0 == (f = ece391_fopen(file)))
+        return 0;
+    while (ECE391_EOF != ece391_getc(f))
+        bytes++;
+    ece391_fclose(f);
+    return bytes;
+}
+
+static void write_raw(void)
+{
+    uint8_t buf[12];
+    int32_t i;
+
+    for (i = 0; i < BENCH_LINES; i++) {
+        ece391_itoa(i, buf, 10);
+        ece391_fdputs(1, buf);
+        ece391_fdputs(1, (uint8_t*)"\n");
+    }
+}
+
+static void write_buffered(int32_t mode)
+{
+    int32_t i;
+
+    ece391_setvbuf(ece391_stdout, mode);
+    for (i = 0; i < BENCH_LINES; i++)
+        ece391_printf("%d\n", i);
+    ece391_fflush(ece391_stdout);
+    ece391_setvbuf(ece391_stdout, ECE391_IOLBF);
+}
+
+int main()
+{
+    uint8_t file[ARG_SIZE];
+    uint32_t bytes[2], traps[5], cycles[5], t, c;
+
+    if (0 != ece391_getargs(file, ARG_SIZE) || '\0' == file[0])
+        ece391_strcpy(file, (uint8_t*)DEFAULT_FILE);
+
+    t = trap_count();
+    c = rdtsc_lo();
+    bytes[0] = read_raw(file);
+    cycles[0] = rdtsc_lo() - c;
+    traps[0] = trap_count() - t;
+
+    t = trap_count();
+    c = rdtsc_lo();
+    bytes[1] = read_buffered(file);
+    cycles[1] = rdtsc_lo() - c;
+    traps[1] = trap_count() - t;
+
+    if (0 == bytes[0]) {
+        ece391_printf("iobench: cannot read %s\n", file);
+        return 1;
+    }
+
+    t = trap_count();
+    c = rdtsc_lo();
+    write_raw();
+    cycles[2] = rdtsc_lo() - c;
+    traps[2] = trap_count() - t;
+
+    t = trap_count();
+    c = rdtsc_lo();
+    write_buffered(ECE391_IOLBF);
+    cycles[3] = rdtsc_lo() - c;
+    traps[3] = trap_count() - t;
+
+    t = trap_count();
+    c = rdtsc_lo();
+    write_buffered(ECE391_IOFBF);
+    cycles[4] = rdtsc_lo() - c;
+    traps[4] = trap_count() - t;
+
+    ece391_printf("%-14s %7s %7s %10s\n", "test", "count", "traps", "cycles");
+    report("read_raw", bytes[0], traps[0], cycles[0]);
+    report("read_getc", bytes[1], traps[1], cycles[1]);
+    report("write_raw", BENCH_LINES, traps[2], cycles[2]);
+    report("printf_line", BENCH_LINES, traps[3], cycles[3]);
+    report("printf_full", BENCH_LINES, traps[4], cycles[4]);
+    return 0;
+}
@@ -0,0 +1,280 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define DEFAULT_HZ 1024
+#define ARG_SIZE 128
+#define USER_BASE 0x08000000
+#define MAX_ELF_SIZE 0x10000
+#define MAX_FUNCS 512
+#define TOP_FUNCS 12
+
+/* ELF32 layout, just the parts needed to walk .symtab */
+#define E_SHOFF 0x20
+#define E_SHENTSIZE 0x2E
+#define E_SHNUM 0x30
+#define SH_TYPE 0x04
+#define SH_OFFSET 0x10
+#define SH_SIZE 0x14
+#define SH_LINK 0x18
+#define SHT_SYMTAB 2
+#define SYM_SIZE 16
+#define STT_FUNC 2
+
+static struct {
+    ece391_prof_header_t header;
+    ece391_prof_entry_t entries[ECE391_PROF_BUCKETS];
+} prof;
+
+static uint8_t elf[MAX_ELF_SIZE];
+static uint32_t elf_size;
+
+/* one bar in the report, a function or a bare address */
+typedef struct func {
+    uint32_t start;
+    uint32_t end;
+    const uint8_t* name;
+    uint32_t count;
+} func_t;
+
+static func_t funcs[MAX_FUNCS];
+static int32_t nfuncs;
+
+static uint32_t get32(uint32_t off)
+{
+    return elf[off] | (elf[off + 1] << 8) | (elf[off + 2] << 16) | ((uint32_t)elf[off + 3] << 24);
+}
+
+static uint32_t get16(uint32_t off)
+{
+    return elf[off] | (elf[off + 1] << 8);
+}
+
+/* reads the whole file into elf, 0 if it is missing */
+static int32_t load_file(const uint8_t* name)
+{
+    int32_t fd, cnt;
+
+    elf_size = 0;
+    if (-1 == (fd = ece391_open(name)))
+        return 0;
+    while (elf_size < MAX_ELF_SIZE &&
+           0 < (cnt = ece391_read(fd, elf + elf_size, MAX_ELF_SIZE - elf_size)))
+        elf_size += cnt;
+    ece391_close(fd);
+    return elf_size != 0;
+}
+
+/*
+ * Fills funcs with the function symbols of the loaded file. Returns 0
+ * when there is no symbol table, which is the case for the stripped
+ * binaries elfconvert puts in to_fsdir.
+ */
+static int32_t load_symbols(void)
+{
+    uint32_t shoff, shentsize, shnum, sh, i;
+    uint32_t symoff, symsize, stroff, sym, name;
+
+    nfuncs = 0;
+    if (elf_size < 0x34 || elf[0] != 0x7F || elf[1] != 'E' || elf[2] != 'L' || elf[3] != 'F')
+        return 0;
+    shoff = get32(E_SHOFF);
+    shentsize = get16(E_SHENTSIZE);
+    shnum = get16(E_SHNUM);
+    if (shoff + shnum * shentsize > elf_size)
+        return 0;
+
+    for (i = 0; i < shnum; i++) {
+        sh = shoff + i * shentsize;
+        if (get32(sh + SH_TYPE) != SHT_SYMTAB)
+            continue;
+        symoff = get32(sh + SH_OFFSET);
+        symsize = get32(sh + SH_SIZE);
+        stroff = get32(shoff + get32(sh + SH_LINK) * shentsize + SH_OFFSET);
+        if (symoff + symsize > elf_size || stroff >= elf_size)
+            return 0;
+
+        for (sym = symoff; sym < symoff + symsize && nfuncs < MAX_FUNCS; sym += SYM_SIZE) {
+            if ((elf[sym + 12] & 0xF) != STT_FUNC)
+                continue;
+            name = stroff + get32(sym);
+            if (name >= elf_size)
+                continue;
+            funcs[nfuncs].start = get32(sym + 4);
+            funcs[nfuncs].end = funcs[nfuncs].start + get32(sym + 8);
+            funcs[nfuncs].name = elf + name;
+            funcs[nfuncs].count = 0;
+            nfuncs++;
+        }
+        return nfuncs != 0;
+    }
+    return 0;
+}
+
+/* charges a sample to the function holding eip, or to its own bar */
+static void add_sample(uint32_t eip, uint32_t count, int32_t have_symbols)
+{
+    int32_t i, best = -1;
+
+    if (have_symbols) {
+        for (i = 0; i < nfuncs; i++) {
+            if (funcs[i].name == 0 || eip < funcs[i].start)
+                continue;
+            if (eip < funcs[i].end) {
+                best = i;
+                break;
+            }
+            // symbols without a size own everything up to the next one
+            if (funcs[i].end == funcs[i].start && (best == -1 || funcs[i].start > funcs[best].start))
+                best = i;
+        }
+        if (best != -1) {
+            funcs[best].count += count;
+            return;
+        }
+    }
+    if (nfuncs < MAX_FUNCS) {
+        funcs[nfuncs].start = eip;
+        funcs[nfuncs].end = eip;
+        funcs[nfuncs].name = 0;
+        funcs[nfuncs].count = count;
+        nfuncs++;
+    }
+}
+
+static void put_num(uint32_t value, int32_t width)
+{
+    uint8_t buf[12];
+    int32_t len;
+
+    ece391_itoa(value, buf, 10);
+    for (len = ece391_strlen(buf); len < width; len++)
+        ece391_fdputs(1, (uint8_t*)" ");
+    ece391_fdputs(1, buf);
+}
+
+/* prints the TOP_FUNCS biggest bars, largest first */
+static void report(uint32_t total)
+{
+    int32_t i, n, best;
+    uint8_t buf[12];
+
+    for (n = 0; n < TOP_FUNCS; n++) {
+        best = -1;
+        for (i = 0; i < nfuncs; i++) {
+            if (funcs[i].count != 0 && (best == -1 || funcs[i].count > funcs[best].count))
+                best = i;
+        }
+        if (best == -1)
+            return;
+        put_num(funcs[best].count, 8);
+        put_num(funcs[best].count * 100 / total, 5);
+        ece391_fdputs(1, (uint8_t*)"%  ");
+        if (funcs[best].name != 0) {
+            ece391_fdputs(1, funcs[best].name);
+        } else {
+            ece391_fdputs(1, (uint8_t*)"0x");
+            ece391_fdputs(1, ece391_itoa(funcs[best].start, buf, 16));
+        }
+        ece391_fdputs(1, (uint8_t*)"\n");
+        funcs[best].count = 0;
+    }
+}
+
+/* reports the samples of one program, user code by function */
+static void report_prog(uint32_t prog)
+{
+    uint8_t name[ECE391_NAME_SIZE + 8];
+    uint32_t i, total = 0, kernel = 0;
+    int32_t have_symbols;
+
+    for (i = 0; i < prof.header.nentries; i++) {
+        if (prof.entries[i].prog != prog)
+            continue;
+        total += prof.entries[i].count;
+        if (prof.entries[i].eip < USER_BASE)
+            kernel += prof.entries[i].count;
+    }
+    if (total == 0)
+        return;
+
+    ece391_fdputs(1, (uint8_t*)"\n");
+    ece391_fdputs(1, prog == ECE391_PROF_NO_PROG ? (uint8_t*)"(no process)" : prof.header.progs[prog]);
+    ece391_fdputs(1, (uint8_t*)": ");
+    put_num(total, 0);
+    ece391_fdputs(1, (uint8_t*)" samples, ");
+    put_num(kernel, 0);
+    ece391_fdputs(1, (uint8_t*)" in the kernel\n");
+    if (kernel == total)
+        return;
+
+    // "make symbols" puts unstripped copies next to the programs
+    have_symbols = 0;
+    if (prog != ECE391_PROF_NO_PROG) {
+        ece391_strcpy(name, prof.header.progs[prog]);
+        ece391_strcpy(name + ece391_strlen(name), (uint8_t*)".sym");
+        if (load_file(name) || load_file(prof.header.progs[prog]))
+            have_symbols = load_symbols();
+    }
+    if (!have_symbols)
+        ece391_fdputs(1, (uint8_t*)"  no symbols, showing addresses\n");
+
+    nfuncs = have_symbols ? nfuncs : 0;
+    for (i = 0; i < prof.header.nentries; i++) {
+        if (prof.entries[i].prog == prog && prof.entries[i].eip >= USER_BASE)
+            add_sample(prof.entries[i].eip, prof.entries[i].count, have_symbols);
+    }
+    report(total);
+}
+
+/*
+ * Runs a command under the sampling profiler and prints its hot
+ * functions:  prof [hz] command [args]
+ * hz is a power of 2 up to 8192, 0 samples on the scheduler tick.
+ */
+int main ()
+{
+    uint8_t args[ARG_SIZE];
+    uint8_t* cmd = args;
+    uint32_t hz = DEFAULT_HZ, prog;
+    int32_t ret;
+
+    if (0 != ece391_getargs(args, ARG_SIZE)) {
+        ece391_fdputs(1, (uint8_t*)"usage: prof [hz] command [args]\n");
+        return 3;
+    }
+    if (*cmd >= '0' && *cmd <= '9') {
+        for (hz = 0; *cmd >= '0' && *cmd <= '9'; cmd++)
+            hz = hz * 10 + (*cmd - '0');
+        while (*cmd == ' ')
+            cmd++;
+    }
+    if (*cmd == '\0') {
+        ece391_fdputs(1, (uint8_t*)"usage: prof [hz] command [args]\n");
+        return 3;
+    }
+
+    ece391_profile(ECE391_PROF_RESET, 0, 0);
+    if (-1 == ece391_profile(ECE391_PROF_START, 0, hz)) {
+        ece391_fdputs(1, (uint8_t*)"bad rate\n");
+        return 3;
+    }
+    ret = ece391_execute(cmd);
+    ece391_profile(ECE391_PROF_STOP, 0, 0);
+    if (-1 == ece391_profile(ECE391_PROF_READ, &prof, sizeof(prof))) {
+        ece391_fdputs(1, (uint8_t*)"profile read failed\n");
+        return 3;
+    }
+    if (-1 == ret)
+        ece391_fdputs(1, (uint8_t*)"no such command\n");
+
+    put_num(prof.header.samples, 0);
+    ece391_fdputs(1, (uint8_t*)" samples, ");
+    put_num(prof.header.dropped, 0);
+    ece391_fdputs(1, (uint8_t*)" dropped\n");
+    for (prog = 0; prog < prof.header.nprogs; prog++)
+        report_prog(prog);
+    report_prog(ECE391_PROF_NO_PROG);
+    return 0;
+}
@@ -2,35 +2,314 @@
 
 #include "ece391support.h"
 #include "ece391syscall.h"
+#include "ece391stdio.h"
 
 #define BUFSIZE 1024
+#define SBUFSIZE 33
+
+/* the boot block holds at most 63 directory entries */
+#define MAX_CMDS 63
+/* commands kept for history and !n */
+#define HIST_SIZE 16
+/* run_line's answer to exit */
+#define EXIT_SHELL (-2)
+
+/*
+ * Names in the file system, read once at startup and again on rehash.
+ * The file system is read only, so a name that is not here cannot be run
+ * and the shell says so without asking the kernel.
+ */
+static uint8_t cmd_names[MAX_CMDS][SBUFSIZE];
+static int32_t num_cmds;
+
+/* history ring, entry n lives at (n - 1) % HIST_SIZE */
+static uint8_t history[HIST_SIZE][BUFSIZE];
+static uint32_t hist_count;
+
+/* what getstats returns, only the header is used */
+static ece391_stats_header_t stats_header;
+
+static int32_t run_line (uint8_t* buf);
+static int32_t run_script (const uint8_t* name);
+
+typedef struct builtin {
+    const char* name;
+    int32_t (*run) (uint8_t* args);
+} builtin_t;
+
+static int32_t
+load_cmds (void)
+{
+    int32_t fd, cnt;
+
+    num_cmds = 0;
+    if (-1 == (fd = ece391_open ((uint8_t*)"."))) {
+        ece391_fputs ((uint8_t*)"directory open failed\n", ece391_stdout);
+	return -1;
+    }
+    while (num_cmds < MAX_CMDS &&
+           0 != (cnt = ece391_read (fd, cmd_names[num_cmds], SBUFSIZE-1))) {
+        if (-1 == cnt) {
+	    ece391_fputs ((uint8_t*)"directory entry read failed\n", ece391_stdout);
+	    break;
+	}
+	cmd_names[num_cmds++][cnt] = '\0';
+    }
+    ece391_close (fd);
+    return 0;
+}
+
+/* The name is the first word of the command line */
+static int32_t
+known_cmd (const uint8_t* line)
+{
+    uint8_t name[SBUFSIZE];
+    int32_t i;
+
+    for (i = 0; i < SBUFSIZE-1 && '\0' != line[i] && ' ' != line[i]; i++)
+        name[i] = line[i];
+    if (i == SBUFSIZE-1 && '\0' != line[i] && ' ' != line[i])
+        return 0;
+    name[i] = '\0';
+    for (i = 0; i < num_cmds; i++) {
+        if (0 == ece391_strcmp (cmd_names[i], name))
+	    return 1;
+    }
+    return 0;
+}
+
+static int32_t
+builtin_rehash (uint8_t* args)
+{
+    return load_cmds ();
+}
+
+/* Same listing as the ls program, out of the cache */
+static int32_t
+builtin_ls (uint8_t* args)
+{
+    int32_t i;
+
+    for (i = 0; i < num_cmds; i++)
+        ece391_printf ("%s\n", cmd_names[i]);
+    return 0;
+}
+
+static int32_t
+builtin_echo (uint8_t* args)
+{
+    ece391_printf ("%s\n", args);
+    return 0;
+}
+
+static int32_t
+builtin_clear (uint8_t* args)
+{
+    ece391_putchar ('\f');
+    return 0;
+}
+
+static int32_t
+builtin_history (uint8_t* args)
+{
+    uint32_t n;
+
+    n = (hist_count > HIST_SIZE) ? hist_count - HIST_SIZE + 1 : 1;
+    for (; n <= hist_count; n++)
+        ece391_printf ("%4u  %s\n", n, history[(n - 1) % HIST_SIZE]);
+    return 0;
+}
+
+/* Runs the rest of the line and reports how long it took */
+static int32_t
+builtin_time (uint8_t* args)
+{
+    uint32_t ticks, lo, hi, rem, q1, q2;
+    int32_t rval;
+
+    if (-1 == ece391_getstats (&stats_header, sizeof (stats_header))) {
+        ece391_fputs ((uint8_t*)"time: no clock\n", ece391_stdout);
+	return run_line (args);
+    }
+    ticks = stats_header.ticks;
+    lo = stats_header.tsc_lo;
+    hi = stats_header.tsc_hi;
+
+    rval = run_line (args);
+
+    (void)ece391_getstats (&stats_header, sizeof (stats_header));
+    ticks = stats_header.ticks - ticks;
+    hi = stats_header.tsc_hi - hi - (stats_header.tsc_lo < lo);
+    lo = stats_header.tsc_lo - lo;
+    /* hi:lo / 1000 in 16 bit steps, there is no 64 bit divide here */
+    rem = hi % 1000;
+    q1 = ((rem << 16) | (lo >> 16)) / 1000;
+    rem = ((rem << 16) | (lo >> 16)) % 1000;
+    q2 = ((rem << 16) | (lo & 0xFFFF)) / 1000;
+    ece391_printf ("time: %u ticks (%u ms), %u kcycles\n", ticks,
+                   ticks * (ECE391_TICK_USEC / 100) / 10, (q1 << 16) + q2);
+    return rval;
+}
+
+static int32_t
+builtin_source (uint8_t* args)
+{
+    return run_script (args);
+}
+
+static const builtin_t builtins[] = {
+    { "ls", builtin_ls },
+    { "echo", builtin_echo },
+    { "clear", builtin_clear },
+    { "history", builtin_history },
+    { "rehash", builtin_rehash },
+    { "time", builtin_time },
+    { "source", builtin_source },
+};
+
+#define NUM_BUILTINS (sizeof (builtins) / sizeof (builtins[0]))
+
+/* Returns the builtin named by the first word of line, args gets the rest */
+static const builtin_t*
+find_builtin (uint8_t* line, uint8_t** args)
+{
+    uint32_t i, len;
+
+    for (i = 0; i < NUM_BUILTINS; i++) {
+        len = ece391_strlen ((uint8_t*)builtins[i].name);
+	if (0 != ece391_strncmp (line, (uint8_t*)builtins[i].name, len))
+	    continue;
+	if ('\0' != line[len] && ' ' != line[len])
+	    continue;
+	for (*args = line + len; ' ' == **args; (*args)++);
+	return &builtins[i];
+    }
+    return (const builtin_t*)0;
+}
+
+/*
+ * Replaces a !n or !! line with the command from history and echoes it.
+ * Returns -1 if that command is no longer kept.
+ */
+static int32_t
+recall (uint8_t* buf)
+{
+    uint32_t n = 0;
+    uint8_t* p;
+
+    if ('!' == buf[1] && '\0' == buf[2]) {
+        n = hist_count;
+    } else {
+        for (p = buf + 1; *p >= '0' && *p <= '9'; p++)
+	    n = n * 10 + (*p - '0');
+	if (p == buf + 1 || '\0' != *p)
+	    n = 0;
+    }
+    if (0 == n || n > hist_count || n + HIST_SIZE <= hist_count) {
+        ece391_fputs ((uint8_t*)"no such history entry\n", ece391_stdout);
+	return -1;
+    }
+    ece391_strcpy (buf, history[(n - 1) % HIST_SIZE]);
+    ece391_printf ("%s\n", buf);
+    return 0;
+}
+
+static void
+add_history (const uint8_t* buf)
+{
+    ece391_strcpy (history[hist_count % HIST_SIZE], buf);
+    hist_count++;
+}
+
+/*
+ * Runs one command line, a builtin or a program. Returns the status,
+ * EXIT_SHELL for exit.
+ */
+static int32_t
+run_line (uint8_t* buf)
+{
+    int32_t rval;
+    uint8_t* args;
+    const builtin_t* b;
+
+    if (0 == ece391_strcmp (buf, (uint8_t*)"exit"))
+        return EXIT_SHELL;
+    if ('\0' == buf[0])
+        return 0;
+
+    if ((const builtin_t*)0 != (b = find_builtin (buf, &args)))
+        return b->run (args);
+    if (!known_cmd (buf)) {
+        ece391_fputs ((uint8_t*)"no such command\n", ece391_stdout);
+	return -1;
+    }
+    ece391_fflush (ece391_stdout);
+    rval = ece391_execute (buf);
+    if (-1 == rval)
+        ece391_fputs ((uint8_t*)"no such command\n", ece391_stdout);
+    else if (256 == rval)
+        ece391_fputs ((uint8_t*)"program terminated by exception\n", ece391_stdout);
+    else if (0 != rval)
+        ece391_fputs ((uint8_t*)"program terminated abnormally\n", ece391_stdout);
+    return rval;
+}
+
+/*
+ * Runs the commands in a file one line at a time, skipping blank lines
+ * and # comments. Stops at exit, returns the last command's status.
+ */
+static int32_t
+run_script (const uint8_t* name)
+{
+    ece391_file_t* f;
+    uint8_t line[BUFSIZE];
+    int32_t cnt, rval = 0;
+
+    if ((ece391_file_t*)0 == (f = ece391_fopen (name))) {
+        ece391_printf ("cannot open script %s\n", name);
+	return -1;
+    }
+    while (-1 != (cnt = ece391_getline (line, BUFSIZE, f))) {
+        if (cnt > 0 && '\n' == line[cnt - 1])
+	    line[--cnt] = '\0';
+	if ('#' == line[0] || '\0' == line[0])
+	    continue;
+	if (EXIT_SHELL == (rval = run_line (line)))
+	    break;
+    }
+    ece391_fclose (f);
+    return rval;
+}
 
 int main ()
 {
     int32_t cnt, rval;
     uint8_t buf[BUFSIZE];
-    ece391_fdputs (1, (uint8_t*)"Starting 391 Shell: hi Ary\n");
 
+    load_cmds ();
+
+    /* shell <script> runs the script and exits with its last status */
+    if (0 == ece391_getargs (buf, BUFSIZE) && '\0' != buf[0]) {
+        rval = run_script (buf);
+	return (EXIT_SHELL == rval) ? 0 : rval & 0xFF;
+    }
+
+    ece391_fdputs (1, (uint8_t*)"Starting 391 Shell: hi Ary\n");
     while (1) {
-        ece391_fdputs (1, (uint8_t*)"391OS> ");
+        ece391_fputs ((uint8_t*)"391OS> ", ece391_stdout);
+	ece391_fflush (ece391_stdout);
 	if (-1 == (cnt = ece391_read (0, buf, BUFSIZE-1))) {
-	    ece391_fdputs (1, (uint8_t*)"read from keyboard failed\n");
+	    ece391_fputs ((uint8_t*)"read from keyboard failed\n", ece391_stdout);
 	    return 3;
 	}
 	if (cnt > 0 && '\n' == buf[cnt - 1])
 	    cnt--;
 	buf[cnt] = '\0';
-	if (0 == ece391_strcmp (buf, (uint8_t*)"exit"))
-	    return 0;
-	if ('\0' == buf[0])
+	if ('!' == buf[0] && -1 == recall (buf))
 	    continue;
-	rval = ece391_execute (buf);
-	if (-1 == rval)
-	    ece391_fdputs (1, (uint8_t*)"no such command\n");
-	else if (256 == rval)
-	    ece391_fdputs (1, (uint8_t*)"program terminated by exception\n");
-	else if (0 != rval)
-	    ece391_fdputs (1, (uint8_t*)"program terminated abnormally\n");
+	if ('\0' != buf[0] && 0 != ece391_strcmp (buf, (uint8_t*)"exit"))
+	    add_history (buf);
+	if (EXIT_SHELL == run_line (buf))
+	    return 0;
     }
 }
-
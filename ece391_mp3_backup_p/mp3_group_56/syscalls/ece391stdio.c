@@ -0,0 +1,397 @@
+#include <stdint.h>
+#include <stdarg.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+#include "ece391stdio.h"
+
+#define NULL_FILE ((ece391_file_t*)0)
+
+/* slots 0 and 1 are stdin and stdout, the rest are handed out by fopen */
+static ece391_file_t files[ECE391_FOPEN_MAX] = {
+    { 0, 1, ECE391_IOLBF },
+    { 1, 1, ECE391_IOLBF },
+};
+
+ece391_file_t* const ece391_stdin = &files[0];
+ece391_file_t* const ece391_stdout = &files[1];
+
+ece391_file_t* ece391_fopen(const uint8_t* name)
+{
+    int32_t i, fd;
+
+    for (i = 0; i < ECE391_FOPEN_MAX && files[i].in_use; i++);
+    if (i == ECE391_FOPEN_MAX)
+        return NULL_FILE;
+    if (-1 == (fd = ece391_open(name)))
+        return NULL_FILE;
+
+    files[i].fd = fd;
+    files[i].in_use = 1;
+    files[i].mode = ECE391_IOFBF;
+    files[i].writing = 0;
+    files[i].eof = 0;
+    files[i].err = 0;
+    files[i].pos = 0;
+    files[i].len = 0;
+    return &files[i];
+}
+
+int32_t ece391_fclose(ece391_file_t* f)
+{
+    int32_t ret;
+
+    ret = ece391_fflush(f);
+    if (-1 == ece391_close(f->fd))
+        ret = -1;
+    f->in_use = 0;
+    return ret;
+}
+
+int32_t ece391_setvbuf(ece391_file_t* f, int32_t mode)
+{
+    if (mode != ECE391_IONBF && mode != ECE391_IOLBF && mode != ECE391_IOFBF)
+        return -1;
+    if (-1 == ece391_fflush(f))
+        return -1;
+    f->mode = mode;
+    return 0;
+}
+
+/* Writes out whatever a writing stream has queued. The terminal takes
+ * everything at once, but a short write is retried anyway. */
+int32_t ece391_fflush(ece391_file_t* f)
+{
+    uint32_t done = 0;
+    int32_t cnt;
+
+    if (NULL_FILE == f) {
+        ece391_flushall();
+        return 0;
+    }
+    if (!f->writing)
+        return 0;
+    while (done < f->pos) {
+        cnt = ece391_write(f->fd, f->buf + done, f->pos - done);
+        if (cnt <= 0) {
+            f->err = 1;
+            f->pos = 0;
+            return -1;
+        }
+        done += cnt;
+    }
+    f->pos = 0;
+    return 0;
+}
+
+void ece391_flushall(void)
+{
+    int32_t i;
+
+    for (i = 0; i < ECE391_FOPEN_MAX; i++) {
+        if (files[i].in_use)
+            (void)ece391_fflush(&files[i]);
+    }
+}
+
+void ece391_exit(uint8_t status)
+{
+    ece391_flushall();
+    (void)ece391_halt(status);
+}
+
+/* Refills an empty read buffer, returns the bytes now in it, 0 at the end
+ * of the file and -1 on an error. A read of the keyboard shows the prompt
+ * first. */
+static int32_t fill(ece391_file_t* f)
+{
+    int32_t cnt;
+
+    if (f->writing) {
+        if (-1 == ece391_fflush(f))
+            return -1;
+        f->writing = 0;
+    }
+    if (f->eof)
+        return 0;
+    if (0 == f->fd)
+        (void)ece391_fflush(ece391_stdout);
+
+    f->pos = 0;
+    f->len = 0;
+    cnt = ece391_read(f->fd, f->buf, ECE391_BUFSIZ);
+    if (cnt < 0) {
+        f->err = 1;
+        return -1;
+    }
+    // the keyboard never runs out, an empty line is just a newline
+    if (0 == cnt)
+        f->eof = 1;
+    f->len = cnt;
+    return cnt;
+}
+
+int32_t ece391_fgetc(ece391_file_t* f)
+{
+    if (f->writing || f->pos == f->len) {
+        if (fill(f) <= 0)
+            return ECE391_EOF;
+    }
+    return f->buf[f->pos++];
+}
+
+/* Reads up to and including the next newline, at most size - 1 bytes,
+ * and terminates the line. Returns its length, -1 at the end of the file
+ * or on an error when nothing was read. */
+int32_t ece391_getline(uint8_t* line, int32_t size, ece391_file_t* f)
+{
+    int32_t n = 0;
+    uint8_t c;
+
+    if (size <= 0)
+        return -1;
+    while (n < size - 1) {
+        if (f->writing || f->pos == f->len) {
+            if (fill(f) <= 0)
+                break;
+        }
+        // scan what is buffered without going back through fgetc
+        while (f->pos < f->len && n < size - 1) {
+            c = f->buf[f->pos++];
+            line[n++] = c;
+            if ('\n' == c) {
+                line[n] = '\0';
+                return n;
+            }
+        }
+    }
+    line[n] = '\0';
+    return (0 == n) ? -1 : n;
+}
+
+/* Hands out what is buffered, then reads big requests straight into buf */
+int32_t ece391_fread(void* buf, int32_t nbytes, ece391_file_t* f)
+{
+    uint8_t* dst = buf;
+    int32_t n = 0, cnt;
+
+    while (n < nbytes) {
+        if (!f->writing && f->pos < f->len) {
+            cnt = f->len - f->pos;
+            if (cnt > nbytes - n)
+                cnt = nbytes - n;
+            ece391_memcpy(dst + n, f->buf + f->pos, cnt);
+            f->pos += cnt;
+            n += cnt;
+        } else if (nbytes - n >= ECE391_BUFSIZ && !f->writing && !f->eof) {
+            if (0 == f->fd)
+                (void)ece391_fflush(ece391_stdout);
+            cnt = ece391_read(f->fd, dst + n, nbytes - n);
+            if (cnt < 0) {
+                f->err = 1;
+                break;
+            }
+            if (0 == cnt) {
+                f->eof = 1;
+                break;
+            }
+            n += cnt;
+        } else if (fill(f) <= 0) {
+            break;
+        }
+    }
+    return (0 == n && f->err) ? -1 : n;
+}
+
+/* Switches a stream to output, dropping any unread input */
+static void start_writing(ece391_file_t* f)
+{
+    if (!f->writing) {
+        f->writing = 1;
+        f->pos = 0;
+        f->len = 0;
+    }
+}
+
+int32_t ece391_fwrite(const void* buf, int32_t nbytes, ece391_file_t* f)
+{
+    const uint8_t* src = buf;
+    int32_t n = 0, cnt, i, newline = 0;
+
+    if (nbytes <= 0)
+        return 0;
+    start_writing(f);
+    if (ECE391_IONBF == f->mode) {
+        if (-1 == ece391_fflush(f))
+            return -1;
+        return ece391_write(f->fd, buf, nbytes);
+    }
+
+    while (n < nbytes) {
+        cnt = ECE391_BUFSIZ - f->pos;
+        if (cnt > nbytes - n)
+            cnt = nbytes - n;
+        ece391_memcpy(f->buf + f->pos, src + n, cnt);
+        f->pos += cnt;
+        n += cnt;
+        if (ECE391_BUFSIZ == f->pos && -1 == ece391_fflush(f))
+            return -1;
+    }
+
+    if (ECE391_IOLBF == f->mode) {
+        for (i = 0; i < nbytes && !newline; i++)
+            newline = ('\n' == src[i]);
+        if (newline && -1 == ece391_fflush(f))
+            return -1;
+    }
+    return nbytes;
+}
+
+int32_t ece391_fputc(int32_t c, ece391_file_t* f)
+{
+    uint8_t ch = (uint8_t)c;
+
+    if (f->writing && f->mode != ECE391_IONBF && f->pos < ECE391_BUFSIZ - 1 && '\n' != ch) {
+        f->buf[f->pos++] = ch;
+        return ch;
+    }
+    return (1 == ece391_fwrite(&ch, 1, f)) ? ch : ECE391_EOF;
+}
+
+int32_t ece391_fputs(const uint8_t* s, ece391_file_t* f)
+{
+    return ece391_fwrite(s, ece391_strlen(s), f);
+}
+
+/* Writes value in the given radix into the end of buf, returns the first digit */
+static uint8_t* format_num(uint32_t value, uint32_t radix, int32_t upper, uint8_t* end)
+{
+    static const char lower_digits[] = "0123456789abcdef";
+    static const char upper_digits[] = "0123456789ABCDEF";
+    const char* digits = upper ? upper_digits : lower_digits;
+
+    *end = '\0';
+    do {
+        *--end = digits[value % radix];
+        value /= radix;
+    } while (value != 0);
+    return end;
+}
+
+/* Pads s to width with spaces, or zeros before the digits */
+static int32_t put_field(ece391_file_t* f, const uint8_t* s, int32_t len, int32_t width,
+                         int32_t left, int32_t zero, int32_t negative)
+{
+    int32_t pad = width - len - negative;
+    int32_t out = 0;
+    uint8_t fill_char = zero ? '0' : ' ';
+
+    if (negative && zero) {
+        ece391_fputc('-', f);
+        out++;
+    }
+    for (; !left && pad > 0; pad--, out++)
+        ece391_fputc(fill_char, f);
+    if (negative && !zero) {
+        ece391_fputc('-', f);
+        out++;
+    }
+    ece391_fwrite(s, len, f);
+    out += len;
+    for (; left && pad > 0; pad--, out++)
+        ece391_fputc(' ', f);
+    return out;
+}
+
+/* Understands %d %i %u %x %X %c %s %% with the - and 0 flags and a width */
+int32_t ece391_vfprintf(ece391_file_t* f, const char* fmt, va_list ap)
+{
+    uint8_t num[12];
+    const uint8_t* s;
+    uint8_t c;
+    int32_t out = 0, left, zero, width, negative, val;
+
+    for (; *fmt != '\0'; fmt++) {
+        if (*fmt != '%') {
+            ece391_fputc(*fmt, f);
+            out++;
+            continue;
+        }
+        fmt++;
+        left = zero = width = negative = 0;
+        for (; *fmt == '-' || *fmt == '0'; fmt++) {
+            if (*fmt == '-')
+                left = 1;
+            else
+                zero = 1;
+        }
+        for (; *fmt >= '0' && *fmt <= '9'; fmt++)
+            width = width * 10 + (*fmt - '0');
+        if (left)
+            zero = 0;
+
+        switch (*fmt) {
+            case 'd':
+            case 'i':
+                val = va_arg(ap, int32_t);
+                negative = (val < 0);
+                s = format_num(negative ? -(uint32_t)val : (uint32_t)val, 10, 0, num + sizeof(num) - 1);
+                break;
+            case 'u':
+                s = format_num(va_arg(ap, uint32_t), 10, 0, num + sizeof(num) - 1);
+                break;
+            case 'x':
+            case 'X':
+                s = format_num(va_arg(ap, uint32_t), 16, *fmt == 'X', num + sizeof(num) - 1);
+                break;
+            case 'c':
+                c = (uint8_t)va_arg(ap, int32_t);
+                num[0] = c;
+                num[1] = '\0';
+                s = num;
+                zero = 0;
+                break;
+            case 's':
+                s = va_arg(ap, const uint8_t*);
+                zero = 0;
+                break;
+            case '%':
+                ece391_fputc('%', f);
+                out++;
+                continue;
+            default:
+                // unknown conversion, print it as it was written
+                ece391_fputc('%', f);
+                out++;
+                if (*fmt == '\0')
+                    return out;
+                ece391_fputc(*fmt, f);
+                out++;
+                continue;
+        }
+        out += put_field(f, s, ('c' == *fmt) ? 1 : ece391_strlen(s), width, left, zero, negative);
+    }
+    return out;
+}
+
+int32_t ece391_fprintf(ece391_file_t* f, const char* fmt, ...)
+{
+    va_list ap;
+    int32_t ret;
+
+    va_start(ap, fmt);
+    ret = ece391_vfprintf(f, fmt, ap);
+    va_end(ap);
+    return ret;
+}
+
+int32_t ece391_printf(const char* fmt, ...)
+{
+    va_list ap;
+    int32_t ret;
+
+    va_start(ap, fmt);
+    ret = ece391_vfprintf(ece391_stdout, fmt, ap);
+    va_end(ap);
+    return ret;
+}
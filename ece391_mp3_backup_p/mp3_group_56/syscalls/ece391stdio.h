@@ -0,0 +1,65 @@
+#if !defined(ECE391STDIO_H)
+#define ECE391STDIO_H
+
+#include <stdint.h>
+#include <stdarg.h>
+
+/* bytes buffered per stream */
+#define ECE391_BUFSIZ 1024
+/* streams open at once, stdin and stdout included, same as the fd table */
+#define ECE391_FOPEN_MAX 8
+#define ECE391_EOF (-1)
+
+/* buffering modes for ece391_setvbuf */
+#define ECE391_IONBF 0      /* every write is a system call */
+#define ECE391_IOLBF 1      /* flushed at each newline and when full */
+#define ECE391_IOFBF 2      /* flushed only when full */
+
+/*
+ * A buffered stream. Reads fill buf with one system call and hand it out
+ * a byte at a time; writes collect in buf until the buffering mode says
+ * to flush. The file system is read only, so streams from ece391_fopen
+ * are for reading and only stdout is normally written.
+ */
+typedef struct ece391_file {
+    int32_t fd;
+    int32_t in_use;
+    int32_t mode;           /* ECE391_IO*BF */
+    int32_t writing;        /* buf holds output waiting for a flush */
+    int32_t eof;
+    int32_t err;
+    uint32_t pos;           /* next byte to hand out, or bytes queued */
+    uint32_t len;           /* bytes in buf when reading */
+    uint8_t buf[ECE391_BUFSIZ];
+} ece391_file_t;
+
+extern ece391_file_t* const ece391_stdin;
+extern ece391_file_t* const ece391_stdout;
+
+extern ece391_file_t* ece391_fopen(const uint8_t* name);
+extern int32_t ece391_fclose(ece391_file_t* f);
+extern int32_t ece391_setvbuf(ece391_file_t* f, int32_t mode);
+extern int32_t ece391_fflush(ece391_file_t* f);
+extern void ece391_flushall(void);
+
+extern int32_t ece391_fgetc(ece391_file_t* f);
+extern int32_t ece391_getline(uint8_t* line, int32_t size, ece391_file_t* f);
+extern int32_t ece391_fread(void* buf, int32_t nbytes, ece391_file_t* f);
+
+extern int32_t ece391_fputc(int32_t c, ece391_file_t* f);
+extern int32_t ece391_fputs(const uint8_t* s, ece391_file_t* f);
+extern int32_t ece391_fwrite(const void* buf, int32_t nbytes, ece391_file_t* f);
+extern int32_t ece391_printf(const char* fmt, ...);
+extern int32_t ece391_fprintf(ece391_file_t* f, const char* fmt, ...);
+extern int32_t ece391_vfprintf(ece391_file_t* f, const char* fmt, va_list ap);
+
+/* Flushes every stream, then halts. main returning does the same. */
+extern void ece391_exit(uint8_t status);
+
+/* getc/putc without a call while the buffer has room */
+#define ece391_getc(f) \
+    (((f)->pos < (f)->len && !(f)->writing) ? (int32_t)(f)->buf[(f)->pos++] : ece391_fgetc(f))
+#define ece391_getchar() ece391_getc(ece391_stdin)
+#define ece391_putchar(c) ece391_fputc((c), ece391_stdout)
+
+#endif /* ECE391STDIO_H */
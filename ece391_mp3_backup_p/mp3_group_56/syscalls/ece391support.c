@@ -102,3 +102,13 @@ uint8_t* ece391_strrev(uint8_t* s)
    return s;
 }
 
+/* Byte copy for the stdio buffers, dst and src must not overlap */
+void* ece391_memcpy(void* dst, const void* src, uint32_t n)
+{
+    uint8_t* d = dst;
+    const uint8_t* s = src;
+
+    while (n-- > 0)
+        *d++ = *s++;
+    return dst;
+}
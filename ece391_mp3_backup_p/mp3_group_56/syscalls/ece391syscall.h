@@ -21,6 +21,39 @@ extern int32_t ece391_getargs (uint8_t* buf, int32_t nbytes);
 extern int32_t ece391_vidmap (uint8_t** screen_start);
 extern int32_t ece391_set_handler (int32_t signum, void* handler);
 extern int32_t ece391_sigreturn (void);
+extern int32_t ece391_getstats (void* buf, int32_t nbytes);
+extern int32_t ece391_profile (int32_t cmd, void* buf, int32_t arg);
+
+/* getstats fills buf with a header followed by one record per process */
+#define ECE391_NAME_SIZE 32
+#define ECE391_SYSCALL_SLOTS 16
+/* microseconds per PIT tick, a count of 30000 at 1193182 Hz */
+#define ECE391_TICK_USEC 25143
+
+typedef struct ece391_stats_header {
+    uint32_t ticks;         /* PIT ticks since boot */
+    uint32_t tsc_lo;
+    uint32_t tsc_hi;
+    uint32_t nprocs;        /* live processes, even ones that did not fit */
+    uint32_t pool_hits;     /* executes that found a zeroed frame */
+    uint32_t pool_misses;   /* executes that zeroed their own */
+    uint32_t pool_zeroed;   /* frames zeroed while idle */
+    uint32_t pool_saved_mcycles;
+} ece391_stats_header_t;
+
+typedef struct ece391_proc_stats {
+    int32_t pid;
+    int32_t parent_pid;
+    int32_t terminal;
+    uint8_t name[ECE391_NAME_SIZE];
+    uint64_t user_cycles;
+    uint64_t kernel_cycles;
+    uint32_t switches;
+    uint32_t page_faults;
+    uint32_t bytes_read;
+    uint32_t bytes_written;
+    uint32_t syscalls[ECE391_SYSCALL_SLOTS];
+} ece391_proc_stats_t;
 
 enum signums {
 	DIV_ZERO = 0,
@@ -31,5 +64,31 @@ enum signums {
 	NUM_SIGNALS
 };
 
+/* profile commands, arg is the rate for START and the size of buf for READ */
+#define ECE391_PROF_START 0
+#define ECE391_PROF_STOP  1
+#define ECE391_PROF_RESET 2
+#define ECE391_PROF_READ  3
+#define ECE391_PROF_MAX_PROGS 32
+#define ECE391_PROF_BUCKETS 2048
+#define ECE391_PROF_NO_PROG 0xFF
+
+/* PROF_READ writes the header then nentries ece391_prof_entry_t */
+typedef struct ece391_prof_header {
+    uint32_t hz;
+    uint32_t running;
+    uint32_t samples;
+    uint32_t dropped;
+    uint32_t nprogs;
+    uint32_t nentries;
+    uint8_t progs[ECE391_PROF_MAX_PROGS][ECE391_NAME_SIZE];
+} ece391_prof_header_t;
+
+typedef struct ece391_prof_entry {
+    uint32_t eip;
+    uint32_t prog;      /* index into progs */
+    uint32_t count;
+} ece391_prof_entry_t;
+
 #endif /* ECE391SYSCALL_H */
 
@@ -0,0 +1,182 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define NUM_COLS 80
+#define NUM_ROWS 25
+#define MAX_PROCS 6
+#define ATTRIB 0x07
+#define HEADER_ATTRIB 0x70
+#define REFRESH_HZ 2
+#define DEFAULT_REFRESHES 20
+
+static uint8_t* video;
+
+/* what getstats returns, header first */
+static struct {
+    ece391_stats_header_t header;
+    ece391_proc_stats_t procs[MAX_PROCS];
+} stats;
+
+/* the last sample of each pid, to turn totals into rates */
+static uint32_t last_user[MAX_PROCS];
+static uint32_t last_kernel[MAX_PROCS];
+static uint32_t last_syscalls[MAX_PROCS];
+static uint32_t last_tsc;
+
+/* writes s at (x, y) with the given attribute, returns the next column */
+static int32_t draw(int32_t x, int32_t y, const uint8_t* s, uint8_t attrib)
+{
+    while (*s != '\0' && x < NUM_COLS) {
+        video[(y * NUM_COLS + x) << 1] = *s++;
+        video[((y * NUM_COLS + x) << 1) + 1] = attrib;
+        x++;
+    }
+    return x;
+}
+
+/* draws value right aligned in a field of width ending at column x */
+static void draw_num(int32_t x, int32_t y, uint32_t value, int32_t width)
+{
+    uint8_t buf[12];
+    int32_t len;
+
+    ece391_itoa(value, buf, 10);
+    len = ece391_strlen(buf);
+    draw(x + width - len, y, buf, ATTRIB);
+}
+
+static void clear_row(int32_t y, uint8_t attrib)
+{
+    int32_t x;
+    for (x = 0; x < NUM_COLS; x++) {
+        video[(y * NUM_COLS + x) << 1] = ' ';
+        video[((y * NUM_COLS + x) << 1) + 1] = attrib;
+    }
+}
+
+/* share of elapsed in percent, without 64-bit division */
+static uint32_t percent(uint32_t part, uint32_t elapsed)
+{
+    elapsed /= 100;
+    if (elapsed == 0)
+        return 0;
+    part /= elapsed;
+    return part > 100 ? 100 : part;
+}
+
+static void refresh(void)
+{
+    int32_t i, j, n, row;
+    uint32_t elapsed, user, kernel, calls;
+    ece391_proc_stats_t* p;
+    uint8_t buf[12];
+
+    if (-1 == ece391_getstats(&stats, sizeof(stats)))
+        return;
+    elapsed = stats.header.tsc_lo - last_tsc;
+    last_tsc = stats.header.tsc_lo;
+    n = stats.header.nprocs < MAX_PROCS ? stats.header.nprocs : MAX_PROCS;
+
+    clear_row(0, ATTRIB);
+    j = draw(0, 0, (uint8_t*)"top - ticks ", ATTRIB);
+    ece391_itoa(stats.header.ticks, buf, 10);
+    j = draw(j, 0, buf, ATTRIB);
+    j = draw(j, 0, (uint8_t*)", processes ", ATTRIB);
+    ece391_itoa(stats.header.nprocs, buf, 10);
+    draw(j, 0, buf, ATTRIB);
+
+    clear_row(1, ATTRIB);
+    j = draw(0, 1, (uint8_t*)"zero pool - hits ", ATTRIB);
+    ece391_itoa(stats.header.pool_hits, buf, 10);
+    j = draw(j, 1, buf, ATTRIB);
+    j = draw(j, 1, (uint8_t*)", misses ", ATTRIB);
+    ece391_itoa(stats.header.pool_misses, buf, 10);
+    j = draw(j, 1, buf, ATTRIB);
+    j = draw(j, 1, (uint8_t*)", zeroed idle ", ATTRIB);
+    ece391_itoa(stats.header.pool_zeroed, buf, 10);
+    j = draw(j, 1, buf, ATTRIB);
+    j = draw(j, 1, (uint8_t*)", saved Mcycles ", ATTRIB);
+    ece391_itoa(stats.header.pool_saved_mcycles, buf, 10);
+    draw(j, 1, buf, ATTRIB);
+
+    clear_row(2, HEADER_ATTRIB);
+    draw(0, 2, (uint8_t*)"PID PPID TTY NAME          %USR %SYS  SWITCH  SYSC/s    READ   WRITE  FAULT", HEADER_ATTRIB);
+
+    for (i = 0; i < MAX_PROCS; i++) {
+        row = 3 + i;
+        clear_row(row, ATTRIB);
+        if (i >= n)
+            continue;
+        p = &stats.procs[i];
+        if (p->pid < 0 || p->pid >= MAX_PROCS)
+            continue;
+
+        /* low 32 bits are enough for the difference between two samples */
+        user = (uint32_t)p->user_cycles - last_user[p->pid];
+        kernel = (uint32_t)p->kernel_cycles - last_kernel[p->pid];
+        last_user[p->pid] = (uint32_t)p->user_cycles;
+        last_kernel[p->pid] = (uint32_t)p->kernel_cycles;
+        calls = 0;
+        for (j = 0; j < ECE391_SYSCALL_SLOTS; j++)
+            calls += p->syscalls[j];
+        ece391_itoa(calls - last_syscalls[p->pid], buf, 10);
+        last_syscalls[p->pid] = calls;
+
+        draw_num(0, row, p->pid, 3);
+        if (p->parent_pid >= 0)
+            draw_num(4, row, p->parent_pid, 4);
+        else
+            draw(7, row, (uint8_t*)"-", ATTRIB);
+        draw_num(9, row, p->terminal + 1, 3);
+        p->name[ECE391_NAME_SIZE - 1] = '\0';
+        draw(13, row, p->name, ATTRIB);
+        draw_num(27, row, percent(user, elapsed), 4);
+        draw_num(32, row, percent(kernel, elapsed), 4);
+        draw_num(37, row, p->switches, 7);
+        draw(53 - ece391_strlen(buf), row, buf, ATTRIB);
+        draw_num(54, row, p->bytes_read, 7);
+        draw_num(62, row, p->bytes_written, 7);
+        draw_num(70, row, p->page_faults, 6);
+    }
+}
+
+/*
+ * Shows per-process CPU use on this terminal's screen through vidmap,
+ * refreshing REFRESH_HZ times a second. The argument is how many
+ * refreshes to do before exiting.
+ */
+int main ()
+{
+    int32_t rtc_fd, rate, garbage, refreshes, i;
+    uint8_t buf[32];
+
+    refreshes = DEFAULT_REFRESHES;
+    if (0 == ece391_getargs(buf, 32) && buf[0] >= '0' && buf[0] <= '9') {
+        refreshes = 0;
+        for (i = 0; buf[i] >= '0' && buf[i] <= '9'; i++)
+            refreshes = refreshes * 10 + (buf[i] - '0');
+    }
+
+    if (-1 == ece391_vidmap(&video)) {
+        ece391_fdputs(1, (uint8_t*)"vidmap failed\n");
+        return 2;
+    }
+    if (-1 == (rtc_fd = ece391_open((uint8_t*)"rtc"))) {
+        ece391_fdputs(1, (uint8_t*)"rtc open failed\n");
+        return 2;
+    }
+    rate = REFRESH_HZ;
+    ece391_write(rtc_fd, &rate, 4);
+
+    for (i = 0; i < NUM_ROWS; i++)
+        clear_row(i, ATTRIB);
+    while (refreshes-- > 0) {
+        refresh();
+        ece391_read(rtc_fd, &garbage, 4);
+    }
+
+    ece391_close(rtc_fd);
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+/* Must match trace_event_t in student-distrib/trace.h */
+typedef struct trace_event_t {
+    uint32_t tsc_lo;
+    uint32_t tsc_hi;
+    uint8_t type;
+    uint8_t cpu;
+    uint8_t pid;
+    uint8_t arg0;
+    uint32_t arg1;
+} trace_event_t;
+
+#define EVENTS_PER_READ 64
+#define LINE_SIZE 80
+
+static const char* event_names[] = {
+    "?", "sys_enter", "sys_exit", "switch", "irq_enter", "irq_exit", "page_fault"
+};
+#define NUM_EVENT_NAMES (sizeof(event_names) / sizeof(event_names[0]))
+
+/* appends value as 8 hex digits */
+static uint8_t* put_hex(uint8_t* p, uint32_t value)
+{
+    int32_t i;
+    for (i = 7; i >= 0; i--) {
+        p[i] = "0123456789abcdef"[value & 0xF];
+        value >>= 4;
+    }
+    return p + 8;
+}
+
+/* appends a decimal number then a space */
+static uint8_t* put_dec(uint8_t* p, uint32_t value)
+{
+    ece391_itoa(value, p, 10);
+    p += ece391_strlen(p);
+    *p++ = ' ';
+    return p;
+}
+
+/*
+ * Prints every event in the kernel trace, one per line:
+ *   <tsc as 16 hex digits> <event> <cpu> <pid> <arg0> <arg1 as hex>
+ * which is easy to turn into a timeline on the host. The kernel hands out
+ * one CPU's events after the other, sort on the tsc to merge them. pid
+ * 255 means no process, e.g. an interrupt of the idle loop.
+ */
+int main ()
+{
+    int32_t fd, cnt, i;
+    trace_event_t events[EVENTS_PER_READ];
+    uint8_t line[LINE_SIZE];
+    uint8_t* p;
+
+    if (-1 == (fd = ece391_open ((uint8_t*)"tracebuf"))) {
+        ece391_fdputs (1, (uint8_t*)"tracebuf open failed\n");
+        return 2;
+    }
+
+    while (0 != (cnt = ece391_read (fd, events, sizeof(events)))) {
+        if (-1 == cnt) {
+            ece391_fdputs (1, (uint8_t*)"tracebuf read failed\n");
+            return 3;
+        }
+        for (i = 0; i < cnt / (int32_t)sizeof(trace_event_t); i++) {
+            p = put_hex(line, events[i].tsc_hi);
+            p = put_hex(p, events[i].tsc_lo);
+            *p++ = ' ';
+            ece391_strcpy(p, (uint8_t*)event_names[events[i].type < NUM_EVENT_NAMES ? events[i].type : 0]);
+            p += ece391_strlen(p);
+            *p++ = ' ';
+            p = put_dec(p, events[i].cpu);
+            p = put_dec(p, events[i].pid);
+            p = put_dec(p, events[i].arg0);
+            p = put_hex(p, events[i].arg1);
+            *p++ = '\n';
+            if (-1 == ece391_write (1, line, p - line))
+                return 3;
+        }
+    }
+
+    ece391_close (fd);
+    return 0;
+}